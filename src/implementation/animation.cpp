@@ -0,0 +1,154 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "dmx_types.hpp"
+#include "thread_pool.hpp"
+#include <cstring>
+#include <type_traits>
+
+module source_engine.dmx;
+
+namespace source_engine::dmx {
+	using AttributeArray = std::vector<std::shared_ptr<Attribute>>;
+	static std::shared_ptr<Element> get_element_attribute(const Element &el, const std::string &name)
+	{
+		auto attr = el.GetAttr(name);
+		if(!attr || attr->type != AttrType::Element || !attr->data)
+			return nullptr;
+		return static_cast<ElementRef *>(attr->data.get())->lock();
+	}
+	static const AttributeArray *get_array_attribute(const Element &el, const std::string &name, AttrType type)
+	{
+		auto attr = el.GetAttr(name);
+		if(!attr || attr->type != type || !attr->data)
+			return nullptr;
+		return static_cast<const AttributeArray *>(attr->data.get());
+	}
+	static const AttributeArray *get_values_attribute(const Element &layer)
+	{
+		auto attr = layer.GetAttr("values");
+		if(!attr || !is_array_type(attr->type) || !attr->data)
+			return nullptr;
+		return static_cast<const AttributeArray *>(attr->data.get());
+	}
+};
+
+source_engine::dmx::LoadFilter source_engine::dmx::AnimationExtractor::GetLoadFilter()
+{
+	LoadFilter filter {};
+	filter.includeElementTypes.insert("DmeChannel");
+	for(auto *type : {"Float", "Int", "Bool", "Time", "Color", "Vector2", "Vector3", "Vector4", "QAngle", "Quaternion", "VMatrix", "String", "Binary", "Element"}) {
+		filter.includeElementTypes.insert(std::string {"Dme"} + type + "Log");
+		filter.includeElementTypes.insert(std::string {"Dme"} + type + "LogLayer");
+	}
+	filter.includeAttributes = {"log", "layers", "times", "values", "fromElement", "fromAttribute", "toElement", "toAttribute", "mode"};
+	return filter;
+}
+
+size_t source_engine::dmx::AnimationExtractor::GetValueSize(AttrType valueType)
+{
+	switch(valueType) {
+	case AttrType::Int:
+	case AttrType::Float:
+	case AttrType::Bool:
+	case AttrType::Time:
+	case AttrType::Color:
+	case AttrType::Vector2:
+	case AttrType::Vector3:
+	case AttrType::Vector4:
+	case AttrType::Angle:
+	case AttrType::Quaternion:
+	case AttrType::Matrix:
+	case AttrType::UInt64:
+	case AttrType::UInt8:
+		return visit_value_type(valueType, [](auto tag) -> size_t { return sizeof(typename decltype(tag)::type); });
+	default:
+		return 0;
+	}
+}
+
+source_engine::dmx::AnimationExtractor::AnimationExtractor(const FileData &fileData)
+{
+	for(auto &channel : fileData.GetElements()) {
+		if(channel->type != "DmeChannel")
+			continue;
+		auto log = get_element_attribute(*channel, "log");
+		if(!log)
+			continue;
+		auto *layers = get_array_attribute(*log, "layers", AttrType::ElementArray);
+		if(!layers)
+			continue;
+		for(auto &layerAttr : *layers) {
+			if(!layerAttr->data)
+				continue;
+			auto layer = static_cast<ElementRef *>(layerAttr->data.get())->lock();
+			if(!layer)
+				continue;
+			auto *times = get_array_attribute(*layer, "times", AttrType::TimeArray);
+			auto *values = get_values_attribute(*layer);
+			if(!times || !values)
+				continue;
+			AnimationLayer animLayer {};
+			animLayer.channel = channel;
+			animLayer.log = log;
+			animLayer.layer = layer;
+			animLayer.valueType = get_single_type(layer->GetAttr("values")->type);
+			animLayer.numSamples = std::min(times->size(), values->size());
+			m_layers.push_back(std::move(animLayer));
+		}
+	}
+}
+
+const std::vector<source_engine::dmx::AnimationLayer> &source_engine::dmx::AnimationExtractor::GetLayers() const { return m_layers; }
+
+bool source_engine::dmx::AnimationExtractor::Extract(size_t layerIndex, const Buffers &buffers) const
+{
+	if(layerIndex >= m_layers.size())
+		return false;
+	auto &animLayer = m_layers[layerIndex];
+	auto valueSize = GetValueSize(animLayer.valueType);
+	if(valueSize == 0)
+		return false;
+	auto *times = get_array_attribute(*animLayer.layer, "times", AttrType::TimeArray);
+	auto *values = get_values_attribute(*animLayer.layer);
+	if(!times || !values || std::min(times->size(), values->size()) < animLayer.numSamples)
+		return false; // Layer has been modified since the extractor was created
+	if(buffers.times || buffers.seconds) {
+		thread_local std::vector<Time> scratchTimes;
+		auto *outTimes = buffers.times;
+		if(!outTimes) {
+			scratchTimes.resize(animLayer.numSamples);
+			outTimes = scratchTimes.data();
+		}
+		for(size_t i = 0; i < animLayer.numSamples; ++i) {
+			auto &attr = (*times)[i];
+			outTimes[i] = attr->data ? *static_cast<const Time *>(attr->data.get()) : Time {};
+		}
+		if(buffers.seconds)
+			get_seconds(outTimes, buffers.seconds, animLayer.numSamples);
+	}
+	if(buffers.values) {
+		visit_value_type(animLayer.valueType, [&animLayer, values, &buffers](auto tag) {
+			using T = typename decltype(tag)::type;
+			if constexpr(std::is_trivially_copyable_v<T>) {
+				auto *out = static_cast<uint8_t *>(buffers.values);
+				for(size_t i = 0; i < animLayer.numSamples; ++i) {
+					auto &attr = (*values)[i];
+					if(attr->data)
+						std::memcpy(out + i * sizeof(T), attr->data.get(), sizeof(T));
+					else
+						std::memset(out + i * sizeof(T), 0, sizeof(T));
+				}
+			}
+		});
+	}
+	return true;
+}
+
+size_t source_engine::dmx::AnimationExtractor::ExtractAll(const std::vector<Buffers> &buffers, const Executor &executor) const
+{
+	auto numLayers = std::min(buffers.size(), m_layers.size());
+	return run_parallel_count(numLayers, [this, &buffers](size_t i) { return Extract(i, buffers[i]); }, executor);
+}
@@ -0,0 +1,71 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "dmx_types.hpp"
+#include "thread_pool.hpp"
+#include <sharedutils/util_ifile.hpp>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+module source_engine.dmx;
+
+source_engine::dmx::BatchLoader::BatchLoader(std::shared_ptr<StringInterner> stringInterner) : m_stringInterner {stringInterner ? std::move(stringInterner) : std::make_shared<StringInterner>()} {}
+
+const std::shared_ptr<source_engine::dmx::StringInterner> &source_engine::dmx::BatchLoader::GetStringInterner() const { return m_stringInterner; }
+
+std::vector<std::shared_ptr<source_engine::dmx::FileData>> source_engine::dmx::BatchLoader::Load(const std::vector<std::shared_ptr<ufile::IFile>> &files, const FileCallback &onFileLoaded, const LoadOptions &options)
+{
+	return Load(
+	  files.size(), [&files](size_t idx) { return files[idx]; }, onFileLoaded, options);
+}
+
+std::vector<std::shared_ptr<source_engine::dmx::FileData>> source_engine::dmx::BatchLoader::Load(size_t numFiles, const FileOpener &openFile, const FileCallback &onFileLoaded, const LoadOptions &loadOptions)
+{
+	if(loadOptions.schema)
+		throw std::invalid_argument {"Schemas can't be used with the batch loader!"};
+	std::vector<std::shared_ptr<FileData>> results;
+	results.resize(numFiles);
+	if(numFiles == 0)
+		return results;
+	auto options = loadOptions;
+	options.stringInterner = m_stringInterner;
+
+	// Contexts are taken for a file and put back afterwards, so there are no more of them than threads working on this call.
+	// They're released once all files have been loaded.
+	std::mutex contextMutex;
+	std::vector<std::unique_ptr<LoaderContext>> contexts;
+	run_parallel(numFiles, ThreadPool::GetDefault().GetThreadCount(), [&openFile, &onFileLoaded, &options, &results, &contextMutex, &contexts](size_t i) {
+		std::shared_ptr<FileData> fd = nullptr;
+		std::exception_ptr error = nullptr;
+		if(options.stopToken.stop_requested() == false) {
+			try {
+				auto f = openFile(i);
+				if(f) {
+					std::unique_ptr<LoaderContext> context = nullptr;
+					{
+						std::scoped_lock lock {contextMutex};
+						if(!contexts.empty()) {
+							context = std::move(contexts.back());
+							contexts.pop_back();
+						}
+					}
+					if(!context)
+						context = std::make_unique<LoaderContext>();
+					fd = FileData::Load(f, options, *context);
+					std::scoped_lock lock {contextMutex};
+					contexts.push_back(std::move(context));
+				}
+			}
+			catch(...) {
+				error = std::current_exception();
+			}
+		}
+		results[i] = fd;
+		if(onFileLoaded)
+			onFileLoaded(i, fd, error);
+	});
+	return results;
+}
@@ -0,0 +1,80 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "dmx_types.hpp"
+#include <utility>
+#include <vector>
+
+module source_engine.dmx;
+
+namespace source_engine::dmx {
+	static std::shared_ptr<Element> get_root_element(const std::shared_ptr<Attribute> &rootAttr)
+	{
+		if(!rootAttr || !rootAttr->data)
+			return nullptr;
+		return static_cast<ElementRef *>(rootAttr->data.get())->lock();
+	}
+	static void shrink_element(Element &el)
+	{
+		el.attributes.rehash(0);
+		el.nameToChildElement.rehash(0);
+		for(auto &pair : el.attributes) {
+			auto &attr = *pair.second;
+			// Shared arrays may be in use by another attribute, possibly on another thread
+			if(is_array_type(attr.type) && attr.data && attr.data.use_count() == 1)
+				static_cast<std::vector<std::shared_ptr<Attribute>> *>(attr.data.get())->shrink_to_fit();
+		}
+	}
+};
+
+std::vector<std::shared_ptr<source_engine::dmx::Element>> source_engine::dmx::FileData::FindUnreachableElements() const
+{
+	auto root = get_root_element(m_rootAttribute);
+	if(!root)
+		return {}; // Reachability is only defined relative to a root element
+	ElementTraversal traversal {m_elements};
+	std::vector<bool> reachable(traversal.GetElements().size(), false);
+	traversal.Traverse(*root, [&traversal, &reachable](Element &el, uint32_t) {
+		reachable[*traversal.FindIndex(el)] = true;
+		return ElementTraversal::Result::Continue;
+	});
+	std::vector<std::shared_ptr<Element>> unreachable {};
+	for(size_t i = 0; i < m_elements.size(); ++i) {
+		if(!reachable[i]) // Elements of m_elements come first in the traversal graph, in the same order
+			unreachable.push_back(m_elements[i]);
+	}
+	return unreachable;
+}
+
+std::vector<std::shared_ptr<source_engine::dmx::Element>> source_engine::dmx::FileData::Compact()
+{
+	auto root = get_root_element(m_rootAttribute);
+	if(!root) {
+		// Without a root element nothing is considered unreachable, so everything is kept
+		for(auto &el : m_elements)
+			shrink_element(*el);
+		m_elements.shrink_to_fit();
+		return {};
+	}
+	ElementTraversal traversal {m_elements};
+	std::vector<std::shared_ptr<Element>> survivors {};
+	std::vector<bool> reachable(traversal.GetElements().size(), false);
+	traversal.Traverse(*root, [&traversal, &reachable, &survivors](Element &el, uint32_t) {
+		auto idx = *traversal.FindIndex(el);
+		reachable[idx] = true;
+		survivors.push_back(traversal.GetElements()[idx]);
+		return ElementTraversal::Result::Continue;
+	});
+	std::vector<std::shared_ptr<Element>> removed {};
+	for(size_t i = 0; i < m_elements.size(); ++i) {
+		if(!reachable[i])
+			removed.push_back(std::move(m_elements[i]));
+	}
+	for(auto &el : survivors)
+		shrink_element(*el);
+	survivors.shrink_to_fit();
+	m_elements = std::move(survivors);
+	return removed;
+}
@@ -0,0 +1,483 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "dmx_types.hpp"
+#include <sharedutils/util_ifile.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#ifdef UTIL_DMX_WITH_ZSTD
+#include <zstd.h>
+#endif
+#ifdef UTIL_DMX_WITH_LZ4
+#include <lz4frame.h>
+#endif
+
+module source_engine.dmx;
+
+namespace source_engine::dmx {
+	constexpr std::array<uint8_t, 4> ZSTD_MAGIC = {0x28, 0xB5, 0x2F, 0xFD};
+	constexpr std::array<uint8_t, 4> LZ4_MAGIC = {0x04, 0x22, 0x4D, 0x18};
+	// Large enough for the frame header of either format
+	constexpr size_t MAX_FRAME_HEADER_SIZE = 18;
+	constexpr size_t INPUT_BLOCK_SIZE = 128 * 1'024;
+
+	static std::optional<size_t> read_frame_content_size(ufile::IFile &f, Compression compression)
+	{
+		auto startPos = f.Tell();
+		std::array<uint8_t, MAX_FRAME_HEADER_SIZE> header {};
+		auto headerSize = f.Read(header.data(), header.size());
+		f.Seek(startPos);
+		switch(compression) {
+		case Compression::Zstd:
+#ifdef UTIL_DMX_WITH_ZSTD
+			{
+				auto size = ZSTD_getFrameContentSize(header.data(), headerSize);
+				if(size == ZSTD_CONTENTSIZE_UNKNOWN || size == ZSTD_CONTENTSIZE_ERROR)
+					return {};
+				return static_cast<size_t>(size);
+			}
+#else
+			return {};
+#endif
+		case Compression::Lz4:
+			{
+				// Magic, FLG and BD bytes, followed by the content size if bit 3 of FLG is set
+				constexpr uint8_t FLAG_CONTENT_SIZE = 0x08;
+				if(headerSize < 14 || (header[4] & FLAG_CONTENT_SIZE) == 0)
+					return {};
+				uint64_t size = 0;
+				for(auto i = 0; i < 8; ++i)
+					size |= static_cast<uint64_t>(header[6 + i]) << (i * 8);
+				return static_cast<size_t>(size);
+			}
+		}
+		return {};
+	}
+
+	// Decompresses the source file on a dedicated thread, so parsing can start as soon as the first block is available.
+	// A thread of its own is used instead of the thread pool, since loads may already be running on the pool.
+	// Unless random access is requested, the decompressed data is held in a bounded window of chunks: The decompression
+	// thread waits while MAX_BUFFERED_CHUNKS chunks haven't been consumed yet, and chunks before the one preceding the read
+	// position are released and reused. Seeking back is only possible into the current or the previous chunk.
+	class DecompressingFile : public ufile::IFile {
+	  public:
+		DecompressingFile(const std::shared_ptr<ufile::IFile> &source, Compression compression, bool randomAccess) : m_source {source}, m_compression {compression}, m_retainAll {randomAccess}
+		{
+			m_contentSize = read_frame_content_size(*source, compression);
+			if(m_contentSize)
+				m_chunks.reserve(*m_contentSize / CHUNK_SIZE + 1);
+			m_thread = std::thread {[this]() { Decompress(); }};
+		}
+		virtual ~DecompressingFile() override
+		{
+			{
+				std::scoped_lock lock {m_mutex};
+				m_cancel = true;
+			}
+			m_condition.notify_all();
+			m_thread.join();
+		}
+		virtual size_t Read(void *data, size_t size) override
+		{
+			auto *out = static_cast<uint8_t *>(data);
+			size_t numRead = 0;
+			while(numRead < size) {
+				auto available = WaitForPosition();
+				if(m_pos >= available)
+					break;
+				auto offset = m_pos % CHUNK_SIZE;
+				auto n = std::min({size - numRead, available - m_pos, CHUNK_SIZE - offset});
+				std::memcpy(out + numRead, GetChunk(m_pos / CHUNK_SIZE) + offset, n);
+				m_pos += n;
+				numRead += n;
+			}
+			return numRead;
+		}
+		virtual size_t Write(const void *data, size_t size) override { return 0; }
+		virtual size_t Tell() override { return m_pos; }
+		virtual void Seek(size_t offset, Whence whence = Whence::Set) override
+		{
+			switch(whence) {
+			case Whence::Set:
+				m_pos = offset;
+				break;
+			case Whence::Cur:
+				m_pos += offset;
+				break;
+			case Whence::End:
+				m_pos = GetSize() + offset;
+				break;
+			}
+		}
+		virtual int32_t ReadChar() override
+		{
+			// Fast path for the common case of the data already being available
+			if(m_pos < m_available.load(std::memory_order_acquire) && m_pos / CHUNK_SIZE == m_cachedChunkIndex)
+				return static_cast<char>(m_cachedChunk[m_pos++ % CHUNK_SIZE]);
+			char c;
+			if(Read(&c, 1) != 1)
+				return EOF;
+			return c;
+		}
+		virtual size_t GetSize() override
+		{
+			if(m_contentSize)
+				return *m_contentSize;
+			// The size is only known once everything has been decompressed, which requires all of it to be kept
+			{
+				std::scoped_lock lock {m_mutex};
+				m_retainAll = true;
+			}
+			m_condition.notify_all();
+			return WaitForData(std::numeric_limits<size_t>::max());
+		}
+		virtual bool Eof() override { return m_pos >= WaitForPosition(); }
+		virtual std::optional<std::string> GetFileName() const override { return m_source->GetFileName(); }
+	  private:
+		static constexpr size_t CHUNK_SIZE = 1'024 * 1'024;
+		static constexpr size_t MAX_BUFFERED_CHUNKS = 4;
+		struct Cancelled {};
+
+		// Releases the chunks the reader can no longer seek back to, then waits for the data at the read position
+		size_t WaitForPosition()
+		{
+			Release(m_pos / CHUNK_SIZE);
+			return WaitForData(m_pos + 1);
+		}
+		void Release(size_t chunkIndex)
+		{
+			auto firstRetained = (chunkIndex > 0) ? chunkIndex - 1 : 0;
+			{
+				std::scoped_lock lock {m_mutex};
+				if(m_retainAll || firstRetained <= m_firstRetained)
+					return;
+				m_firstRetained = firstRetained;
+				// The chunk that is still being written is freed by the decompression thread once it has moved on
+				FreeChunks(std::min(firstRetained, m_available.load(std::memory_order_relaxed) / CHUNK_SIZE));
+			}
+			if(m_cachedChunkIndex < firstRetained)
+				m_cachedChunkIndex = std::numeric_limits<size_t>::max();
+			m_condition.notify_all();
+		}
+
+		// Moves the chunks before limit to the free list; Has to be called with m_mutex locked
+		void FreeChunks(size_t limit)
+		{
+			for(; m_numFreedChunks < limit; ++m_numFreedChunks) {
+				if(m_chunks[m_numFreedChunks])
+					m_freeChunks.push_back(std::move(m_chunks[m_numFreedChunks]));
+			}
+		}
+
+		// Blocks until at least size bytes have been decompressed or decompression has ended, and returns the number of available bytes
+		size_t WaitForData(size_t size)
+		{
+			auto available = m_available.load(std::memory_order_acquire);
+			if(available >= size)
+				return available;
+			std::unique_lock lock {m_mutex};
+			m_condition.wait(lock, [this, size]() { return m_finished || m_available.load(std::memory_order_relaxed) >= size; });
+			if(m_error)
+				std::rethrow_exception(m_error);
+			return m_available.load(std::memory_order_relaxed);
+		}
+		const uint8_t *GetChunk(size_t index)
+		{
+			if(index != m_cachedChunkIndex) {
+				std::scoped_lock lock {m_mutex};
+				if(index < m_firstRetained || !m_chunks[index])
+					throw std::runtime_error {"Unable to seek back in streamed decompressed dmx data: The data at this position has already been released!"};
+				m_cachedChunk = m_chunks[index].get();
+				m_cachedChunkIndex = index;
+			}
+			return m_cachedChunk;
+		}
+
+		// Producer side; Returns the free space at the end of the last chunk
+		std::pair<uint8_t *, size_t> GetWriteBuffer()
+		{
+			auto offset = m_written % CHUNK_SIZE;
+			auto chunkIndex = m_written / CHUNK_SIZE;
+			std::unique_lock lock {m_mutex};
+			if(offset == 0 && chunkIndex == m_chunks.size()) {
+				// Backpressure: Wait until the reader has consumed enough of the buffered data
+				m_condition.wait(lock, [this, chunkIndex]() { return m_cancel || m_retainAll || chunkIndex < m_firstRetained + MAX_BUFFERED_CHUNKS; });
+				if(m_cancel)
+					throw Cancelled {};
+				// Chunks the reader has skipped over are released as soon as they're complete
+				FreeChunks(std::min(m_firstRetained, chunkIndex));
+				std::unique_ptr<uint8_t[]> chunk = nullptr;
+				if(!m_freeChunks.empty()) {
+					chunk = std::move(m_freeChunks.back());
+					m_freeChunks.pop_back();
+				}
+				else
+					chunk = std::make_unique<uint8_t[]>(CHUNK_SIZE);
+				m_chunks.push_back(std::move(chunk));
+			}
+			return {m_chunks[chunkIndex].get() + offset, CHUNK_SIZE - offset};
+		}
+		void Commit(size_t size)
+		{
+			if(size == 0)
+				return;
+			m_written += size;
+			if(m_contentSize && m_written > *m_contentSize)
+				throw std::runtime_error {"Decompressed data is larger than declared in frame header!"};
+			{
+				std::scoped_lock lock {m_mutex};
+				m_available.store(m_written, std::memory_order_release);
+			}
+			m_condition.notify_all();
+		}
+		void Decompress()
+		{
+			try {
+				switch(m_compression) {
+#ifdef UTIL_DMX_WITH_ZSTD
+				case Compression::Zstd:
+					DecompressZstd();
+					break;
+#endif
+#ifdef UTIL_DMX_WITH_LZ4
+				case Compression::Lz4:
+					DecompressLz4();
+					break;
+#endif
+				default:
+					throw std::runtime_error {"Unsupported compression format!"};
+				}
+				if(m_contentSize && m_written != *m_contentSize && !m_cancel)
+					throw std::runtime_error {"Decompressed data is smaller than declared in frame header!"};
+			}
+			catch(const Cancelled &) {
+			}
+			catch(...) {
+				std::scoped_lock lock {m_mutex};
+				m_error = std::current_exception();
+			}
+			{
+				std::scoped_lock lock {m_mutex};
+				m_finished = true;
+			}
+			m_condition.notify_all();
+		}
+#ifdef UTIL_DMX_WITH_ZSTD
+		void DecompressZstd()
+		{
+			std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> ctx {ZSTD_createDCtx(), &ZSTD_freeDCtx};
+			std::vector<uint8_t> input(ZSTD_DStreamInSize());
+			size_t result = 0;
+			while(!m_cancel) {
+				auto n = m_source->Read(input.data(), input.size());
+				if(n == 0)
+					break;
+				ZSTD_inBuffer in {input.data(), n, 0};
+				// The decoder may still hold data after all input has been consumed if the output buffer was filled up
+				auto outputFull = false;
+				do {
+					auto [buffer, bufferSize] = GetWriteBuffer();
+					ZSTD_outBuffer out {buffer, bufferSize, 0};
+					result = ZSTD_decompressStream(ctx.get(), &out, &in);
+					if(ZSTD_isError(result))
+						throw std::runtime_error {std::string {"Failed to decompress zstd data: "} + ZSTD_getErrorName(result)};
+					Commit(out.pos);
+					outputFull = (out.pos == out.size);
+				} while(in.pos < in.size || (outputFull && result != 0));
+			}
+			if(result != 0 && !m_cancel)
+				throw std::runtime_error {"Compressed dmx data is truncated!"};
+		}
+#endif
+#ifdef UTIL_DMX_WITH_LZ4
+		void DecompressLz4()
+		{
+			LZ4F_dctx *dctx = nullptr;
+			if(LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION)))
+				throw std::runtime_error {"Failed to create LZ4 decompression context!"};
+			std::unique_ptr<LZ4F_dctx, decltype(&LZ4F_freeDecompressionContext)> ctx {dctx, &LZ4F_freeDecompressionContext};
+			std::vector<uint8_t> input(INPUT_BLOCK_SIZE);
+			size_t result = 0;
+			while(!m_cancel) {
+				auto n = m_source->Read(input.data(), input.size());
+				if(n == 0)
+					break;
+				size_t pos = 0;
+				auto outputFull = false;
+				do {
+					auto [buffer, bufferSize] = GetWriteBuffer();
+					auto dstSize = bufferSize;
+					auto srcSize = n - pos;
+					result = LZ4F_decompress(ctx.get(), buffer, &dstSize, input.data() + pos, &srcSize, nullptr);
+					if(LZ4F_isError(result))
+						throw std::runtime_error {std::string {"Failed to decompress LZ4 data: "} + LZ4F_getErrorName(result)};
+					Commit(dstSize);
+					pos += srcSize;
+					outputFull = (dstSize == bufferSize);
+				} while(pos < n || (outputFull && result != 0));
+			}
+			if(result != 0 && !m_cancel)
+				throw std::runtime_error {"Compressed dmx data is truncated!"};
+		}
+#endif
+
+		std::shared_ptr<ufile::IFile> m_source;
+		Compression m_compression;
+		std::optional<size_t> m_contentSize {};
+		std::thread m_thread;
+		std::atomic<bool> m_cancel = false;
+
+		// Chunks don't move while they're retained, only the vectors holding them are guarded by m_mutex. Released chunks are null.
+		std::vector<std::unique_ptr<uint8_t[]>> m_chunks;
+		std::vector<std::unique_ptr<uint8_t[]>> m_freeChunks;
+		size_t m_firstRetained = 0; // Chunks before this one can't be read anymore
+		size_t m_numFreedChunks = 0;
+		bool m_retainAll = false;
+		std::atomic<size_t> m_available = 0;
+		size_t m_written = 0;
+		bool m_finished = false;
+		std::exception_ptr m_error {};
+		std::mutex m_mutex;
+		std::condition_variable m_condition;
+
+		// Reader side
+		size_t m_pos = 0;
+		size_t m_cachedChunkIndex = std::numeric_limits<size_t>::max();
+		const uint8_t *m_cachedChunk = nullptr;
+	};
+};
+
+source_engine::dmx::Compression source_engine::dmx::detect_compression(ufile::IFile &f)
+{
+	auto startPos = f.Tell();
+	std::array<uint8_t, 4> magic {};
+	auto n = f.Read(magic.data(), magic.size());
+	f.Seek(startPos);
+	if(n != magic.size())
+		return Compression::None;
+	if(magic == ZSTD_MAGIC)
+		return Compression::Zstd;
+	if(magic == LZ4_MAGIC)
+		return Compression::Lz4;
+	return Compression::None;
+}
+
+bool source_engine::dmx::is_compression_supported(Compression compression)
+{
+	switch(compression) {
+	case Compression::None:
+		return true;
+	case Compression::Zstd:
+#ifdef UTIL_DMX_WITH_ZSTD
+		return true;
+#else
+		return false;
+#endif
+	case Compression::Lz4:
+#ifdef UTIL_DMX_WITH_LZ4
+		return true;
+#else
+		return false;
+#endif
+	}
+	return false;
+}
+
+std::shared_ptr<ufile::IFile> source_engine::dmx::open_decompressed(const std::shared_ptr<ufile::IFile> &f, bool randomAccess)
+{
+	auto compression = detect_compression(*f);
+	if(compression == Compression::None)
+		return f;
+	if(!is_compression_supported(compression))
+		throw std::runtime_error {"Unable to load compressed dmx file: Library has been built without support for " + std::string {compression == Compression::Zstd ? "zstd" : "LZ4"} + "!"};
+	return std::make_shared<DecompressingFile>(f, compression, randomAccess);
+}
+
+void source_engine::dmx::compress_dmx(ufile::IFile &in, ufile::IFile &out, const CompressionOptions &options)
+{
+	if(!is_compression_supported(options.compression))
+		throw std::runtime_error {"Compression format is not supported by this build!"};
+	// The content size is stored in the frame header, so readers can size their buffers up front
+	auto startPos = in.Tell();
+	auto size = in.GetSize() - startPos;
+	std::vector<uint8_t> input(INPUT_BLOCK_SIZE);
+	switch(options.compression) {
+	case Compression::None:
+		for(auto n = in.Read(input.data(), input.size()); n > 0; n = in.Read(input.data(), input.size()))
+			out.Write(input.data(), n);
+		break;
+#ifdef UTIL_DMX_WITH_ZSTD
+	case Compression::Zstd:
+		{
+			std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> ctx {ZSTD_createCCtx(), &ZSTD_freeCCtx};
+			auto check = [](size_t result) {
+				if(ZSTD_isError(result))
+					throw std::runtime_error {std::string {"Failed to compress zstd data: "} + ZSTD_getErrorName(result)};
+				return result;
+			};
+			check(ZSTD_CCtx_setParameter(ctx.get(), ZSTD_c_compressionLevel, options.level.value_or(ZSTD_CLEVEL_DEFAULT)));
+			check(ZSTD_CCtx_setParameter(ctx.get(), ZSTD_c_checksumFlag, 1));
+			check(ZSTD_CCtx_setPledgedSrcSize(ctx.get(), size));
+			std::vector<uint8_t> output(ZSTD_CStreamOutSize());
+			size_t numRead = 0;
+			for(;;) {
+				auto n = in.Read(input.data(), input.size());
+				numRead += n;
+				auto last = (n == 0 || numRead >= size);
+				ZSTD_inBuffer inBuf {input.data(), n, 0};
+				auto finished = false;
+				do {
+					ZSTD_outBuffer outBuf {output.data(), output.size(), 0};
+					auto remaining = check(ZSTD_compressStream2(ctx.get(), &outBuf, &inBuf, last ? ZSTD_e_end : ZSTD_e_continue));
+					out.Write(output.data(), outBuf.pos);
+					finished = last ? (remaining == 0) : (inBuf.pos == inBuf.size);
+				} while(!finished);
+				if(last)
+					break;
+			}
+			break;
+		}
+#endif
+#ifdef UTIL_DMX_WITH_LZ4
+	case Compression::Lz4:
+		{
+			LZ4F_cctx *cctx = nullptr;
+			if(LZ4F_isError(LZ4F_createCompressionContext(&cctx, LZ4F_VERSION)))
+				throw std::runtime_error {"Failed to create LZ4 compression context!"};
+			std::unique_ptr<LZ4F_cctx, decltype(&LZ4F_freeCompressionContext)> ctx {cctx, &LZ4F_freeCompressionContext};
+			auto check = [](size_t result) {
+				if(LZ4F_isError(result))
+					throw std::runtime_error {std::string {"Failed to compress LZ4 data: "} + LZ4F_getErrorName(result)};
+				return result;
+			};
+			LZ4F_preferences_t prefs {};
+			prefs.frameInfo.contentSize = size;
+			prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+			prefs.compressionLevel = options.level.value_or(0);
+			std::vector<uint8_t> output(std::max<size_t>(LZ4F_compressBound(input.size(), &prefs), LZ4F_HEADER_SIZE_MAX));
+			out.Write(output.data(), check(LZ4F_compressBegin(ctx.get(), output.data(), output.size(), &prefs)));
+			size_t numRead = 0;
+			while(numRead < size) {
+				auto n = in.Read(input.data(), input.size());
+				if(n == 0)
+					break;
+				numRead += n;
+				out.Write(output.data(), check(LZ4F_compressUpdate(ctx.get(), output.data(), output.size(), input.data(), n, nullptr)));
+			}
+			out.Write(output.data(), check(LZ4F_compressEnd(ctx.get(), output.data(), output.size(), nullptr)));
+			break;
+		}
+#endif
+	default:
+		break;
+	}
+}
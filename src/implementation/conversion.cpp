@@ -0,0 +1,222 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "dmx_types.hpp"
+#include "simd.hpp"
+#include <array>
+#include <string_view>
+#include <cstring>
+
+module source_engine.dmx;
+
+namespace source_engine::dmx {
+	static constexpr uint8_t HEX_WHITESPACE = 0xFE;
+	static constexpr uint8_t HEX_INVALID = 0xFF;
+	static constexpr auto s_hexTable = []() {
+		std::array<uint8_t, 256> table {};
+		for(auto &v : table)
+			v = HEX_INVALID;
+		for(auto c = '0'; c <= '9'; ++c)
+			table[static_cast<uint8_t>(c)] = c - '0';
+		for(auto c = 'a'; c <= 'f'; ++c)
+			table[static_cast<uint8_t>(c)] = c - 'a' + 10;
+		for(auto c = 'A'; c <= 'F'; ++c)
+			table[static_cast<uint8_t>(c)] = c - 'A' + 10;
+		for(auto c : {' ', '\t', '\n', '\r'})
+			table[static_cast<uint8_t>(c)] = HEX_WHITESPACE;
+		return table;
+	}();
+
+#ifdef UTIL_DMX_SIMD_SSE2
+	// Converts 16 hex characters to nibbles; Returns false if any of the characters is not a hex digit
+	static bool hex_to_nibbles(__m128i chars, __m128i &outNibbles)
+	{
+		auto digits = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+		auto isDigit = _mm_cmpeq_epi8(_mm_min_epu8(digits, _mm_set1_epi8(9)), digits);
+		auto letters = _mm_sub_epi8(_mm_or_si128(chars, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+		auto isLetter = _mm_cmpeq_epi8(_mm_min_epu8(letters, _mm_set1_epi8(5)), letters);
+		if(_mm_movemask_epi8(_mm_or_si128(isDigit, isLetter)) != 0xFFFF)
+			return false;
+		outNibbles = _mm_or_si128(_mm_and_si128(isDigit, digits), _mm_andnot_si128(isDigit, _mm_add_epi8(letters, _mm_set1_epi8(10))));
+		return true;
+	}
+	// Decodes 32 hex characters into 16 bytes
+	static bool decode_hex_block(const char *in, uint8_t *out)
+	{
+		__m128i n0, n1;
+		if(hex_to_nibbles(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in)), n0) == false || hex_to_nibbles(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 16)), n1) == false)
+			return false;
+		// Each 16-bit lane contains the high nibble in its low byte and the low nibble in its high byte
+		auto lowByteMask = _mm_set1_epi16(0x00FF);
+		auto b0 = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(n0, lowByteMask), 4), _mm_srli_epi16(n0, 8));
+		auto b1 = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(n1, lowByteMask), 4), _mm_srli_epi16(n1, 8));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_packus_epi16(b0, b1));
+		return true;
+	}
+#endif
+};
+
+bool source_engine::dmx::decode_hex(std::string_view hex, Binary &outData)
+{
+	outData.resize(hex.size() / 2);
+	auto *out = outData.data();
+	auto *p = hex.data();
+	auto *end = p + hex.size();
+	auto pendingNibble = HEX_INVALID;
+	while(p < end) {
+#ifdef UTIL_DMX_SIMD_SSE2
+		if(pendingNibble == HEX_INVALID) {
+			while(end - p >= 32 && decode_hex_block(p, out)) {
+				p += 32;
+				out += 16;
+			}
+		}
+#endif
+		// Scalar path for line breaks, the tail and anything the vectorized path rejected.
+		// We only have to advance until the next whitespace has been skipped before retrying the vectorized path.
+		auto skippedWhitespace = false;
+		while(p < end) {
+			auto v = s_hexTable[static_cast<uint8_t>(*p)];
+			if(v == HEX_WHITESPACE) {
+				skippedWhitespace = true;
+				++p;
+				continue;
+			}
+			if(skippedWhitespace && pendingNibble == HEX_INVALID)
+				break;
+			if(v == HEX_INVALID) {
+				outData.clear();
+				return false;
+			}
+			if(pendingNibble == HEX_INVALID)
+				pendingNibble = v;
+			else {
+				*(out++) = (pendingNibble << 4) | v;
+				pendingNibble = HEX_INVALID;
+			}
+			++p;
+		}
+	}
+	if(pendingNibble != HEX_INVALID) {
+		// Odd number of hex digits
+		outData.clear();
+		return false;
+	}
+	outData.resize(out - outData.data());
+	return true;
+}
+
+source_engine::dmx::ObjectId source_engine::dmx::parse_object_id(std::string_view str)
+{
+	// Format: "xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx"
+	ObjectId id {};
+	size_t numNibbles = 0;
+	for(auto c : str) {
+		uint8_t nibble;
+		if(c >= '0' && c <= '9')
+			nibble = c - '0';
+		else if(c >= 'a' && c <= 'f')
+			nibble = c - 'a' + 10;
+		else if(c >= 'A' && c <= 'F')
+			nibble = c - 'A' + 10;
+		else
+			continue;
+		if(numNibbles >= id.size() * 2)
+			break;
+		id[numNibbles / 2] |= (numNibbles % 2 == 0) ? (nibble << 4) : nibble;
+		++numNibbles;
+	}
+	return id;
+}
+
+void source_engine::dmx::get_seconds(const Time *times, float *outSeconds, size_t count)
+{
+	size_t i = 0;
+#ifdef UTIL_DMX_SIMD_SSE2
+	// Divided in double precision, so that the results are identical to Time::GetSeconds
+	auto divisor = _mm_set1_pd(Time::TICKS_PER_SECOND);
+	for(; i + 4 <= count; i += 4) {
+		auto ticks = _mm_loadu_si128(reinterpret_cast<const __m128i *>(times + i));
+		auto lo = _mm_cvtpd_ps(_mm_div_pd(_mm_cvtepi32_pd(ticks), divisor));
+		auto hi = _mm_cvtpd_ps(_mm_div_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(ticks, _MM_SHUFFLE(1, 0, 3, 2))), divisor));
+		_mm_storeu_ps(outSeconds + i, _mm_movelh_ps(lo, hi));
+	}
+#endif
+	for(; i < count; ++i)
+		outSeconds[i] = times[i].GetSeconds();
+}
+void source_engine::dmx::get_seconds(const Time *times, double *outSeconds, size_t count)
+{
+	size_t i = 0;
+#ifdef UTIL_DMX_SIMD_SSE2
+	auto divisor = _mm_set1_pd(Time::TICKS_PER_SECOND);
+	for(; i + 4 <= count; i += 4) {
+		auto ticks = _mm_loadu_si128(reinterpret_cast<const __m128i *>(times + i));
+		_mm_storeu_pd(outSeconds + i, _mm_div_pd(_mm_cvtepi32_pd(ticks), divisor));
+		_mm_storeu_pd(outSeconds + i + 2, _mm_div_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(ticks, _MM_SHUFFLE(1, 0, 3, 2))), divisor));
+	}
+#endif
+	for(; i < count; ++i)
+		outSeconds[i] = times[i].GetSecondsDouble();
+}
+
+namespace source_engine::dmx {
+	static_assert(sizeof(Quaternion) == sizeof(float) * 4);
+	// Depending on the glm configuration, quaternions are either stored as x y z w (same as dmx) or w x y z
+	static bool is_quaternion_layout_xyzw()
+	{
+		static const auto xyzw = []() {
+			Quaternion q {1.f, 2.f, 3.f, 4.f}; // w x y z
+			std::array<float, 4> components;
+			std::memcpy(components.data(), &q, sizeof(q));
+			return components[0] == 2.f;
+		}();
+		return xyzw;
+	}
+};
+
+void source_engine::dmx::decode_quaternions(const float *xyzw, Quaternion *outQuats, size_t count)
+{
+	if(is_quaternion_layout_xyzw()) {
+		std::memcpy(static_cast<void *>(outQuats), xyzw, count * sizeof(Quaternion));
+		return;
+	}
+	auto *out = reinterpret_cast<float *>(outQuats);
+	size_t i = 0;
+#ifdef UTIL_DMX_SIMD_SSE2
+	for(; i < count; ++i) {
+		auto v = _mm_loadu_ps(xyzw + i * 4);
+		_mm_storeu_ps(out + i * 4, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 1, 0, 3)));
+	}
+#endif
+	for(; i < count; ++i) {
+		auto *in = xyzw + i * 4;
+		outQuats[i] = Quaternion {in[3], in[0], in[1], in[2]};
+	}
+}
+
+void source_engine::dmx::encode_quaternions(const Quaternion *quats, float *outXyzw, size_t count)
+{
+	if(is_quaternion_layout_xyzw()) {
+		std::memcpy(outXyzw, static_cast<const void *>(quats), count * sizeof(Quaternion));
+		return;
+	}
+	auto *in = reinterpret_cast<const float *>(quats);
+	size_t i = 0;
+#ifdef UTIL_DMX_SIMD_SSE2
+	for(; i < count; ++i) {
+		auto v = _mm_loadu_ps(in + i * 4);
+		_mm_storeu_ps(outXyzw + i * 4, _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 3, 2, 1)));
+	}
+#endif
+	for(; i < count; ++i) {
+		auto &q = quats[i];
+		auto *out = outXyzw + i * 4;
+		out[0] = q.x;
+		out[1] = q.y;
+		out[2] = q.z;
+		out[3] = q.w;
+	}
+}
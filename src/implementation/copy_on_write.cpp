@@ -0,0 +1,99 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "dmx_types.hpp"
+#include <unordered_map>
+#include <vector>
+
+module source_engine.dmx;
+
+namespace source_engine::dmx {
+	// Creates the shallow copies of the elements of a snapshot. Element references have to point to the copies, and array
+	// items are attributes of their own, so element values and arrays are the only value blocks that aren't shared.
+	class SnapshotBuilder {
+	  public:
+		std::shared_ptr<Element> &GetCopy(const Element &el)
+		{
+			auto &copy = m_copies[&el];
+			if(copy == nullptr) {
+				copy = std::make_shared<Element>();
+				copy->type = el.type;
+				copy->name = el.name;
+				copy->GUID = el.GUID;
+				copy->m_readOnly = true;
+				m_pending.push_back({&el, copy});
+			}
+			return copy;
+		}
+		std::shared_ptr<Attribute> CopyAttribute(const Attribute &src)
+		{
+			auto attr = std::make_shared<Attribute>();
+			attr->type = src.type;
+			attr->m_readOnly = true;
+			if(src.data == nullptr)
+				return attr;
+			if(src.type == AttrType::Element)
+				attr->data = CopyElementRef(*static_cast<const ElementRef *>(src.data.get()));
+			else if(is_array_type(src.type)) {
+				auto &srcArray = *static_cast<const std::vector<std::shared_ptr<Attribute>> *>(src.data.get());
+				auto array = std::make_shared<std::vector<std::shared_ptr<Attribute>>>();
+				array->reserve(srcArray.size());
+				for(auto &item : srcArray)
+					array->push_back(item ? CopyAttribute(*item) : nullptr);
+				attr->data = array;
+			}
+			else
+				attr->data = src.data;
+			return attr;
+		}
+		// Copies the attributes of all elements that have been reached so far, which may reach further elements
+		void Process()
+		{
+			for(size_t i = 0; i < m_pending.size(); ++i) {
+				auto [src, dst] = m_pending[i];
+				dst->attributes.reserve(src->attributes.size());
+				for(auto &pair : src->attributes)
+					dst->attributes[pair.first] = CopyAttribute(*pair.second);
+				for(auto &pair : src->nameToChildElement) {
+					if(auto child = pair.second.lock())
+						dst->nameToChildElement[pair.first] = GetCopy(*child);
+				}
+			}
+		}
+		std::vector<std::shared_ptr<Element>> TakeElements()
+		{
+			std::vector<std::shared_ptr<Element>> elements {};
+			elements.reserve(m_pending.size());
+			for(auto &pair : m_pending)
+				elements.push_back(std::move(pair.second));
+			return elements;
+		}
+	  private:
+		std::shared_ptr<ElementRef> CopyElementRef(const ElementRef &ref)
+		{
+			auto el = ref.lock();
+			return std::make_shared<ElementRef>(el ? ElementRef {GetCopy(*el)} : ElementRef {});
+		}
+		std::unordered_map<const Element *, std::shared_ptr<Element>> m_copies;
+		std::vector<std::pair<const Element *, std::shared_ptr<Element>>> m_pending;
+	};
+};
+
+std::shared_ptr<const source_engine::dmx::FileData> source_engine::dmx::FileData::Snapshot() const
+{
+	SnapshotBuilder builder {};
+	for(auto &el : m_elements)
+		builder.GetCopy(*el);
+	std::shared_ptr<Attribute> rootAttr = nullptr;
+	if(m_rootAttribute)
+		rootAttr = builder.CopyAttribute(*m_rootAttribute);
+	builder.Process();
+
+	auto fd = std::shared_ptr<FileData>(new FileData());
+	// Elements that are only referenced, but not part of the element list, are appended so that the snapshot keeps them alive
+	fd->m_elements = builder.TakeElements();
+	fd->m_rootAttribute = rootAttr;
+	return fd;
+}
@@ -0,0 +1,275 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "dmx_types.hpp"
+#include <array>
+#include <cstring>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include "definitions.hpp"
+
+module source_engine.dmx;
+
+namespace source_engine::dmx {
+	struct GUIDHash {
+		size_t operator()(const util::GUID &guid) const
+		{
+			uint64_t a, b;
+			memcpy(&a, guid.data(), sizeof(a));
+			memcpy(&b, guid.data() + sizeof(a), sizeof(b));
+			return std::hash<uint64_t> {}(a ^ (b * 0x9E3779B97F4A7C15ull));
+		}
+	};
+	using GUIDElementMap = std::unordered_map<util::GUID, std::shared_ptr<Element>, GUIDHash>;
+	// An all-zero GUID is a placeholder and doesn't identify an element
+	static bool is_zero_guid(const util::GUID &guid) { return std::all_of(guid.begin(), guid.end(), [](uint8_t b) { return b == 0; }); }
+	static GUIDElementMap build_guid_map(const std::vector<std::shared_ptr<Element>> &elements)
+	{
+		GUIDElementMap map {};
+		map.reserve(elements.size());
+		for(auto &el : elements) {
+			if(is_zero_guid(el->GUID))
+				continue;
+			map.insert(std::make_pair(el->GUID, el)); // If there are duplicate GUIDs, the first element wins
+		}
+		return map;
+	}
+
+	template<typename T>
+	static bool values_equal(const T &a, const T &b)
+	{
+		if constexpr(std::is_same_v<T, ElementRef>) {
+			// Element references are considered equal if they point to the same element by GUID
+			auto elA = a.lock();
+			auto elB = b.lock();
+			if(!elA || !elB)
+				return !elA && !elB;
+			return elA->GUID == elB->GUID;
+		}
+		else if constexpr(std::is_trivially_copyable_v<T>) {
+			// Compared bitwise, so that NaN values are equal to themselves and unchanged values aren't reported as changed
+			return memcmp(&a, &b, sizeof(T)) == 0;
+		}
+		else
+			return a == b;
+	}
+	static bool attributes_equal(const Attribute &a, const Attribute &b)
+	{
+		if(a.type != b.type)
+			return false;
+		if(a.data == nullptr || b.data == nullptr)
+			return a.data == b.data;
+		if(is_array_type(a.type)) {
+			auto &valuesA = *static_cast<const std::vector<std::shared_ptr<Attribute>> *>(a.data.get());
+			auto &valuesB = *static_cast<const std::vector<std::shared_ptr<Attribute>> *>(b.data.get());
+			if(valuesA.size() != valuesB.size())
+				return false;
+			for(size_t i = 0; i < valuesA.size(); ++i) {
+				if(attributes_equal(*valuesA[i], *valuesB[i]) == false)
+					return false;
+			}
+			return true;
+		}
+		if(is_single_type(a.type) == false)
+			return true;
+		return visit_value_type(a.type, [&a, &b](auto tag) -> bool {
+			using T = typename decltype(tag)::type;
+			return values_equal(*static_cast<const T *>(a.data.get()), *static_cast<const T *>(b.data.get()));
+		});
+	}
+
+	// Copies the value of an attribute; Element references are redirected to the element with the same GUID in the target element map
+	static void copy_attribute_value(const Attribute &src, Attribute &dst, const GUIDElementMap &targetElements)
+	{
+		dst.type = src.type;
+		if(src.data == nullptr) {
+			dst.data = nullptr;
+			return;
+		}
+		if(is_array_type(src.type)) {
+			auto &srcValues = *static_cast<const std::vector<std::shared_ptr<Attribute>> *>(src.data.get());
+			auto dstValues = std::make_shared<std::vector<std::shared_ptr<Attribute>>>();
+			dstValues->reserve(srcValues.size());
+			for(auto &srcValue : srcValues) {
+				auto dstValue = std::make_shared<Attribute>();
+				copy_attribute_value(*srcValue, *dstValue, targetElements);
+				dstValues->push_back(dstValue);
+			}
+			dst.data = dstValues;
+			return;
+		}
+		if(src.type == AttrType::Element) {
+			auto ref = std::make_shared<ElementRef>();
+			auto el = static_cast<const ElementRef *>(src.data.get())->lock();
+			if(el) {
+				auto it = targetElements.find(el->GUID);
+				if(it != targetElements.end())
+					*ref = it->second;
+			}
+			dst.data = ref;
+			return;
+		}
+		if(is_single_type(src.type) == false) {
+			dst.data = nullptr;
+			return;
+		}
+		dst.data = visit_value_type(src.type, [&src](auto tag) -> std::shared_ptr<void> {
+			using T = typename decltype(tag)::type;
+			return std::make_shared<T>(*static_cast<const T *>(src.data.get()));
+		});
+	}
+};
+
+bool source_engine::dmx::FileDataDiff::IsEmpty() const { return addedElements.empty() && removedElements.empty() && changedElements.empty(); }
+
+source_engine::dmx::FileDataDiff source_engine::dmx::FileData::Diff(const FileData &oldData, const FileData &newData)
+{
+	FileDataDiff diff {};
+	auto oldElements = build_guid_map(oldData.m_elements);
+	auto newElements = build_guid_map(newData.m_elements);
+	for(auto &elNew : newData.m_elements) {
+		if(is_zero_guid(elNew->GUID))
+			continue;
+		if(newElements.find(elNew->GUID)->second != elNew)
+			continue; // Duplicate GUID
+		auto it = oldElements.find(elNew->GUID);
+		if(it == oldElements.end()) {
+			diff.addedElements.push_back(elNew);
+			continue;
+		}
+		auto &elOld = *it->second;
+		ElementDiff elDiff {};
+		elDiff.GUID = elNew->GUID;
+		if(elOld.type != elNew->type)
+			elDiff.type = elNew->type;
+		if(elOld.name != elNew->name)
+			elDiff.name = elNew->name;
+		for(auto &pair : elNew->attributes) {
+			auto itOld = elOld.attributes.find(pair.first);
+			if(itOld == elOld.attributes.end())
+				elDiff.attributes.push_back({pair.first, AttributeDiff::Change::Added, pair.second});
+			else if(attributes_equal(*itOld->second, *pair.second) == false)
+				elDiff.attributes.push_back({pair.first, AttributeDiff::Change::Changed, pair.second});
+		}
+		for(auto &pair : elOld.attributes) {
+			if(elNew->attributes.find(pair.first) == elNew->attributes.end())
+				elDiff.attributes.push_back({pair.first, AttributeDiff::Change::Removed, nullptr});
+		}
+		if(elDiff.type.has_value() || elDiff.name.has_value() || elDiff.attributes.empty() == false)
+			diff.changedElements.push_back(std::move(elDiff));
+	}
+	for(auto &elOld : oldData.m_elements) {
+		auto it = oldElements.find(elOld->GUID);
+		if(it == oldElements.end() || it->second != elOld)
+			continue; // No GUID or duplicate GUID
+		if(newElements.find(elOld->GUID) == newElements.end())
+			diff.removedElements.push_back(elOld->GUID);
+	}
+	return diff;
+}
+
+void source_engine::dmx::FileData::ApplyPatch(const FileDataDiff &diff)
+{
+	auto elements = build_guid_map(m_elements);
+
+	// Elements whose child lookup tables have to be updated
+	std::unordered_set<Element *> dirtyElements {};
+	// Elements that have been renamed or removed; Any element referencing them has to update its lookup table
+	std::unordered_set<const Element *> invalidatedChildren {};
+
+	if(diff.removedElements.empty() == false) {
+		std::unordered_set<util::GUID, GUIDHash> removed {diff.removedElements.begin(), diff.removedElements.end()};
+		for(auto &guid : diff.removedElements) {
+			auto it = elements.find(guid);
+			if(it == elements.end())
+				continue;
+			invalidatedChildren.insert(it->second.get());
+			elements.erase(it);
+		}
+		removed.erase(util::GUID {});
+		m_elements.erase(std::remove_if(m_elements.begin(), m_elements.end(), [&removed](const std::shared_ptr<Element> &el) { return removed.find(el->GUID) != removed.end(); }), m_elements.end());
+	}
+
+	// Added elements have to be created before any attributes are copied, since attributes may refer to them
+	std::vector<std::pair<std::shared_ptr<Element>, const Element *>> addedElements {};
+	addedElements.reserve(diff.addedElements.size());
+	for(auto &elSrc : diff.addedElements) {
+		// Elements without a GUID can't be matched, and a GUID that already exists is only added once
+		if(is_zero_guid(elSrc->GUID) || elements.find(elSrc->GUID) != elements.end())
+			continue;
+		auto el = std::make_shared<Element>();
+		el->type = elSrc->type;
+		el->name = elSrc->name;
+		el->GUID = elSrc->GUID;
+		AdoptElement(*el);
+		elements[el->GUID] = el;
+		m_elements.push_back(el);
+		addedElements.push_back({el, elSrc.get()});
+	}
+	for(auto &[el, elSrc] : addedElements) {
+		el->attributes.reserve(elSrc->attributes.size());
+		for(auto &pair : elSrc->attributes) {
+			auto attr = std::make_shared<Attribute>();
+			copy_attribute_value(*pair.second, *attr, elements);
+			el->attributes[pair.first] = attr;
+		}
+		dirtyElements.insert(el.get());
+	}
+
+	for(auto &elDiff : diff.changedElements) {
+		auto it = elements.find(elDiff.GUID);
+		if(it == elements.end())
+			continue;
+		auto &el = *it->second;
+		if(elDiff.type.has_value())
+			el.type = *elDiff.type;
+		if(elDiff.name.has_value() && el.name != *elDiff.name) {
+			el.SetName(*elDiff.name);
+			invalidatedChildren.insert(&el);
+		}
+		for(auto &attrDiff : elDiff.attributes) {
+			switch(attrDiff.change) {
+			case AttributeDiff::Change::Removed:
+				el.attributes.erase(attrDiff.name);
+				break;
+			case AttributeDiff::Change::Added:
+			case AttributeDiff::Change::Changed:
+				{
+					if(attrDiff.value == nullptr)
+						break;
+					// Update the existing attribute object in-place if there is one
+					auto &attr = el.attributes[attrDiff.name];
+					if(attr == nullptr)
+						attr = std::make_shared<Attribute>();
+					attr->CheckWritable();
+					copy_attribute_value(*attrDiff.value, *attr, elements);
+					attr->InvalidateIndices(); // Same as SetValue; The indices may refer to a released array
+					break;
+				}
+			}
+		}
+		dirtyElements.insert(&el);
+	}
+
+	if(invalidatedChildren.empty() == false) {
+		for(auto &el : m_elements) {
+			for(auto &pair : el->nameToChildElement) {
+				auto child = pair.second.lock();
+				if(child == nullptr || invalidatedChildren.find(child.get()) != invalidatedChildren.end()) {
+					dirtyElements.insert(el.get());
+					break;
+				}
+			}
+		}
+	}
+	for(auto *el : dirtyElements)
+		el->UpdateChildElementLookupTable();
+
+	auto elRoot = m_rootAttribute ? std::static_pointer_cast<ElementRef>(m_rootAttribute->data) : nullptr;
+	if(!elRoot || elRoot->expired())
+		UpdateRootElement();
+}
@@ -4,6 +4,7 @@
 module;
 
 #include "dmx_types.hpp"
+#include "memory_usage.hpp"
 #include <fsys/filesystem.h>
 #include <sharedutils/util_string.h>
 #include <sharedutils/util.h>
@@ -11,7 +12,16 @@ module;
 #include <mathutil/uvec.h>
 #include <mathutil/uquat.h>
 #include <unordered_set>
+#include <algorithm>
 #include <cassert>
+#include <charconv>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <queue>
+#include <unordered_map>
+#include <utility>
 
 module source_engine.dmx;
 
@@ -42,48 +52,726 @@ namespace source_engine::dmx {
 	};
 #pragma pack(pop)
 
+	// Reads a null-terminated string into an existing buffer, keeping its capacity
+	static void read_string(ufile::IFile &f, std::string &outStr)
+	{
+		outStr.clear();
+		for(;;) {
+			auto c = f.ReadChar();
+			if(c == '\0' || f.Eof())
+				break;
+			outStr += c;
+		}
+	}
+
+	static void skip_string(ufile::IFile &f)
+	{
+		while(f.ReadChar() != '\0' && f.Eof() == false)
+			;
+	}
+
+	// Size of a value in the binary format, or 0 if the value has a variable size
+	static size_t get_binary_value_size(AttrType type)
+	{
+		switch(type) {
+		case AttrType::Int:
+		case AttrType::Float:
+		case AttrType::Time:
+		case AttrType::Color:
+			return 4;
+		case AttrType::Bool:
+		case AttrType::UInt8:
+			return 1;
+		case AttrType::Vector2:
+		case AttrType::UInt64:
+			return 8;
+		case AttrType::Vector3:
+		case AttrType::Angle:
+			return 12;
+		case AttrType::Vector4:
+		case AttrType::Quaternion:
+		case AttrType::ObjectId:
+			return 16;
+		case AttrType::Matrix:
+			return 64;
+		default:
+			return 0;
+		}
+	}
+
+	struct DictionaryLayout {
+		bool hasDictionary = true; // Strings are stored inline if there is no dictionary
+		uint32_t indexSize = 0u;
+		uint32_t lengthSize = 0u;
+	};
+	static DictionaryLayout get_dictionary_layout(const std::string &encoding, uint32_t encodingVersion)
+	{
+		DictionaryLayout layout {};
+		if(encoding == "binary") {
+			layout.indexSize = layout.lengthSize = sizeof(int32_t);
+			if(encodingVersion == 4u)
+				layout.indexSize = sizeof(int16_t);
+			else if(encodingVersion == 2u || encodingVersion == 3u)
+				layout.lengthSize = layout.indexSize = sizeof(int16_t);
+			else if(encodingVersion == 1u)
+				layout.hasDictionary = false;
+		}
+		else if(encoding == "binary_proto")
+			layout.hasDictionary = false;
+		return layout;
+	}
+
+	// Unless a file has been validated, counts are taken from the file as they are. Memory for them is allocated in blocks
+	// of this many items as the data is read, so that a corrupt count fails at the end of the file instead of allocating it.
+	static constexpr size_t UNCHECKED_BLOCK_SIZE = 64 * 1'024;
+
 	class StringDictionary {
 	  public:
-		StringDictionary(const std::shared_ptr<ufile::IFile> &f, const std::string &encoding, uint32_t encodingVersion) : m_file(f)
-		{
-			if(encoding == "binary") {
-				m_indexSize = m_lengthSize = sizeof(int32_t);
-				if(encodingVersion == 4u)
-					m_indexSize = sizeof(int16_t);
-				else if(encodingVersion == 2u || encodingVersion == 3u)
-					m_lengthSize = m_indexSize = sizeof(int16_t);
-				else if(encodingVersion == 1u) {
-					m_bDummy = true;
-					return;
-				}
-			}
-			else if(encoding == "binary_proto") {
+		// If the file has been validated, dictionary indices are not checked
+		StringDictionary(const std::shared_ptr<ufile::IFile> &f, const std::string &encoding, uint32_t encodingVersion, std::vector<std::string> &strings, std::vector<std::shared_ptr<const String>> &internedStrings, StringInterner *interner = nullptr, bool validated = false)
+		    : m_file(f), m_interner(interner), m_strings(strings), m_internedStrings(internedStrings), m_validated(validated)
+		{
+			auto layout = get_dictionary_layout(encoding, encodingVersion);
+			m_indexSize = layout.indexSize;
+			m_lengthSize = layout.lengthSize;
+			if(!layout.hasDictionary) {
 				m_bDummy = true;
 				return;
 			}
 
 			auto numStrings = (m_lengthSize == sizeof(int16_t)) ? static_cast<int32_t>(f->Read<int16_t>()) : f->Read<int32_t>();
-			m_strings.reserve(numStrings);
-			for(auto i = decltype(numStrings) {0}; i < numStrings; ++i)
-				m_strings.push_back(f->ReadString());
+			m_numStrings = std::max(numStrings, 0);
+			// The containers may hold strings from a previous load; They're only ever grown so that the
+			// existing string buffers can be reused
+			if(m_strings.size() < m_numStrings)
+				m_strings.resize(validated ? m_numStrings : std::min(m_numStrings, std::max(m_strings.size(), UNCHECKED_BLOCK_SIZE)));
+			for(size_t i = 0; i < m_numStrings; ++i) {
+				if(i == m_strings.size()) {
+					if(f->Eof())
+						throw std::runtime_error {"Invalid dmx file: Unexpected end of file!"};
+					m_strings.resize(std::min(m_numStrings, i * 2));
+				}
+				read_string(*f, m_strings[i]);
+			}
+			if(interner) {
+				m_internedStrings.clear();
+				m_internedStrings.reserve(m_numStrings);
+				for(size_t i = 0; i < m_numStrings; ++i)
+					m_internedStrings.push_back(interner->Intern(m_strings[i]));
+			}
 		}
+		// Strings are only read when they're accessed, by seeking to their offset
+		StringDictionary(const std::shared_ptr<ufile::IFile> &f, const std::string &encoding, uint32_t encodingVersion, const std::vector<uint64_t> &stringOffsets, std::vector<std::string> &strings,
+		  std::vector<std::shared_ptr<const String>> &internedStrings, StringInterner *interner = nullptr)
+		    : m_file(f), m_interner(interner), m_strings(strings), m_internedStrings(internedStrings), m_lazyStringOffsets(&stringOffsets)
+		{
+			auto layout = get_dictionary_layout(encoding, encodingVersion);
+			m_indexSize = layout.indexSize;
+			m_lengthSize = layout.lengthSize;
+			m_bDummy = !layout.hasDictionary;
+			m_numStrings = stringOffsets.size();
+		}
+		~StringDictionary() { m_internedStrings.clear(); }
 		std::string ReadString() const
 		{
 			if(m_bDummy)
 				return GetString();
-			auto idx = (m_indexSize == sizeof(int16_t)) ? m_file->Read<int16_t>() : m_file->Read<int32_t>();
-			return m_strings.at(idx);
+			return GetDictionaryString(ReadIndex());
+		}
+		// The returned reference is only valid until the next call
+		const std::string &ReadStringRef() const
+		{
+			if(m_bDummy) {
+				read_string(*m_file, m_stringBuffer);
+				return m_stringBuffer;
+			}
+			return GetDictionaryString(ReadIndex());
+		}
+		void SkipString() const
+		{
+			if(m_bDummy)
+				skip_string(*m_file);
+			else
+				m_file->Seek(m_file->Tell() + m_indexSize);
 		}
 		std::string GetString() const { return m_file->ReadString(); }
+		// Returns the interned string if an interner was specified, otherwise a new copy. Interned strings are only
+		// stored as attribute values, whose non-const getters copy shared values, so they're never modified.
+		std::shared_ptr<String> ReadStringValue() const
+		{
+			if(m_bDummy)
+				return GetStringValue();
+			auto idx = ReadIndex();
+			if(m_interner) {
+				auto &str = GetDictionaryString(idx); // Bounds check, unless validated
+				if(m_lazyStringOffsets)
+					return std::const_pointer_cast<String>(m_interner->Intern(str));
+				return std::const_pointer_cast<String>(m_internedStrings[idx]);
+			}
+			return std::make_shared<String>(GetDictionaryString(idx));
+		}
+		std::shared_ptr<String> GetStringValue() const { return m_interner ? std::const_pointer_cast<String>(m_interner->Intern(m_file->ReadString())) : std::make_shared<String>(m_file->ReadString()); }
 	  private:
+		int32_t ReadIndex() const { return (m_indexSize == sizeof(int16_t)) ? m_file->Read<int16_t>() : m_file->Read<int32_t>(); }
+		const std::string &GetDictionaryString(int32_t idx) const
+		{
+			if(!m_validated && (idx < 0 || static_cast<size_t>(idx) >= m_numStrings))
+				throw std::out_of_range {"String dictionary index " + std::to_string(idx) + " is out of range!"};
+			if(m_lazyStringOffsets)
+				return GetLazyString(idx);
+			return m_strings[idx];
+		}
+		const std::string &GetLazyString(int32_t idx) const
+		{
+			auto it = m_lazyStrings.find(idx);
+			if(it != m_lazyStrings.end())
+				return it->second;
+			auto pos = m_file->Tell();
+			m_file->Seek((*m_lazyStringOffsets)[idx]);
+			auto &str = m_lazyStrings[idx];
+			read_string(*m_file, str);
+			m_file->Seek(pos);
+			return str;
+		}
 		std::shared_ptr<ufile::IFile> m_file = nullptr;
-		std::vector<std::string> m_strings;
+		StringInterner *m_interner = nullptr;
+		std::vector<std::string> &m_strings;
+		std::vector<std::shared_ptr<const String>> &m_internedStrings;
+		mutable std::string m_stringBuffer;
+		const std::vector<uint64_t> *m_lazyStringOffsets = nullptr; // Absolute file positions
+		mutable std::unordered_map<int32_t, std::string> m_lazyStrings;
+		size_t m_numStrings = 0;
 		uint32_t m_indexSize = 0u;
 		uint32_t m_lengthSize = 0u;
 		bool m_bDummy = false;
+		bool m_validated = false;
 	};
 
 	AttrType get_id_type(const std::string &encoding, uint32_t encodingVersion, uint32_t id);
+
+	// Sequential reader over a file with its own read buffer. Every read is checked against the file size.
+	class BoundedReader {
+	  public:
+		static constexpr size_t BLOCK_SIZE = 64 * 1'024;
+		BoundedReader(ufile::IFile &f, std::vector<uint8_t> &buffer) : m_file {f}, m_buffer {buffer}, m_pos {f.Tell()}, m_end {f.GetSize()} { m_buffer.resize(BLOCK_SIZE); }
+		uint64_t GetPosition() const { return m_pos; }
+		uint64_t GetRemaining() const { return (m_pos < m_end) ? (m_end - m_pos) : 0; }
+		template<typename T>
+		T Read()
+		{
+			Require(sizeof(T));
+			T value;
+			std::memcpy(&value, Fill(sizeof(T)), sizeof(T));
+			m_pos += sizeof(T);
+			return value;
+		}
+		void Skip(uint64_t size)
+		{
+			Require(size);
+			m_pos += size;
+		}
+		void SkipString()
+		{
+			for(;;) {
+				Require(1);
+				auto *p = Fill(1);
+				auto available = m_bufferPos + m_bufferSize - m_pos;
+				if(auto *end = static_cast<const uint8_t *>(std::memchr(p, '\0', available))) {
+					m_pos += (end - p) + 1;
+					return;
+				}
+				m_pos += available;
+			}
+		}
+	  private:
+		void Require(uint64_t size) const
+		{
+			if(size > GetRemaining())
+				throw std::runtime_error {"Invalid dmx file: Unexpected end of file!"};
+		}
+		// Makes sure that the next size bytes (at most BLOCK_SIZE) are in the buffer
+		const uint8_t *Fill(size_t size)
+		{
+			if(m_pos < m_bufferPos || m_pos + size > m_bufferPos + m_bufferSize) {
+				m_file.Seek(m_pos);
+				m_bufferPos = m_pos;
+				m_bufferSize = m_file.Read(m_buffer.data(), std::min<uint64_t>(BLOCK_SIZE, m_end - m_pos));
+				if(m_bufferSize < size)
+					throw std::runtime_error {"Invalid dmx file: Unexpected end of file!"};
+			}
+			return m_buffer.data() + (m_pos - m_bufferPos);
+		}
+		ufile::IFile &m_file;
+		std::vector<uint8_t> &m_buffer;
+		uint64_t m_pos = 0;
+		uint64_t m_end = 0;
+		uint64_t m_bufferPos = 0;
+		size_t m_bufferSize = 0;
+	};
+
+	struct BinaryLayoutInfo {
+		uint32_t numMissingElements = 0;
+		// File positions of the dictionary strings and the element headers and bodies, only filled in if requested
+		std::vector<uint64_t> stringOffsets;
+		std::vector<uint64_t> headerOffsets;
+		std::vector<uint64_t> bodyOffsets;
+	};
+	// Walks the structure of a binary dmx file, starting at the string dictionary, and checks all counts, lengths and
+	// indices against the file size and against each other. Throws if the file is invalid.
+	static BinaryLayoutInfo validate_binary(ufile::IFile &f, const std::string &encoding, uint32_t encodingVersion, std::vector<uint8_t> &buffer, bool recordOffsets = false)
+	{
+		auto fail = [](const std::string &msg) { throw std::runtime_error {"Invalid dmx file: " + msg + "!"}; };
+		BoundedReader reader {f, buffer};
+		BinaryLayoutInfo info {};
+		auto layout = get_dictionary_layout(encoding, encodingVersion);
+		auto readCount = [&reader, &fail](uint32_t size, uint64_t minItemSize, const char *what) -> uint32_t {
+			auto count = (size == sizeof(int16_t)) ? static_cast<int32_t>(reader.Read<int16_t>()) : reader.Read<int32_t>();
+			if(count < 0)
+				fail(std::string {"Negative "} + what);
+			if(static_cast<uint64_t>(count) * minItemSize > reader.GetRemaining())
+				fail(std::string {what} + " exceeds the file size");
+			return static_cast<uint32_t>(count);
+		};
+
+		uint32_t numStrings = 0;
+		if(layout.hasDictionary) {
+			numStrings = readCount(layout.lengthSize, 1, "string count");
+			if(recordOffsets)
+				info.stringOffsets.reserve(numStrings);
+			for(uint32_t i = 0; i < numStrings; ++i) {
+				if(recordOffsets)
+					info.stringOffsets.push_back(reader.GetPosition());
+				reader.SkipString();
+			}
+		}
+		auto skipStringRef = [&reader, &layout, numStrings, &fail]() {
+			if(!layout.hasDictionary) {
+				reader.SkipString();
+				return;
+			}
+			auto idx = (layout.indexSize == sizeof(int16_t)) ? static_cast<int32_t>(reader.Read<int16_t>()) : reader.Read<int32_t>();
+			if(idx < 0 || static_cast<uint32_t>(idx) >= numStrings)
+				fail("String dictionary index " + std::to_string(idx) + " is out of range");
+		};
+
+		auto numElements = readCount(sizeof(int32_t), sizeof(ObjectId), "element count");
+		if(recordOffsets) {
+			info.headerOffsets.reserve(numElements);
+			info.bodyOffsets.reserve(numElements);
+		}
+		for(uint32_t i = 0; i < numElements; ++i) {
+			if(recordOffsets)
+				info.headerOffsets.push_back(reader.GetPosition());
+			skipStringRef();
+			if(encodingVersion >= 4)
+				skipStringRef();
+			else
+				reader.SkipString();
+			reader.Skip(sizeof(ObjectId));
+		}
+
+		auto validateValue = [&](AttrType type, bool fromArray) {
+			switch(type) {
+			case AttrType::Element:
+				{
+					auto idx = reader.Read<int32_t>();
+					if(idx == -2) {
+						reader.SkipString();
+						++info.numMissingElements;
+					}
+					else if(idx != -1 && (idx < 0 || static_cast<uint32_t>(idx) >= numElements))
+						fail("Element index " + std::to_string(idx) + " is out of range");
+					break;
+				}
+			case AttrType::String:
+				if(encodingVersion < 4 || fromArray)
+					reader.SkipString();
+				else
+					skipStringRef();
+				break;
+			case AttrType::Binary:
+				reader.Skip(readCount(sizeof(int32_t), 1, "binary length"));
+				break;
+			default:
+				{
+					auto size = get_binary_value_size(type);
+					if(size == 0)
+						fail("Unsupported attribute type " + std::to_string(umath::to_integral(type)));
+					reader.Skip(size);
+					break;
+				}
+			}
+		};
+		auto minAttributeSize = (layout.hasDictionary ? layout.indexSize : 1) + 1;
+		for(uint32_t i = 0; i < numElements; ++i) {
+			if(recordOffsets)
+				info.bodyOffsets.push_back(reader.GetPosition());
+			auto numAttributes = readCount(sizeof(int32_t), minAttributeSize, "attribute count");
+			for(uint32_t j = 0; j < numAttributes; ++j) {
+				skipStringRef();
+				auto typeId = reader.Read<uint8_t>();
+				auto type = AttrType::Invalid;
+				try {
+					type = get_id_type(encoding, encodingVersion, typeId);
+				}
+				catch(const std::out_of_range &) {
+				}
+				if(is_single_type(type))
+					validateValue(type, false);
+				else if(is_array_type(type)) {
+					auto singleType = get_single_type(type);
+					auto size = get_binary_value_size(singleType);
+					// Variable-sized values take up at least one byte
+					auto len = readCount(sizeof(int32_t), std::max<size_t>(size, 1), "array length");
+					if(size > 0)
+						reader.Skip(static_cast<uint64_t>(len) * size);
+					else {
+						for(uint32_t k = 0; k < len; ++k)
+							validateValue(singleType, true);
+					}
+				}
+				else
+					fail("Invalid attribute type id " + std::to_string(typeId));
+			}
+		}
+		return info;
+	}
+
+	// Appends numItems attributes of the given type; getValue(i) returns the value of the i-th item
+	template<typename T, typename TFunc>
+	static void add_array_items(std::vector<std::shared_ptr<Attribute>> &attributes, AttrType type, size_t numItems, const TFunc &getValue)
+	{
+		// Every item has its own allocations, so that items that are released or replaced don't keep the others' memory alive
+		for(size_t i = 0; i < numItems; ++i) {
+			auto &item = attributes.emplace_back(std::make_shared<Attribute>());
+			item->type = type;
+			item->data = std::make_shared<T>(getValue(i));
+		}
+	}
+
+	// Decodes the attributes of binary element bodies. Element references are resolved by the index of the element in
+	// the file's element table.
+	class BinaryBodyReader {
+	  public:
+		BinaryBodyReader(const std::shared_ptr<ufile::IFile> &f, const StringDictionary &dictionary, const std::string &encoding, uint32_t encodingVersion, bool validated, std::vector<int32_t> &timeTicks,
+		  std::vector<float> &quaternionComponents, std::vector<Quaternion> &quaternions)
+		    : m_file {f}, m_dictionary {dictionary}, m_encoding {encoding}, m_encodingVersion {encodingVersion}, m_validated {validated}, m_timeTicks {timeTicks}, m_quaternionComponents {quaternionComponents},
+		      m_quaternions {quaternions}
+		{
+		}
+		// If set, referenced elements that haven't been created yet are created on demand and their indices are added to the list
+		void SetPendingElements(std::vector<uint32_t> *pendingElements) { m_pendingElements = pendingElements; }
+		void SetSchema(Schema *schema) { m_schema = schema; }
+		// Reads the element body at the current file position
+		void ReadBody(Element &el, std::vector<std::shared_ptr<Element>> &elements, const LoadFilter *filter)
+		{
+			auto elementIncluded = !filter || filter->IsElementTypeIncluded(el.type);
+			auto *binding = (m_schema && elementIncluded) ? m_schema->FindBinding(el.type) : nullptr;
+			size_t recordIdx = 0;
+			if(binding)
+				recordIdx = binding->AddRecord(el.shared_from_this());
+			auto numAttributes = ReadCount();
+			for(uint32_t j = 0; j < numAttributes; ++j) {
+				CheckItem(j);
+				auto &name = m_dictionary.ReadStringRef();
+				auto attrType = get_id_type(m_encoding, m_encodingVersion, m_file->Read<uint8_t>());
+				if(filter && (!elementIncluded || !filter->IsAttributeIncluded(name))) {
+					// Element bodies have no size information, so the values have to be stepped over
+					if(is_single_type(attrType))
+						SkipValue(attrType);
+					else if(is_array_type(attrType))
+						SkipValue(get_single_type(attrType), ReadCount(), true);
+					continue;
+				}
+				if(binding) {
+					auto *field = binding->FindField(name);
+					if(field && field->type == attrType) {
+						ReadField(attrType, field->getMember(binding->GetRecord(recordIdx)));
+						continue;
+					}
+				}
+				if(is_single_type(attrType))
+					el.attributes[name] = ReadValue(elements, attrType);
+				else if(is_array_type(attrType)) {
+					auto singleType = get_single_type(attrType);
+					auto &attr = el.attributes[name] = std::make_shared<Attribute>();
+					attr->type = attrType;
+					attr->data = std::make_shared<std::vector<std::shared_ptr<Attribute>>>();
+					auto &attributes = *static_cast<std::vector<std::shared_ptr<Attribute>> *>(attr->data.get());
+
+					auto len = ReadCount();
+					attributes.reserve(GetReserveCount(len));
+					if(singleType == AttrType::Time && len > 0) {
+						// Time arrays are usually the bulk of animation data, so they're read in one go
+						auto &ticks = m_timeTicks;
+						ReadRaw(ticks, len);
+						add_array_items<Time>(attributes, singleType, ticks.size(), [&ticks](size_t i) { return Time::FromTicks(ticks[i]); });
+					}
+					else if(singleType == AttrType::Quaternion && len > 0) {
+						auto &components = m_quaternionComponents;
+						auto &rotations = m_quaternions;
+						ReadRaw(components, len * size_t {4});
+						rotations.resize(len);
+						decode_quaternions(components.data(), rotations.data(), rotations.size());
+						add_array_items<Quaternion>(attributes, singleType, rotations.size(), [&rotations](size_t i) { return rotations[i]; });
+					}
+					else {
+						for(uint32_t k = 0; k < len; ++k) {
+							CheckItem(k);
+							attributes.push_back(ReadValue(elements, singleType, true));
+						}
+					}
+				}
+			}
+		}
+	  private:
+		// Decodes a value directly into a bound member. Element references are never bound.
+		template<typename T>
+		void ReadTypedValue(T &out, bool bFromArray)
+		{
+			if constexpr(std::is_same_v<T, String>)
+				out = (m_encodingVersion < 4 || bFromArray) ? m_dictionary.GetString() : m_dictionary.ReadString();
+			else if constexpr(std::is_same_v<T, Binary>)
+				ReadRaw(out, ReadCount());
+			else if constexpr(std::is_same_v<T, Angle>) {
+				auto v = m_file->Read<Vector3>();
+				out = Angle {v.x, v.y, v.z};
+			}
+			else if constexpr(std::is_same_v<T, Quaternion>) {
+				auto xyzw = m_file->Read<std::array<float, 4>>();
+				decode_quaternions(xyzw.data(), &out, 1);
+			}
+			else if constexpr(std::is_same_v<T, Time>)
+				out = get_time(m_file->Read<int32_t>());
+			else if constexpr(!std::is_same_v<T, ElementRef>)
+				out = m_file->Read<T>();
+		}
+		void ReadField(AttrType type, void *member)
+		{
+			if(is_single_type(type)) {
+				visit_value_type(type, [this, member](auto tag) { ReadTypedValue(*static_cast<typename decltype(tag)::type *>(member), false); });
+				return;
+			}
+			auto len = ReadCount();
+			visit_value_type(get_single_type(type), [this, member, len](auto tag) {
+				using T = typename decltype(tag)::type;
+				if constexpr(!std::is_same_v<T, ElementRef>) {
+					auto &values = *static_cast<std::vector<T> *>(member);
+					// Types whose memory layout matches the file are read in one go
+					if constexpr(std::is_same_v<T, Int> || std::is_same_v<T, Float> || std::is_same_v<T, Time> || std::is_same_v<T, ObjectId> || std::is_same_v<T, Color> || std::is_same_v<T, Vector2> || std::is_same_v<T, Vector3> || std::is_same_v<T, Vector4>
+					  || std::is_same_v<T, Matrix>)
+						ReadRaw(values, len);
+					else if constexpr(std::is_same_v<T, Quaternion>) {
+						auto &components = m_quaternionComponents;
+						ReadRaw(components, len * size_t {4});
+						values.resize(len);
+						decode_quaternions(components.data(), values.data(), values.size());
+					}
+					else {
+						values.clear();
+						values.reserve(GetReserveCount(len));
+						for(uint32_t i = 0; i < len; ++i) {
+							CheckItem(i);
+							T value {};
+							ReadTypedValue(value, true);
+							values.push_back(std::move(value));
+						}
+					}
+				}
+			});
+		}
+		std::shared_ptr<Attribute> ReadValue(std::vector<std::shared_ptr<Element>> &elements, AttrType type, bool bFromArray = false)
+		{
+			auto attr = std::make_shared<Attribute>();
+			attr->type = type;
+			switch(type) {
+			case source_engine::dmx::AttrType::Element:
+				{
+					auto elIdx = m_file->Read<int32_t>();
+					if(elIdx == -1)
+						return attr;
+					else if(elIdx == -2) {
+						if(elements.capacity() == elements.size())
+							elements.reserve(elements.size() + 100); // Reserve for potential future missing elements
+						elements.push_back(std::make_shared<Element>());
+						auto &el = elements.back();
+						// The element is in another file, which is referenced by the id of the element
+						el->name = "Missing element";
+						el->GUID = parse_object_id(m_file->ReadString());
+						attr->data = std::make_shared<ElementRef>(el);
+					}
+					else {
+						auto &el = m_validated ? elements[elIdx] : elements.at(elIdx);
+						if(!el && m_pendingElements) {
+							el = std::make_shared<Element>();
+							m_pendingElements->push_back(elIdx);
+						}
+						attr->data = std::make_shared<ElementRef>(el);
+					}
+					break;
+				}
+			case source_engine::dmx::AttrType::String:
+				{
+					attr->data = (m_encodingVersion < 4 || bFromArray) ? m_dictionary.GetStringValue() : m_dictionary.ReadStringValue();
+					break;
+				}
+			case source_engine::dmx::AttrType::Int:
+				{
+					attr->data = std::make_shared<Int>(m_file->Read<Int>());
+					break;
+				}
+			case source_engine::dmx::AttrType::Float:
+				{
+					attr->data = std::make_shared<Float>(m_file->Read<Float>());
+					break;
+				}
+			case source_engine::dmx::AttrType::Bool:
+				{
+					attr->data = std::make_shared<Bool>(m_file->Read<Bool>());
+					break;
+				}
+			case source_engine::dmx::AttrType::Vector2:
+				{
+					attr->data = std::make_shared<Vector2>(m_file->Read<Vector2>());
+					break;
+				}
+			case source_engine::dmx::AttrType::Vector3:
+				{
+					attr->data = std::make_shared<Vector3>(m_file->Read<Vector3>());
+					break;
+				}
+			case source_engine::dmx::AttrType::Angle:
+				{
+					auto v = m_file->Read<Vector3>();
+					attr->data = std::make_shared<EulerAngles>(EulerAngles(v.x, v.y, v.z));
+					break;
+				}
+			case source_engine::dmx::AttrType::Vector4:
+				{
+					attr->data = std::make_shared<Vector4>(m_file->Read<Vector4>());
+					break;
+				}
+			case source_engine::dmx::AttrType::Quaternion:
+				{
+					auto xyzw = m_file->Read<std::array<float, 4>>();
+					auto rot = std::make_shared<Quat>();
+					source_engine::dmx::decode_quaternions(xyzw.data(), rot.get(), 1);
+					attr->data = rot;
+					break;
+				}
+			case source_engine::dmx::AttrType::Matrix:
+				{
+					attr->data = std::make_shared<Mat4>(m_file->Read<Mat4>());
+					break;
+				}
+			case source_engine::dmx::AttrType::Color:
+				{
+					attr->data = std::make_shared<Color>(m_file->Read<Color>());
+					break;
+				}
+			case source_engine::dmx::AttrType::Time:
+				{
+					auto t = m_file->Read<int32_t>();
+					attr->data = std::make_shared<Time>(source_engine::dmx::get_time(t));
+					break;
+				}
+			case source_engine::dmx::AttrType::Binary:
+				{
+					attr->data = std::make_shared<Binary>();
+					ReadRaw(*static_cast<Binary *>(attr->data.get()), ReadCount());
+					break;
+				}
+			case source_engine::dmx::AttrType::ObjectId:
+				{
+					attr->data = std::make_shared<ObjectId>(m_file->Read<ObjectId>());
+					break;
+				}
+			case source_engine::dmx::AttrType::UInt64:
+				{
+					attr->data = std::make_shared<UInt64>(m_file->Read<UInt64>());
+					break;
+				}
+			case source_engine::dmx::AttrType::UInt8:
+				{
+					attr->data = std::make_shared<UInt8>(m_file->Read<UInt8>());
+					break;
+				}
+			default:
+				throw std::logic_error {"Unsupported DMX data type '" + std::to_string(umath::to_integral(type)) + "'"};
+			}
+			return attr;
+		}
+		// Skips a value without allocating anything
+		void SkipValue(AttrType type, uint32_t count = 1, bool bFromArray = false)
+		{
+			auto size = get_binary_value_size(type);
+			if(size > 0) {
+				m_file->Seek(m_file->Tell() + size * count);
+				return;
+			}
+			for(uint32_t i = 0; i < count; ++i) {
+				CheckItem(i);
+				switch(type) {
+				case source_engine::dmx::AttrType::Element:
+					if(m_file->Read<int32_t>() == -2)
+						skip_string(*m_file);
+					break;
+				case source_engine::dmx::AttrType::String:
+					if(m_encodingVersion < 4 || bFromArray)
+						skip_string(*m_file);
+					else
+						m_dictionary.SkipString();
+					break;
+				case source_engine::dmx::AttrType::Binary:
+					{
+						auto len = ReadCount();
+						m_file->Seek(m_file->Tell() + len);
+						break;
+					}
+				default:
+					throw std::logic_error {"Unsupported DMX data type '" + std::to_string(umath::to_integral(type)) + "'"};
+				}
+			}
+		}
+		uint32_t ReadCount()
+		{
+			auto count = m_file->Read<int32_t>();
+			if(count < 0)
+				throw std::runtime_error {"Invalid dmx file: Negative count!"};
+			return static_cast<uint32_t>(count);
+		}
+		size_t GetReserveCount(size_t count) const { return m_validated ? count : std::min<size_t>(count, UNCHECKED_BLOCK_SIZE); }
+		// Reads values whose memory layout matches the file
+		template<typename T>
+		void ReadRaw(std::vector<T> &out, size_t count)
+		{
+			out.clear();
+			for(size_t offset = 0; offset < count;) {
+				auto n = m_validated ? (count - offset) : std::min<size_t>(count - offset, UNCHECKED_BLOCK_SIZE);
+				out.resize(offset + n);
+				if(m_file->Read(out.data() + offset, n * sizeof(T)) != n * sizeof(T))
+					throw std::runtime_error {"Invalid dmx file: Unexpected end of file!"};
+				offset += n;
+			}
+		}
+		// Called before each value of a count that is read one by one
+		void CheckItem(uint32_t idx) const
+		{
+			if(!m_validated && idx > 0 && idx % UNCHECKED_BLOCK_SIZE == 0 && m_file->Eof())
+				throw std::runtime_error {"Invalid dmx file: Unexpected end of file!"};
+		}
+
+		std::shared_ptr<ufile::IFile> m_file;
+		const StringDictionary &m_dictionary;
+		const std::string &m_encoding;
+		uint32_t m_encodingVersion = 0;
+		bool m_validated = false;
+		std::vector<uint32_t> *m_pendingElements = nullptr;
+		Schema *m_schema = nullptr;
+		std::vector<int32_t> &m_timeTicks;
+		std::vector<float> &m_quaternionComponents;
+		std::vector<Quaternion> &m_quaternions;
+	};
 };
 
 std::string source_engine::dmx::type_to_string(AttrType type)
@@ -295,9 +983,9 @@ static std::string attr_value_to_string(const void *data, source_engine::dmx::At
 			return util::get_pretty_bytes(v.size());
 		}
 	case source_engine::dmx::AttrType::Time:
-		return std::to_string(*static_cast<const source_engine::dmx::Time *>(data));
+		return std::to_string(static_cast<const source_engine::dmx::Time *>(data)->GetSecondsDouble());
 	case source_engine::dmx::AttrType::ObjectId:
-		return "ObjectId?";
+		return util::guid_to_string(*static_cast<const source_engine::dmx::ObjectId *>(data));
 	case source_engine::dmx::AttrType::Color:
 		{
 			auto &col = *static_cast<const source_engine::dmx::Color *>(data);
@@ -369,24 +1057,263 @@ template<class TArrayType,class TType>
 	return output;
 }
 */
-std::shared_ptr<source_engine::dmx::Element> source_engine::dmx::Attribute::Get(const std::string &name) const
+namespace source_engine::dmx {
+	// Name indices are built lazily by const lookups, which may run concurrently
+	static std::mutex &get_name_index_mutex(const Attribute &attr)
+	{
+		static std::array<std::mutex, 64> mutexes;
+		return mutexes[(reinterpret_cast<uintptr_t>(&attr) / alignof(Attribute)) % mutexes.size()];
+	}
+	// Rename counter of elements that don't belong to a file data object
+	static const std::shared_ptr<std::atomic<uint64_t>> &get_default_rename_count()
+	{
+		static auto count = std::make_shared<std::atomic<uint64_t>>(0);
+		return count;
+	}
+	static std::shared_ptr<Element> get_array_item_element(const Attribute &item)
+	{
+		if(item.type != AttrType::Element || item.data == nullptr)
+			return nullptr;
+		return static_cast<const ElementRef *>(item.data.get())->lock();
+	}
+	template<typename TNameIndex>
+	static void add_to_name_index(TNameIndex &index, const Attribute &item)
+	{
+		auto el = get_array_item_element(item);
+		if(el == nullptr)
+			return;
+		auto it = index.items.find(el->name);
+		if(it == index.items.end()) {
+			it = index.items.emplace(el->name, std::vector<const Attribute *> {}).first;
+			index.names.insert(it->first);
+		}
+		it->second.push_back(&item);
+		++index.numItems;
+	}
+	// Returns false if the item couldn't be found, in which case the index is out of date
+	template<typename TNameIndex>
+	static bool remove_from_name_index(TNameIndex &index, const Attribute &item)
+	{
+		auto el = get_array_item_element(item);
+		if(el == nullptr)
+			return false;
+		auto it = index.items.find(el->name);
+		if(it == index.items.end())
+			return false;
+		auto &items = it->second;
+		auto itItem = std::find(items.begin(), items.end(), &item);
+		if(itItem == items.end())
+			return false;
+		items.erase(itItem);
+		--index.numItems;
+		if(items.empty()) {
+			index.names.erase(it->first);
+			index.items.erase(it);
+		}
+		return true;
+	}
+};
+source_engine::dmx::Attribute::Attribute(const Attribute &other) : type {other.type}, data {other.data}
 {
-	static auto emptyElement = std::make_shared<source_engine::dmx::Element>();
-	if(type != AttrType::ElementArray)
-		return emptyElement;
-	auto &children = *static_cast<std::vector<std::shared_ptr<source_engine::dmx::Attribute>> *>(data.get());
-	for(auto &child : children) {
-		if(child->type != AttrType::Element)
-			continue;
-		auto &elRef = *static_cast<const source_engine::dmx::ElementRef *>(child->data.get());
-		if(elRef.expired())
+	if(other.IsArrayIndexEnabled())
+		SetArrayIndexEnabled(true);
+}
+source_engine::dmx::Attribute &source_engine::dmx::Attribute::operator=(const Attribute &other)
+{
+	if(this == &other)
+		return *this;
+	type = other.type;
+	data = other.data;
+	InvalidateIndices();
+	SetArrayIndexEnabled(other.IsArrayIndexEnabled());
+	return *this;
+}
+source_engine::dmx::Attribute::~Attribute() { delete m_indices.load(std::memory_order_acquire); }
+source_engine::dmx::Attribute::Indices *source_engine::dmx::Attribute::GetIndices() const { return m_indices.load(std::memory_order_acquire); }
+source_engine::dmx::Attribute::Indices &source_engine::dmx::Attribute::GetOrCreateIndices() const
+{
+	auto *indices = GetIndices();
+	if(indices == nullptr) {
+		indices = new Indices {};
+		m_indices.store(indices, std::memory_order_release);
+	}
+	return *indices;
+}
+void source_engine::dmx::Attribute::InvalidateIndices()
+{
+	auto *indices = GetIndices();
+	if(indices == nullptr)
+		return;
+	if(!indices->arrayIndexEnabled) {
+		m_indices.store(nullptr, std::memory_order_release);
+		delete indices;
+		return;
+	}
+	indices->positionsArray = nullptr;
+	indices->positions.clear();
+	ResetNameIndex();
+}
+void source_engine::dmx::Attribute::MarkArrayChanged()
+{
+	auto *indices = GetIndices();
+	if(indices == nullptr)
+		return;
+	indices->positionsArray = nullptr;
+	if(auto index = indices->nameIndex.load(std::memory_order_acquire))
+		index->checkItems.store(true, std::memory_order_release);
+}
+void source_engine::dmx::Attribute::ResetNameIndex()
+{
+	auto *indices = GetIndices();
+	if(indices == nullptr)
+		return;
+	indices->nameIndex.store(nullptr, std::memory_order_release);
+}
+bool source_engine::dmx::Attribute::IsNameIndexValid(const NameIndex &index) const
+{
+	if(type != AttrType::ElementArray || index.array != GetArrayData() || index.checkItems.load(std::memory_order_acquire))
+		return false;
+	return std::all_of(index.renameCounts.begin(), index.renameCounts.end(), [](const auto &pair) { return pair.first->load(std::memory_order_acquire) == pair.second; });
+}
+bool source_engine::dmx::Attribute::NameIndexMatchesArray(const NameIndex &index) const
+{
+	auto *a = GetArrayData();
+	if(a == nullptr || index.array != a)
+		return false;
+	// The items of a name are in array order, so the number of items with the same name that came before is the expected position;
+	// It only has to be counted for names that occur more than once.
+	std::unordered_map<const std::vector<const Attribute *> *, uint32_t> positions {};
+	size_t numItems = 0;
+	for(auto &item : *a) {
+		auto el = item ? get_array_item_element(*item) : nullptr;
+		if(el == nullptr)
 			continue;
-		auto el = elRef.lock();
-		if(el->name != name)
+		auto it = index.items.find(el->name);
+		if(it == index.items.end())
+			return false;
+		auto &items = it->second;
+		auto pos = (items.size() > 1) ? positions[&items]++ : 0u;
+		if(pos >= items.size() || items[pos] != item.get())
+			return false;
+		++numItems;
+	}
+	return numItems == index.numItems;
+}
+source_engine::dmx::Attribute::NameIndex *source_engine::dmx::Attribute::GetValidNameIndex()
+{
+	auto *indices = GetIndices();
+	auto index = indices ? indices->nameIndex.load(std::memory_order_acquire) : nullptr;
+	if(index == nullptr || type != AttrType::ElementArray || GetArrayData() == nullptr)
+		return nullptr;
+	if(index->checkItems.load(std::memory_order_acquire) && NameIndexMatchesArray(*index))
+		index->checkItems.store(false, std::memory_order_release);
+	if(!IsNameIndexValid(*index)) {
+		ResetNameIndex();
+		return nullptr;
+	}
+	return index.get(); // No const lookups can run at the same time as this, so the index isn't replaced while it's in use
+}
+template<typename TFunc>
+bool source_engine::dmx::Attribute::LookUpName(const TFunc &func) const
+{
+	if(type != AttrType::ElementArray || data == nullptr)
+		return false;
+	// The lookup fails if an element has been renamed without SetName or destroyed since the index was built, in which case it is rebuilt once
+	std::shared_ptr<NameIndex> index = nullptr;
+	auto failed = false;
+	if(auto *indices = GetIndices()) {
+		index = indices->nameIndex.load(std::memory_order_acquire);
+		if(index && IsNameIndexValid(*index)) {
+			if(func(*index))
+				return true;
+			failed = true;
+		}
+	}
+
+	std::scoped_lock lock {get_name_index_mutex(*this)};
+	auto &indices = GetOrCreateIndices();
+	// Another thread may have rebuilt or checked the index in the meantime
+	auto current = indices.nameIndex.load(std::memory_order_acquire);
+	if(current && current->checkItems.load(std::memory_order_acquire) && NameIndexMatchesArray(*current))
+		current->checkItems.store(false, std::memory_order_release);
+	if(current && !(current == index && failed) && IsNameIndexValid(*current) && func(*current))
+		return true;
+	auto &a = *static_cast<const std::vector<std::shared_ptr<source_engine::dmx::Attribute>> *>(data.get());
+	auto newIndex = std::make_shared<NameIndex>();
+	newIndex->array = &a;
+	for(auto &item : a) {
+		auto el = item ? get_array_item_element(*item) : nullptr;
+		if(el == nullptr)
 			continue;
-		return el;
+		// The counter is read before the name, so that a rename in the meantime makes the index out of date
+		auto &renameCount = el->GetRenameCount();
+		if(std::find_if(newIndex->renameCounts.rbegin(), newIndex->renameCounts.rend(), [&renameCount](const auto &pair) { return pair.first == renameCount; }) == newIndex->renameCounts.rend())
+			newIndex->renameCounts.push_back({renameCount, renameCount->load(std::memory_order_acquire)});
+		add_to_name_index(*newIndex, *item);
 	}
-	return emptyElement;
+	func(*newIndex);
+	// Lookups that are still using the previous index keep it alive until they're done
+	indices.nameIndex.store(std::move(newIndex), std::memory_order_release);
+	return true;
+}
+std::shared_ptr<source_engine::dmx::Element> source_engine::dmx::Attribute::Get(const std::string &name) const
+{
+	static auto emptyElement = std::make_shared<source_engine::dmx::Element>();
+	std::shared_ptr<source_engine::dmx::Element> result = nullptr;
+	LookUpName([&name, &result](const NameIndex &index) {
+		result = nullptr;
+		auto it = index.items.find(name);
+		if(it == index.items.end())
+			return true;
+		auto el = get_array_item_element(*it->second.front());
+		if(el == nullptr || el->name != name)
+			return false;
+		result = el;
+		return true;
+	});
+	return result ? result : emptyElement;
+}
+std::vector<std::shared_ptr<source_engine::dmx::Element>> source_engine::dmx::Attribute::GetAll(const std::string &name) const
+{
+	std::vector<std::shared_ptr<source_engine::dmx::Element>> result {};
+	LookUpName([&name, &result](const NameIndex &index) {
+		result.clear();
+		auto it = index.items.find(name);
+		if(it == index.items.end())
+			return true;
+		result.reserve(it->second.size());
+		for(auto *item : it->second) {
+			auto el = get_array_item_element(*item);
+			if(el == nullptr || el->name != name)
+				return false;
+			result.push_back(el);
+		}
+		return true;
+	});
+	return result;
+}
+std::vector<std::shared_ptr<source_engine::dmx::Element>> source_engine::dmx::Attribute::FindByPrefix(std::string_view prefix) const
+{
+	std::vector<std::shared_ptr<source_engine::dmx::Element>> result {};
+	LookUpName([prefix, &result](const NameIndex &index) {
+		result.clear();
+		for(auto itName = index.names.lower_bound(prefix); itName != index.names.end() && itName->starts_with(prefix); ++itName) {
+			auto &items = index.items.find(*itName)->second;
+			for(auto *item : items) {
+				auto el = get_array_item_element(*item);
+				if(el == nullptr || el->name != *itName)
+					return false;
+				result.push_back(el);
+			}
+		}
+		return true;
+	});
+	return result;
+}
+void source_engine::dmx::Attribute::InvalidateNameIndex()
+{
+	std::scoped_lock lock {get_name_index_mutex(*this)};
+	ResetNameIndex();
 }
 std::string source_engine::dmx::Attribute::DataToString() const
 {
@@ -465,6 +1392,31 @@ std::string source_engine::dmx::Attribute::DataToString() const
 		return "Unknown";
 	}
 }
+bool source_engine::dmx::Attribute::IsReadOnly() const { return m_readOnly; }
+void source_engine::dmx::Attribute::CheckWritable() const
+{
+	if(m_readOnly)
+		throw std::logic_error {"Attributes of file data snapshots are read-only!"};
+}
+void source_engine::dmx::Attribute::MakeValueUnique()
+{
+	if(m_readOnly || data == nullptr)
+		return;
+	if(is_array_type(type)) {
+		MakeArrayUnique();
+		return;
+	}
+	if(!is_single_type(type))
+		return;
+	if(data.use_count() == 1) {
+		std::atomic_thread_fence(std::memory_order_acquire); // Synchronizes with a snapshot that has just released the value on another thread
+		return;
+	}
+	data = visit_value_type(type, [this](auto tag) -> std::shared_ptr<void> {
+		using T = typename decltype(tag)::type;
+		return std::make_shared<T>(*static_cast<const T *>(data.get()));
+	});
+}
 source_engine::dmx::ElementRef *source_engine::dmx::Attribute::GetElement() { return GetValue<ElementRef>(AttrType::Element); }
 source_engine::dmx::Int *source_engine::dmx::Attribute::GetInt() { return GetValue<Int>(AttrType::Int); }
 source_engine::dmx::Float *source_engine::dmx::Attribute::GetFloat() { return GetValue<Float>(AttrType::Float); }
@@ -472,6 +1424,7 @@ source_engine::dmx::Bool *source_engine::dmx::Attribute::GetBoolean() { return G
 source_engine::dmx::String *source_engine::dmx::Attribute::GetString() { return GetValue<String>(AttrType::String); }
 source_engine::dmx::Binary *source_engine::dmx::Attribute::GetBinary() { return GetValue<Binary>(AttrType::Binary); }
 source_engine::dmx::Time *source_engine::dmx::Attribute::GetTime() { return GetValue<Time>(AttrType::Time); }
+source_engine::dmx::ObjectId *source_engine::dmx::Attribute::GetObjectId() { return GetValue<ObjectId>(AttrType::ObjectId); }
 source_engine::dmx::Color *source_engine::dmx::Attribute::GetColor() { return GetValue<Color>(AttrType::Color); }
 source_engine::dmx::Vector2 *source_engine::dmx::Attribute::GetVector2() { return GetValue<Vector2>(AttrType::Vector2); }
 source_engine::dmx::Vector3 *source_engine::dmx::Attribute::GetVector3() { return GetValue<Vector3>(AttrType::Vector3); }
@@ -481,25 +1434,193 @@ source_engine::dmx::Quaternion *source_engine::dmx::Attribute::GetQuaternion() {
 source_engine::dmx::Matrix *source_engine::dmx::Attribute::GetMatrix() { return GetValue<Matrix>(AttrType::Matrix); }
 source_engine::dmx::UInt64 *source_engine::dmx::Attribute::GetUInt64() { return GetValue<UInt64>(AttrType::UInt64); }
 source_engine::dmx::UInt8 *source_engine::dmx::Attribute::GetUInt8() { return GetValue<UInt8>(AttrType::UInt8); }
-std::vector<std::shared_ptr<source_engine::dmx::Attribute>> *source_engine::dmx::Attribute::GetArray() { return is_array_type(type) ? GetValue<std::vector<std::shared_ptr<source_engine::dmx::Attribute>>>(AttrType::ElementArray) : nullptr; }
+const source_engine::dmx::ElementRef *source_engine::dmx::Attribute::GetElement() const { return GetValue<ElementRef>(AttrType::Element); }
+const source_engine::dmx::Int *source_engine::dmx::Attribute::GetInt() const { return GetValue<Int>(AttrType::Int); }
+const source_engine::dmx::Float *source_engine::dmx::Attribute::GetFloat() const { return GetValue<Float>(AttrType::Float); }
+const source_engine::dmx::Bool *source_engine::dmx::Attribute::GetBoolean() const { return GetValue<Bool>(AttrType::Bool); }
+const source_engine::dmx::String *source_engine::dmx::Attribute::GetString() const { return GetValue<String>(AttrType::String); }
+const source_engine::dmx::Binary *source_engine::dmx::Attribute::GetBinary() const { return GetValue<Binary>(AttrType::Binary); }
+const source_engine::dmx::Time *source_engine::dmx::Attribute::GetTime() const { return GetValue<Time>(AttrType::Time); }
+const source_engine::dmx::ObjectId *source_engine::dmx::Attribute::GetObjectId() const { return GetValue<ObjectId>(AttrType::ObjectId); }
+const source_engine::dmx::Color *source_engine::dmx::Attribute::GetColor() const { return GetValue<Color>(AttrType::Color); }
+const source_engine::dmx::Vector2 *source_engine::dmx::Attribute::GetVector2() const { return GetValue<Vector2>(AttrType::Vector2); }
+const source_engine::dmx::Vector3 *source_engine::dmx::Attribute::GetVector3() const { return GetValue<Vector3>(AttrType::Vector3); }
+const source_engine::dmx::Vector4 *source_engine::dmx::Attribute::GetVector4() const { return GetValue<Vector4>(AttrType::Vector4); }
+const source_engine::dmx::Angle *source_engine::dmx::Attribute::GetAngle() const { return GetValue<Angle>(AttrType::Angle); }
+const source_engine::dmx::Quaternion *source_engine::dmx::Attribute::GetQuaternion() const { return GetValue<Quaternion>(AttrType::Quaternion); }
+const source_engine::dmx::Matrix *source_engine::dmx::Attribute::GetMatrix() const { return GetValue<Matrix>(AttrType::Matrix); }
+const source_engine::dmx::UInt64 *source_engine::dmx::Attribute::GetUInt64() const { return GetValue<UInt64>(AttrType::UInt64); }
+const source_engine::dmx::UInt8 *source_engine::dmx::Attribute::GetUInt8() const { return GetValue<UInt8>(AttrType::UInt8); }
+std::vector<std::shared_ptr<source_engine::dmx::Attribute>> *source_engine::dmx::Attribute::GetArray()
+{
+	if(m_readOnly)
+		return const_cast<std::vector<std::shared_ptr<source_engine::dmx::Attribute>> *>(GetArrayData());
+	auto *a = MakeArrayUnique();
+	MarkArrayChanged();
+	return a;
+}
 std::vector<std::shared_ptr<source_engine::dmx::Attribute>> *source_engine::dmx::Attribute::GetArray(AttrType type)
 {
 	if(this->type != type)
 		return nullptr;
-	return is_array_type(type) ? GetValue<std::vector<std::shared_ptr<source_engine::dmx::Attribute>>>(AttrType::ElementArray) : nullptr;
+	return GetArray();
+}
+std::optional<source_engine::dmx::ConstArrayView> source_engine::dmx::Attribute::GetArray() const
+{
+	auto *a = GetArrayData();
+	if(a == nullptr)
+		return {};
+	return ConstArrayView {std::ranges::ref_view {*a}, ConstItem {}};
+}
+std::optional<source_engine::dmx::ConstArrayView> source_engine::dmx::Attribute::GetArray(AttrType type) const
+{
+	if(this->type != type)
+		return {};
+	return GetArray();
+}
+const std::vector<std::shared_ptr<source_engine::dmx::Attribute>> *source_engine::dmx::Attribute::GetArrayData() const { return is_array_type(type) ? static_cast<const std::vector<std::shared_ptr<source_engine::dmx::Attribute>> *>(data.get()) : nullptr; }
+std::vector<std::shared_ptr<source_engine::dmx::Attribute>> *source_engine::dmx::Attribute::MakeArrayUnique()
+{
+	CheckWritable();
+	if(!is_array_type(type) || data == nullptr)
+		return nullptr;
+	auto *a = static_cast<std::vector<std::shared_ptr<source_engine::dmx::Attribute>> *>(data.get());
+	if(data.use_count() == 1) {
+		std::atomic_thread_fence(std::memory_order_acquire); // Synchronizes with a snapshot that has just released the array on another thread
+		return a;
+	}
+	// The items stay shared, so the indices only have to be moved to the copy
+	auto copy = std::make_shared<std::vector<std::shared_ptr<source_engine::dmx::Attribute>>>(*a);
+	if(auto *indices = GetIndices()) {
+		if(indices->positionsArray == a)
+			indices->positionsArray = copy.get();
+		if(auto nameIndex = indices->nameIndex.load(std::memory_order_relaxed); nameIndex && nameIndex->array == a)
+			nameIndex->array = copy.get();
+	}
+	data = copy;
+	return copy.get();
+}
+std::vector<std::shared_ptr<source_engine::dmx::Attribute>> *source_engine::dmx::Attribute::GetMutableArray() { return GetArray(); }
+void source_engine::dmx::Attribute::SetArrayIndexEnabled(bool enabled)
+{
+	CheckWritable();
+	if(enabled) {
+		GetOrCreateIndices().arrayIndexEnabled = true;
+		return;
+	}
+	auto *indices = GetIndices();
+	if(indices == nullptr)
+		return;
+	if(indices->nameIndex.load(std::memory_order_relaxed) == nullptr) {
+		m_indices.store(nullptr, std::memory_order_release);
+		delete indices;
+		return;
+	}
+	indices->arrayIndexEnabled = false;
+	indices->positionsArray = nullptr;
+	indices->positions = {};
+}
+bool source_engine::dmx::Attribute::IsArrayIndexEnabled() const
+{
+	auto *indices = GetIndices();
+	return indices && indices->arrayIndexEnabled;
+}
+uint64_t source_engine::dmx::Attribute::GetIndexMemoryUsage() const
+{
+	std::scoped_lock lock {get_name_index_mutex(*this)};
+	auto *indices = GetIndices();
+	if(indices == nullptr)
+		return 0;
+	uint64_t size = sizeof(Indices) + get_hash_table_size(indices->positions);
+	if(auto nameIndex = indices->nameIndex.load(std::memory_order_acquire)) {
+		size += sizeof(NameIndex) + nameIndex->renameCounts.capacity() * sizeof(nameIndex->renameCounts.front()) + get_hash_table_size(nameIndex->items);
+		for(auto &[name, items] : nameIndex->items)
+			size += get_string_heap_size(name) + items.capacity() * sizeof(items.front());
+		size += nameIndex->names.size() * (TREE_NODE_OVERHEAD + sizeof(std::string_view));
+	}
+	return size;
+}
+std::unordered_map<const source_engine::dmx::Attribute *, uint32_t> *source_engine::dmx::Attribute::GetArrayIndex()
+{
+	auto *pIndices = GetIndices();
+	if(pIndices == nullptr || !pIndices->arrayIndexEnabled)
+		return nullptr;
+	auto *a = GetArrayData();
+	if(a == nullptr)
+		return nullptr;
+	auto &indices = *pIndices;
+	if(indices.positionsArray != a) {
+		indices.positions.clear();
+		indices.positions.reserve(a->size());
+		for(uint32_t i = 0; i < a->size(); ++i)
+			indices.positions.emplace((*a)[i].get(), i);
+		indices.positionsArray = a;
+	}
+	return &indices.positions;
+}
+bool source_engine::dmx::Attribute::HasArrayValue(const source_engine::dmx::Attribute &attr)
+{
+	if(auto *positions = GetArrayIndex())
+		return positions->find(&attr) != positions->end();
+	auto *a = GetArrayData();
+	if(a == nullptr)
+		return false;
+	return std::find_if(a->begin(), a->end(), [&attr](const std::shared_ptr<source_engine::dmx::Attribute> &attrOther) { return attrOther.get() == &attr; }) != a->end();
+}
+void source_engine::dmx::Attribute::SetArrayValue(uint32_t idx, source_engine::dmx::Attribute &attr)
+{
+	CheckWritable();
+	if(get_array_type(attr.type) != type)
+		return;
+	auto *a = GetArrayData();
+	if(a == nullptr || idx >= a->size())
+		return;
+	auto *positions = GetArrayIndex();
+	auto *ma = MakeArrayUnique();
+	auto &item = (*ma)[idx];
+	if(positions) {
+		auto it = positions->find(&attr);
+		if(it != positions->end() && it->second != idx)
+			GetIndices()->positionsArray = nullptr; // The value is in the array twice now, which the index can't represent; It is rebuilt on the next access
+		else {
+			positions->erase(item.get());
+			(*positions)[&attr] = idx;
+		}
+	}
+	item = attr.shared_from_this();
+	ResetNameIndex(); // Keeping the array order of duplicate names intact isn't worth it here
 }
 void source_engine::dmx::Attribute::RemoveArrayValue(uint32_t idx)
 {
-	auto *a = GetArray();
+	CheckWritable();
+	auto *a = GetArrayData();
 	if(a == nullptr || idx >= a->size())
 		return;
-	a->erase(a->begin() + idx);
+	auto *positions = GetArrayIndex();
+	auto *nameIndex = GetValidNameIndex();
+	auto *ma = MakeArrayUnique();
+	if(nameIndex && !remove_from_name_index(*nameIndex, *(*ma)[idx]))
+		ResetNameIndex();
+	if(positions)
+		positions->erase((*ma)[idx].get());
+	ma->erase(ma->begin() + idx);
+	if(positions) {
+		for(auto i = idx; i < ma->size(); ++i)
+			(*positions)[(*ma)[i].get()] = i;
+	}
 }
 void source_engine::dmx::Attribute::RemoveArrayValue(source_engine::dmx::Attribute &attr)
 {
-	auto *a = GetArray();
+	CheckWritable();
+	auto *a = GetArrayData();
 	if(a == nullptr)
 		return;
+	if(auto *positions = GetArrayIndex()) {
+		auto it = positions->find(&attr);
+		if(it != positions->end())
+			RemoveArrayValue(it->second);
+		return;
+	}
 	auto it = std::find_if(a->begin(), a->end(), [&attr](const std::shared_ptr<source_engine::dmx::Attribute> &attrOther) { return attrOther.get() == &attr; });
 	if(it == a->end())
 		return;
@@ -507,15 +1628,100 @@ void source_engine::dmx::Attribute::RemoveArrayValue(source_engine::dmx::Attribu
 }
 void source_engine::dmx::Attribute::AddArrayValue(source_engine::dmx::Attribute &attr)
 {
+	CheckWritable();
 	if(get_array_type(attr.type) != type)
 		return;
-	auto *a = GetArray();
+	if(GetArrayData() == nullptr || HasArrayValue(attr))
+		return;
+	auto *positions = GetArrayIndex();
+	auto *nameIndex = GetValidNameIndex();
+	auto *a = MakeArrayUnique();
+	if(positions)
+		positions->emplace(&attr, static_cast<uint32_t>(a->size()));
+	a->push_back(attr.shared_from_this());
+	if(nameIndex)
+		add_to_name_index(*nameIndex, attr);
+}
+void source_engine::dmx::Attribute::AddArrayValues(const std::vector<std::shared_ptr<source_engine::dmx::Attribute>> &values)
+{
+	CheckWritable();
+	auto *a = GetArrayData();
+	if(a == nullptr || values.empty())
+		return;
+	auto *positions = GetArrayIndex();
+	auto *nameIndex = GetValidNameIndex();
+	auto *ma = MakeArrayUnique();
+	std::unordered_set<const source_engine::dmx::Attribute *> localItems {};
+	if(positions == nullptr) {
+		localItems.reserve(ma->size() + values.size());
+		for(auto &item : *ma)
+			localItems.insert(item.get());
+	}
+	ma->reserve(ma->size() + values.size());
+	for(auto &value : values) {
+		if(value == nullptr || get_array_type(value->type) != type)
+			continue;
+		auto added = positions ? positions->emplace(value.get(), static_cast<uint32_t>(ma->size())).second : localItems.insert(value.get()).second;
+		if(!added)
+			continue;
+		ma->push_back(value);
+		if(nameIndex)
+			add_to_name_index(*nameIndex, *value);
+	}
+}
+void source_engine::dmx::Attribute::RemoveArrayValues(const std::vector<const source_engine::dmx::Attribute *> &values)
+{
+	CheckWritable();
+	auto *a = GetArrayData();
+	if(a == nullptr || values.empty())
+		return;
+	auto *positions = GetArrayIndex();
+	std::unordered_set<const source_engine::dmx::Attribute *> toRemove {};
+	toRemove.reserve(values.size());
+	for(auto *value : values) {
+		if(!positions || positions->find(value) != positions->end())
+			toRemove.insert(value);
+	}
+	if(toRemove.empty())
+		return;
+	RemoveArrayValuesIf([&toRemove](const source_engine::dmx::Attribute &attr) { return toRemove.find(&attr) != toRemove.end(); });
+}
+void source_engine::dmx::Attribute::RemoveArrayValuesIf(const std::function<bool(const source_engine::dmx::Attribute &)> &predicate)
+{
+	CheckWritable();
+	auto *a = GetArrayData();
 	if(a == nullptr)
 		return;
-	auto it = std::find_if(a->begin(), a->end(), [&attr](const std::shared_ptr<source_engine::dmx::Attribute> &attrOther) { return attrOther.get() == &attr; });
-	if(it != a->end())
+	auto itFirst = std::find_if(a->begin(), a->end(), [&predicate](const std::shared_ptr<source_engine::dmx::Attribute> &item) { return item && predicate(*item); });
+	if(itFirst == a->end())
 		return;
-	a->push_back(attr.shared_from_this());
+	auto first = itFirst - a->begin();
+	auto *positions = GetArrayIndex();
+	auto *nameIndex = GetValidNameIndex();
+	auto *ma = MakeArrayUnique();
+	auto removeFromIndices = [positions, &nameIndex](const source_engine::dmx::Attribute &item) {
+		if(positions)
+			positions->erase(&item);
+		if(nameIndex && !remove_from_name_index(*nameIndex, item))
+			nameIndex = nullptr;
+	};
+	// The predicate has already been called for the first match
+	auto itOut = ma->begin() + first;
+	removeFromIndices(**itOut);
+	for(auto it = itOut + 1; it != ma->end(); ++it) {
+		if(*it && predicate(**it)) {
+			removeFromIndices(**it);
+			continue;
+		}
+		*itOut++ = std::move(*it);
+	}
+	ma->erase(itOut, ma->end());
+	if(positions) {
+		for(auto i = static_cast<uint32_t>(first); i < ma->size(); ++i)
+			(*positions)[(*ma)[i].get()] = i;
+	}
+	if(nameIndex == nullptr)
+		ResetNameIndex();
 }
 void source_engine::dmx::Attribute::DebugPrint(std::stringstream &ss)
 {
@@ -559,24 +1765,64 @@ void source_engine::dmx::Attribute::DebugPrint(std::stringstream &ss, std::unord
 }
 
 std::string source_engine::dmx::Element::GetGUIDAsString() const { return util::guid_to_string(GUID); }
+bool source_engine::dmx::Element::IsReadOnly() const { return m_readOnly; }
+void source_engine::dmx::Element::SetName(std::string name)
+{
+	if(m_readOnly)
+		throw std::logic_error {"Elements of file data snapshots are read-only!"};
+	this->name = std::move(name);
+	GetRenameCount()->fetch_add(1, std::memory_order_release);
+}
+const std::shared_ptr<std::atomic<uint64_t>> &source_engine::dmx::Element::GetRenameCount() const { return m_renameCount ? m_renameCount : get_default_rename_count(); }
 
-std::shared_ptr<source_engine::dmx::Element> source_engine::dmx::Element::Get(const std::string &name) const
+std::shared_ptr<source_engine::dmx::Element> source_engine::dmx::Element::Get(const std::string &name)
+{
+	auto it = nameToChildElement.find(name);
+	if(it == nameToChildElement.end() || it->second.expired())
+		return std::make_shared<source_engine::dmx::Element>(); // Not shared, since the caller may modify it
+	return it->second.lock();
+}
+std::shared_ptr<const source_engine::dmx::Element> source_engine::dmx::Element::Get(const std::string &name) const
 {
 	auto it = nameToChildElement.find(name);
 	if(it == nameToChildElement.end() || it->second.expired()) {
-		static auto emptyElement = std::make_shared<source_engine::dmx::Element>();
+		static auto emptyElement = std::make_shared<const source_engine::dmx::Element>();
 		return emptyElement;
 	}
 	return it->second.lock();
 }
 
-std::shared_ptr<source_engine::dmx::Attribute> source_engine::dmx::Element::GetAttr(const std::string &name) const
+std::shared_ptr<source_engine::dmx::Attribute> source_engine::dmx::Element::GetAttr(const std::string &name)
 {
 	auto it = attributes.find(name);
 	if(it == attributes.end())
 		return nullptr;
 	return it->second;
 }
+std::shared_ptr<const source_engine::dmx::Attribute> source_engine::dmx::Element::GetAttr(const std::string &name) const
+{
+	auto it = attributes.find(name);
+	if(it == attributes.end())
+		return nullptr;
+	return it->second;
+}
+
+void source_engine::dmx::Element::UpdateChildElementLookupTable()
+{
+	if(m_readOnly)
+		throw std::logic_error {"Elements of file data snapshots are read-only!"};
+	nameToChildElement.clear();
+	for(auto &pair : attributes) {
+		auto &attr = *pair.second;
+		if(attr.type != AttrType::Element || attr.data == nullptr)
+			continue;
+		auto &elRef = *static_cast<const source_engine::dmx::ElementRef *>(attr.data.get());
+		if(elRef.expired() == false) {
+			auto elChild = elRef.lock();
+			nameToChildElement[elChild->name] = elChild;
+		}
+	}
+}
 
 void source_engine::dmx::Element::DebugPrint(std::stringstream &ss)
 {
@@ -598,36 +1844,53 @@ void source_engine::dmx::Element::DebugPrint(std::stringstream &ss, std::unorder
 	}
 }
 
-std::shared_ptr<source_engine::dmx::FileData> source_engine::dmx::FileData::Load(const std::shared_ptr<ufile::IFile> &f)
+std::shared_ptr<source_engine::dmx::FileData> source_engine::dmx::FileData::Load(const std::shared_ptr<ufile::IFile> &f) { return Load(f, LoadOptions {}); }
+std::shared_ptr<source_engine::dmx::FileData> source_engine::dmx::FileData::Load(const std::shared_ptr<ufile::IFile> &f, const LoadOptions &options)
 {
-	auto dmxHeader = source_engine::dmx::BinaryDMX_v5 {};
-	const char *headerEnd = "-->";
-	uint32_t headerMatch = 0;
-	auto c = f->ReadChar();
-	while(headerMatch < 3 && f->Eof() == false) {
-		dmxHeader.header += c;
-		if(dmxHeader.header.length() > 1'024) // DMX header should never be this long; Assume that something is wrong
-			throw std::runtime_error("DMX header not found!");
-		if(c == headerEnd[headerMatch])
-			++headerMatch;
-		else
-			headerMatch = 0;
-		c = f->ReadChar();
-	}
-	if(f->Eof())
-		throw std::runtime_error("DMX header not found!");
-
-	std::vector<std::string> headerData;
-	ustring::split(dmxHeader.header, headerData);
-
-	if(headerData.size() < 2 || headerData.at(1) != "dmx")
+	LoaderContext context {};
+	return Load(f, options, context);
+}
+std::shared_ptr<source_engine::dmx::FileData> source_engine::dmx::FileData::Load(const std::shared_ptr<ufile::IFile> &f, const LoadOptions &options, LoaderContext &context)
+{
+	// The validation pass seeks back to the start of the data, so the decompressed data has to be kept in full for it
+	if(detect_compression(*f) != Compression::None)
+		return Load(open_decompressed(f, options.validateBinary), options, context);
+	auto startPos = f->Tell();
+	auto header = Probe(f);
+	if(!header)
 		throw std::runtime_error("Not a valid dmx file!");
-	else if(headerData.at(3) == "keyvalues2") {
+	// Skip the header and the line break that follows it
+	f->Seek(startPos + header->headerSize + 1);
+
+	if(header->IsKeyValues2()) {
 		// Not a DMX binary file, try loading KeyValues2 version
 		std::shared_ptr<KeyValues2::Array> dmxRoot = nullptr;
-		auto result = KeyValues2::Load(f, dmxRoot);
+		std::function<bool()> topLevelItemCallback = nullptr;
+		if(options.progressCallback || options.stopToken.stop_possible()) {
+			topLevelItemCallback = [&f, &options, bytesTotal = f->GetSize(), numItems = uint32_t {0}]() mutable -> bool {
+				if(options.stopToken.stop_requested())
+					return false;
+				if(options.progressCallback) {
+					LoadProgress progress {};
+					progress.bytesProcessed = f->Tell();
+					progress.bytesTotal = bytesTotal;
+					progress.elementsProcessed = ++numItems;
+					options.progressCallback(progress);
+				}
+				return true;
+			};
+		}
+		std::optional<KeyValues2::Filter> kv2Filter {};
+		if(!options.filter.IsEmpty()) {
+			kv2Filter = KeyValues2::Filter {};
+			kv2Filter->isElementTypeIncluded = [&options](const std::string &type) { return options.filter.IsElementTypeIncluded(type); };
+			kv2Filter->isAttributeIncluded = [&options](const std::string &name) { return options.filter.IsAttributeIncluded(name); };
+		}
+		auto result = KeyValues2::Load(f, dmxRoot, topLevelItemCallback, &context.m_kv2StringBuffer, kv2Filter ? &*kv2Filter : nullptr);
 		if(result == KeyValues2::Result::Success) {
-			auto result = CreateFromKeyValues2Data(dmxRoot.get());
+			auto result = CreateFromKeyValues2Data(dmxRoot.get(), options, context);
+			if(result == nullptr)
+				return nullptr; // Cancelled
 			result->UpdateRootElement();
 			result->UpdateChildElementLookupTables();
 
@@ -644,29 +1907,20 @@ std::shared_ptr<source_engine::dmx::FileData> source_engine::dmx::FileData::Load
 		case KeyValues2::Result::SyntaxError:
 			throw std::runtime_error("Unable to load dmx file: Syntax error!");
 			break;
+		case KeyValues2::Result::Cancelled:
 		default:
 			break;
 		}
 		return nullptr;
 	}
-	else if(headerData.at(3) != "binary")
+	else if(header->IsBinary() == false)
 		throw std::runtime_error("Not a valid dmx file!");
 
 	f->Seek(f->Tell() + 1); // Skip '\0'-byte
-	auto fGetHeaderData = [&headerData](const std::string &id, std::string &val, uint32_t &version) -> bool {
-		auto it = std::find(headerData.begin(), headerData.end(), id);
-		if((it - headerData.begin()) >= headerData.size() - 2)
-			return false;
-		val = *(it + 1);
-		version = util::to_int(*(it + 2));
-		return true;
-	};
-	std::string encoding {};
-	uint32_t encodingVersion = 0;
-	std::string format;
-	uint32_t formatVersion = 0;
-	if(fGetHeaderData("encoding", encoding, encodingVersion) == false || fGetHeaderData("format", format, formatVersion) == false)
-		throw std::runtime_error("Invalid dmx header: \"" + dmxHeader.header + "\"!");
+	if(header->GetFormat().empty())
+		throw std::runtime_error("Invalid dmx header: Missing format!");
+	std::string encoding {header->GetEncoding()};
+	auto encodingVersion = header->encodingVersion;
 
 	if(encodingVersion >= 9) {
 		throw std::runtime_error("Unsupported dmx format version " + std::to_string(encodingVersion) + "!");
@@ -674,145 +1928,62 @@ std::shared_ptr<source_engine::dmx::FileData> source_engine::dmx::FileData::Load
 		// TODO: Read prefix attributes
 	}
 
-	source_engine::dmx::StringDictionary dictionary(f, encoding, encodingVersion);
+	auto validated = options.validateBinary;
+	std::optional<BinaryLayoutInfo> layoutInfo {};
+	if(validated) {
+		auto dataStart = f->Tell();
+		layoutInfo = validate_binary(*f, encoding, encodingVersion, context.m_readBuffer);
+		f->Seek(dataStart);
+	}
+
+	source_engine::dmx::StringDictionary dictionary(f, encoding, encodingVersion, context.m_dictionary, context.m_internedDictionary, options.stringInterner.get(), validated);
 	auto fd = std::shared_ptr<FileData>(new FileData());
 
 	auto numElements = f->Read<int32_t>();
-	fd->m_elements.reserve(numElements * 1.05);                            // Reserve 5% extra for potential missing elements, which will be added to the container dynamically
-	std::vector<std::shared_ptr<source_engine::dmx::Element>> elements {}; // Temporary container which owns all elements; Will be discarded once elements have been assigned to their attributes
-	elements.reserve(numElements);
+	if(layoutInfo)
+		fd->m_elements.reserve(numElements + layoutInfo->numMissingElements);
+	else {
+		auto reserveCount = std::min<size_t>(std::max(numElements, 0), UNCHECKED_BLOCK_SIZE);
+		fd->m_elements.reserve(reserveCount * 1.05); // Reserve 5% extra for potential missing elements, which will be added to the container dynamically
+	}
 	for(auto i = decltype(numElements) {0}; i < numElements; ++i) {
-		elements.push_back(std::make_shared<Element>());
-		auto &el = elements.back();
+		if(!layoutInfo && i > 0 && i % UNCHECKED_BLOCK_SIZE == 0 && f->Eof())
+			throw std::runtime_error {"Invalid dmx file: Unexpected end of file!"};
+		auto &el = fd->m_elements.emplace_back(std::make_shared<Element>());
 		el->type = dictionary.ReadString();
 		el->name = (encodingVersion >= 4) ? dictionary.ReadString() : dictionary.GetString();
 		el->GUID = f->Read<std::array<uint8_t, 16>>();
-		fd->m_elements.push_back(el);
 	}
 
-	auto fGetValue = [&f, &dictionary, encodingVersion, &fd](std::vector<std::shared_ptr<Element>> &elements, source_engine::dmx::AttrType type, bool bFromArray = false) -> std::shared_ptr<source_engine::dmx::Attribute> {
-		auto attr = std::make_shared<source_engine::dmx::Attribute>();
-		attr->type = type;
-		switch(type) {
-		case source_engine::dmx::AttrType::Element:
-			{
-				auto elIdx = f->Read<int32_t>();
-				if(elIdx == -1)
-					return attr;
-				else if(elIdx == -2) {
-					if(elements.capacity() == elements.size())
-						elements.reserve(elements.size() + 100); // Reserve for potential future missing elements
-					elements.push_back(std::make_shared<Element>());
-					auto &el = elements.back();
-					auto id = f->ReadString();
-					el->name = "Missing element";
-					//el->id = id; // TODO
-					attr->data = std::make_shared<ElementRef>(el);
-				}
-				else
-					attr->data = std::make_shared<ElementRef>(elements.at(elIdx));
-				break;
-			}
-		case source_engine::dmx::AttrType::String:
-			{
-				attr->data = std::make_shared<String>((encodingVersion < 4 || bFromArray) ? dictionary.GetString() : dictionary.ReadString());
-				break;
-			}
-		case source_engine::dmx::AttrType::Int:
-			{
-				attr->data = std::make_shared<Int>(f->Read<Int>());
-				break;
-			}
-		case source_engine::dmx::AttrType::Float:
-			{
-				attr->data = std::make_shared<Float>(f->Read<Float>());
-				break;
-			}
-		case source_engine::dmx::AttrType::Bool:
-			{
-				attr->data = std::make_shared<Bool>(f->Read<Bool>());
-				break;
-			}
-		case source_engine::dmx::AttrType::Vector2:
-			{
-				attr->data = std::make_shared<Vector2>(f->Read<Vector2>());
-				break;
-			}
-		case source_engine::dmx::AttrType::Vector3:
-			{
-				attr->data = std::make_shared<Vector3>(f->Read<Vector3>());
-				break;
-			}
-		case source_engine::dmx::AttrType::Angle:
-			{
-				auto v = f->Read<Vector3>();
-				attr->data = std::make_shared<EulerAngles>(EulerAngles(v.x, v.y, v.z));
-				break;
-			}
-		case source_engine::dmx::AttrType::Vector4:
-			{
-				attr->data = std::make_shared<Vector4>(f->Read<Vector4>());
-				break;
-			}
-		case source_engine::dmx::AttrType::Quaternion:
-			{
-				attr->data = std::make_shared<Quat>(f->Read<Quat>());
-				break;
-			}
-		case source_engine::dmx::AttrType::Matrix:
-			{
-				attr->data = std::make_shared<Mat4>(f->Read<Mat4>());
-				break;
-			}
-		case source_engine::dmx::AttrType::Color:
-			{
-				attr->data = std::make_shared<Color>(f->Read<Color>());
-				break;
-			}
-		case source_engine::dmx::AttrType::Time:
-			{
-				auto t = f->Read<int32_t>();
-				attr->data = std::make_shared<Time>(source_engine::dmx::get_time(t));
-				break;
-			}
-		case source_engine::dmx::AttrType::Binary:
-			{
-				attr->data = std::make_shared<Binary>();
-				auto &data = *static_cast<Binary *>(attr->data.get());
-				auto len = f->Read<int32_t>();
-				data.resize(len);
-				f->Read(data.data(), data.size() * sizeof(data.front()));
-				break;
-			}
-		default:
-			throw std::logic_error {"Unsupported DMX data type '" + std::to_string(umath::to_integral(type)) + "'"};
-		}
-		return attr;
-	};
+	Schema::LoadScope schemaScope {options.schema.get()};
+	BinaryBodyReader bodyReader {f, dictionary, encoding, encodingVersion, validated, context.m_timeTicks, context.m_quaternionComponents, context.m_quaternions};
+	bodyReader.SetSchema(options.schema.get());
+	auto *filter = options.filter.IsEmpty() ? nullptr : &options.filter;
+
+	LoadProgress progress {};
+	if(options.progressCallback) {
+		progress.bytesTotal = f->GetSize();
+		progress.elementsTotal = numElements;
+	}
+	constexpr uint32_t progressInterval = 256;
 
 	// Note: We have to use numElements instead of fd->m_elements.size(), because the container size
 	// can change due to missing elements that are added dynamically
 	for(auto i = decltype(numElements) {0}; i < numElements; ++i) {
-		auto &el = *fd->m_elements.at(i);
-		auto numAttributes = f->Read<int32_t>();
-		for(auto j = decltype(numAttributes) {0}; j < numAttributes; ++j) {
-			auto name = dictionary.ReadString();
-			auto attrType = source_engine::dmx::get_id_type(encoding, encodingVersion, f->Read<uint8_t>());
-			if(source_engine::dmx::is_single_type(attrType))
-				el.attributes[name] = fGetValue(fd->m_elements, attrType);
-			else if(source_engine::dmx::is_array_type(attrType)) {
-				auto singleType = source_engine::dmx::get_single_type(attrType);
-				auto &attr = el.attributes[name] = std::make_shared<source_engine::dmx::Attribute>();
-				attr->type = attrType;
-				attr->data = std::make_shared<std::vector<std::shared_ptr<source_engine::dmx::Attribute>>>();
-				auto &attributes = *static_cast<std::vector<std::shared_ptr<source_engine::dmx::Attribute>> *>(attr->data.get());
-
-				auto len = f->Read<int32_t>();
-				attributes.reserve(len);
-				for(auto k = decltype(len) {0}; k < len; ++k)
-					attributes.push_back(fGetValue(fd->m_elements, singleType, true));
-			}
+		if(options.stopToken.stop_requested())
+			return nullptr;
+		if(options.progressCallback && (i % progressInterval) == 0) {
+			progress.bytesProcessed = f->Tell();
+			progress.elementsProcessed = i;
+			options.progressCallback(progress);
 		}
+		bodyReader.ReadBody(*fd->m_elements[i], fd->m_elements, filter);
+	}
+
+	if(options.progressCallback) {
+		progress.bytesProcessed = f->Tell();
+		progress.elementsProcessed = numElements;
+		options.progressCallback(progress);
 	}
 
 	fd->UpdateRootElement();
@@ -822,100 +1993,211 @@ std::shared_ptr<source_engine::dmx::FileData> source_engine::dmx::FileData::Load
 	// std::cout<<ss.str()<<std::endl;
 	return fd;
 }
-void source_engine::dmx::FileData::UpdateChildElementLookupTables()
+source_engine::dmx::ElementIndex source_engine::dmx::ElementIndex::Build(const std::shared_ptr<ufile::IFile> &file)
 {
-	std::function<void(source_engine::dmx::Element &)> fIterateChildren = nullptr;
-	auto fIterateAttributeChildren = [&fIterateChildren](source_engine::dmx::Attribute &attr) {
-		auto &children = *static_cast<std::vector<std::shared_ptr<source_engine::dmx::Attribute>> *>(attr.data.get());
-		for(auto &child : children) {
-			if(child->data == nullptr)
-				continue; // Child points to non-existing element? This shouldn't happen!
-			if(child->type != source_engine::dmx::AttrType::Element)
-				throw std::logic_error {"Object of non-Element type is member of Element array!"};
-			auto &elRef = *static_cast<const source_engine::dmx::ElementRef *>(child->data.get());
-			if(elRef.expired() == false)
-				fIterateChildren(*static_cast<source_engine::dmx::Element *>(elRef.lock().get()));
-		}
-	};
+	auto f = open_decompressed(file, true);
+	auto startPos = f->Tell();
+	auto header = FileData::Probe(f);
+	if(!header || header->IsBinary() == false)
+		throw std::runtime_error("Unable to build element index: Not a binary dmx file!");
+	std::string encoding {header->GetEncoding()};
+	auto encodingVersion = header->encodingVersion;
+	if(encodingVersion >= 9)
+		throw std::runtime_error("Unsupported dmx format version " + std::to_string(encodingVersion) + "!");
+	// Skip the header, the line break and the '\0'-byte
+	auto dataStart = startPos + header->headerSize + 2;
+	f->Seek(dataStart);
 
-	fIterateChildren = [this, &fIterateChildren, &fIterateAttributeChildren](source_engine::dmx::Element &el) {
-		for(auto &pair : el.attributes) {
-			auto &attr = *pair.second;
-			if(attr.data == nullptr)
-				continue; // This shouldn't happen?
-			switch(attr.type) {
-			case source_engine::dmx::AttrType::Element:
-				{
-					auto &elRef = *static_cast<const source_engine::dmx::ElementRef *>(attr.data.get());
-					if(elRef.expired() == false) {
-						auto elChild = elRef.lock();
-						el.nameToChildElement[elChild->name] = elChild;
-					}
-					break;
-				}
-			case source_engine::dmx::AttrType::ElementArray:
-				{
-					fIterateAttributeChildren(attr);
-					break;
-				}
-			}
+	ElementIndex index {};
+	index.m_encoding = encoding;
+	index.m_encodingVersion = encodingVersion;
+	index.m_sourceSize = f->GetSize() - startPos;
+
+	// The validation pass steps over every element body anyway, so it's used to collect the offsets
+	std::vector<uint8_t> buffer {};
+	auto layoutInfo = validate_binary(*f, encoding, encodingVersion, buffer, true);
+	index.m_dictionaryStringOffsets.reserve(layoutInfo.stringOffsets.size());
+	for(auto offset : layoutInfo.stringOffsets)
+		index.m_dictionaryStringOffsets.push_back(offset - startPos);
+	f->Seek(dataStart);
+	std::vector<std::string> dictionaryStrings {};
+	std::vector<std::shared_ptr<const String>> internedStrings {};
+	StringDictionary dictionary {f, encoding, encodingVersion, dictionaryStrings, internedStrings, nullptr, true};
+	auto numElements = static_cast<uint32_t>(f->Read<int32_t>());
+
+	std::unordered_map<std::string, uint32_t> stringIndices {};
+	auto addString = [&index, &stringIndices](const std::string &str) {
+		auto it = stringIndices.find(str);
+		if(it == stringIndices.end()) {
+			it = stringIndices.insert({str, static_cast<uint32_t>(index.m_strings.size())}).first;
+			index.m_strings.push_back(str);
 		}
+		return it->second;
 	};
-	auto elRoot = std::static_pointer_cast<source_engine::dmx::ElementRef>(m_rootAttribute->data);
-	if(elRoot && elRoot->expired() == false)
-		fIterateChildren(*elRoot->lock());
+	index.m_entries.reserve(numElements);
+	for(uint32_t i = 0; i < numElements; ++i) {
+		Entry entry {};
+		entry.type = addString(dictionary.ReadStringRef());
+		entry.name = addString((encodingVersion >= 4) ? dictionary.ReadStringRef() : dictionary.GetString());
+		entry.GUID = f->Read<util::GUID>();
+		entry.headerOffset = layoutInfo.headerOffsets[i] - startPos;
+		entry.bodyOffset = layoutInfo.bodyOffsets[i] - startPos;
+		index.m_entries.push_back(entry);
+	}
+	index.UpdateLookupTable();
+	return index;
 }
-void source_engine::dmx::FileData::UpdateRootElement()
+std::shared_ptr<source_engine::dmx::FileData> source_engine::dmx::FileData::LoadElements(const std::shared_ptr<ufile::IFile> &file, const ElementIndex &index, const std::vector<util::GUID> &guids, const LoadOptions &options)
 {
-	std::unordered_set<source_engine::dmx::Element *> nestedElements {};
-	std::function<void(const source_engine::dmx::Element &)> fIterateChildren = nullptr;
-	fIterateChildren = [&fIterateChildren, &nestedElements](const source_engine::dmx::Element &el) {
-		for(auto &pair : el.attributes) {
-			auto &attr = *pair.second;
-			if(attr.data == nullptr)
-				continue; // This shouldn't happen?
-			switch(attr.type) {
-			case source_engine::dmx::AttrType::Element:
-				{
-					auto &elRef = *static_cast<const source_engine::dmx::ElementRef *>(attr.data.get());
-					if(elRef.expired() == false)
-						nestedElements.insert(static_cast<source_engine::dmx::Element *>(elRef.lock().get()));
-					break;
-				}
-			case source_engine::dmx::AttrType::ElementArray:
-				{
-					auto &children = *static_cast<std::vector<std::shared_ptr<source_engine::dmx::Attribute>> *>(attr.data.get());
-					for(auto &child : children) {
-						if(child->data == nullptr)
-							continue; // Child in array points to non-existing element? This shouldn't happen!
-						if(child->type != source_engine::dmx::AttrType::Element)
-							throw std::logic_error {"Object of non-Element type is member of Element array!"};
-						auto &elRef = *static_cast<const source_engine::dmx::ElementRef *>(child->data.get());
-						if(elRef.expired() == false)
-							fIterateChildren(*static_cast<source_engine::dmx::Element *>(elRef.lock().get()));
-					}
-					break;
-				}
-			}
+	auto f = open_decompressed(file, true);
+	auto startPos = f->Tell();
+	if(f->GetSize() - startPos != index.GetSourceSize())
+		throw std::runtime_error("Element index does not match dmx file!");
+	auto &encoding = index.GetEncoding();
+	auto encodingVersion = index.GetEncodingVersion();
+	LoaderContext context {};
+	// Only the strings used by the decoded elements are read from the dictionary
+	std::vector<uint64_t> stringOffsets {};
+	stringOffsets.reserve(index.GetDictionaryStringOffsets().size());
+	for(auto offset : index.GetDictionaryStringOffsets())
+		stringOffsets.push_back(startPos + offset);
+	StringDictionary dictionary {f, encoding, encodingVersion, stringOffsets, context.m_dictionary, context.m_internedDictionary, options.stringInterner.get()};
+
+	// Elements are created on demand, indexed by their position in the file's element table. Missing elements are appended.
+	auto &entries = index.GetEntries();
+	std::vector<std::shared_ptr<Element>> elements(entries.size());
+	std::vector<uint32_t> pending {};
+	for(auto &guid : guids) {
+		auto entryIdx = index.FindEntry(guid);
+		if(!entryIdx || elements[*entryIdx])
+			continue;
+		elements[*entryIdx] = std::make_shared<Element>();
+		pending.push_back(*entryIdx);
+	}
+	Schema::LoadScope schemaScope {options.schema.get()};
+	BinaryBodyReader bodyReader {f, dictionary, encoding, encodingVersion, false, context.m_timeTicks, context.m_quaternionComponents, context.m_quaternions};
+	bodyReader.SetPendingElements(&pending);
+	bodyReader.SetSchema(options.schema.get());
+	auto *filter = options.filter.IsEmpty() ? nullptr : &options.filter;
+
+	auto fd = std::shared_ptr<FileData>(new FileData());
+	// Bodies are read in file order where possible, which keeps the seeks short
+	std::priority_queue<uint32_t, std::vector<uint32_t>, std::greater<uint32_t>> queue {};
+	for(;;) {
+		for(auto idx : pending) {
+			queue.push(idx);
+			fd->m_elements.push_back(elements[idx]);
 		}
-	};
-	for(auto &el : m_elements)
-		fIterateChildren(*el);
+		pending.clear();
+		if(queue.empty())
+			break;
+		if(options.stopToken.stop_requested())
+			return nullptr;
+		auto idx = queue.top();
+		queue.pop();
+		auto &entry = entries[idx];
+		auto &el = *elements[idx];
+		el.type = index.GetString(entry.type);
+		el.name = index.GetString(entry.name);
+		el.GUID = entry.GUID;
+		f->Seek(startPos + entry.bodyOffset);
+		bodyReader.ReadBody(el, elements, filter);
+	}
+	fd->m_elements.insert(fd->m_elements.end(), elements.begin() + entries.size(), elements.end());
 
+	fd->UpdateRootElement();
+	fd->UpdateChildElementLookupTables();
+	return fd;
+}
+void source_engine::dmx::FileData::UpdateChildElementLookupTables()
+{
+	// The loaders add every element they create to the element list, nested ones included, so a single pass over the
+	// list reaches all of them without walking the graph
+	for(auto &el : m_elements) {
+		AdoptElement(*el);
+		el->UpdateChildElementLookupTable();
+	}
+}
+void source_engine::dmx::FileData::AdoptElement(Element &el) const
+{
+	if(el.m_renameCount == m_renameCount || el.m_readOnly)
+		return;
+	// Name indices that have been built with the previous counter wouldn't notice renames anymore
+	el.GetRenameCount()->fetch_add(1, std::memory_order_release);
+	el.m_renameCount = m_renameCount;
+}
+void source_engine::dmx::FileData::UpdateRootElement()
+{
 	auto attr = std::make_shared<Attribute>();
 	attr->type = AttrType::Element;
 	attr->data = (m_elements.empty() == false) ? std::make_shared<source_engine::dmx::ElementRef>(m_elements.front()) : nullptr;
 	m_rootAttribute = attr;
 }
+std::shared_ptr<source_engine::dmx::FileData> source_engine::dmx::FileData::Create(std::vector<std::shared_ptr<Element>> &&elements)
+{
+	auto fd = std::shared_ptr<FileData>(new FileData());
+	fd->m_elements = std::move(elements);
+	fd->UpdateRootElement();
+	// Unlike with the loaders, the list doesn't have to contain every element, so the elements referenced by it are updated as well
+	ElementTraversal traversal {fd->m_elements};
+	for(auto &el : traversal.GetElements()) {
+		fd->AdoptElement(*el);
+		el->UpdateChildElementLookupTable();
+	}
+	return fd;
+}
+bool source_engine::dmx::LoadFilter::IsEmpty() const { return includeElementTypes.empty() && excludeElementTypes.empty() && includeAttributes.empty() && excludeAttributes.empty(); }
+bool source_engine::dmx::LoadFilter::IsElementTypeIncluded(const std::string &type) const
+{
+	if(!includeElementTypes.empty() && includeElementTypes.find(type) == includeElementTypes.end())
+		return false;
+	return excludeElementTypes.find(type) == excludeElementTypes.end();
+}
+bool source_engine::dmx::LoadFilter::IsAttributeIncluded(const std::string &name) const
+{
+	if(!includeAttributes.empty() && includeAttributes.find(name) == includeAttributes.end())
+		return false;
+	return excludeAttributes.find(name) == excludeAttributes.end();
+}
+void source_engine::dmx::LoaderContext::Clear()
+{
+	m_dictionary = {};
+	m_internedDictionary = {};
+	m_timeTicks = {};
+	m_quaternionComponents = {};
+	m_quaternions = {};
+	m_readBuffer = {};
+	m_kv2StringBuffer = {};
+	m_kv2IdToElement = {};
+	m_kv2RefsToUpdate = {};
+}
 const std::vector<std::shared_ptr<source_engine::dmx::Element>> &source_engine::dmx::FileData::GetElements() const { return m_elements; }
 const std::shared_ptr<source_engine::dmx::Attribute> &source_engine::dmx::FileData::GetRootAttribute() const { return m_rootAttribute; }
 
-source_engine::dmx::Time source_engine::dmx::get_time(const std::string &value) { return get_time(util::to_int(value)); }
-source_engine::dmx::Time source_engine::dmx::get_time(int32_t value) { return value / 10'000.0; }
+source_engine::dmx::Time source_engine::dmx::get_time(const std::string &value)
+{
+	// Text formats store times as seconds
+	double seconds = 0.0;
+	std::from_chars(value.data(), value.data() + value.size(), seconds);
+	return Time::FromSeconds(seconds);
+}
+source_engine::dmx::Time source_engine::dmx::get_time(int32_t value) { return Time::FromTicks(value); }
 Quat source_engine::dmx::get_quaternion(const std::string &value)
 {
-	auto rot = uquat::create(value);
-	rot = {rot.z, rot.w, rot.x, rot.y};
+	// Components are stored as 'x y z w'
+	std::array<float, 4> xyzw {0.f, 0.f, 0.f, 1.f};
+	auto *p = value.data();
+	auto *end = value.data() + value.size();
+	for(auto &v : xyzw) {
+		while(p < end && (*p == ' ' || *p == '\t'))
+			++p;
+		auto res = std::from_chars(p, end, v);
+		if(res.ec != std::errc {})
+			break;
+		p = res.ptr;
+	}
+	Quat rot;
+	decode_quaternions(xyzw.data(), &rot, 1);
 	return rot;
 }
 
@@ -7,6 +7,12 @@
 #include <cinttypes>
 #include <memory>
 #include <vector>
+#include <array>
+#include <type_traits>
+#include <string>
+#include <cmath>
+#include <compare>
+#include <limits>
 #include <mathutil/umath.h>
 #include <mathutil/eulerangles.h>
 #include <mathutil/uquat.h>
@@ -19,8 +25,45 @@ namespace source_engine::dmx {
 	using Bool = bool;
 	using String = std::string;
 	using Binary = std::vector<uint8_t>;
-	using Time = float;
-	// using ObjectId = ;
+	// Time value in ticks of 1/10000th of a second, which is the representation used by dmx files.
+	// Keeping the ticks avoids the precision loss of float seconds on long timelines.
+	class Time {
+	  public:
+		static constexpr int32_t TICKS_PER_SECOND = 10'000;
+		static constexpr Time FromTicks(int32_t ticks) { return Time {ticks}; }
+		// Rounds to the nearest tick. Times outside of the range of the ticks (about +-59.6 hours) are clamped, NaN becomes 0.
+		static Time FromSeconds(double seconds)
+		{
+			auto ticks = std::round(seconds * TICKS_PER_SECOND);
+			if(std::isnan(ticks))
+				return Time {};
+			if(ticks <= static_cast<double>(std::numeric_limits<int32_t>::min()))
+				return Time {std::numeric_limits<int32_t>::min()};
+			if(ticks >= static_cast<double>(std::numeric_limits<int32_t>::max()))
+				return Time {std::numeric_limits<int32_t>::max()};
+			return Time {static_cast<int32_t>(ticks)};
+		}
+
+		constexpr Time() = default;
+		// Times used to be float seconds; Same as FromSeconds. Arithmetic on times still converts them to float, which
+		// has to be assigned back, i.e. "t += dt" has to become "t = Time::FromSeconds(t + dt)".
+		[[deprecated("Use Time::FromSeconds")]] Time(float seconds) : Time {FromSeconds(seconds)} {}
+		constexpr int32_t GetTicks() const { return m_ticks; }
+		constexpr float GetSeconds() const { return static_cast<float>(GetSecondsDouble()); }
+		constexpr double GetSecondsDouble() const { return m_ticks / static_cast<double>(TICKS_PER_SECOND); }
+		// Times used to be stored as float seconds
+		constexpr operator float() const { return GetSeconds(); }
+		constexpr bool operator==(const Time &other) const = default;
+		constexpr auto operator<=>(const Time &other) const = default;
+		// Comparisons with float seconds, which would otherwise be ambiguous between the float constructor and the float conversion
+		friend constexpr bool operator==(const Time &time, float seconds) { return time.GetSeconds() == seconds; }
+		friend constexpr auto operator<=>(const Time &time, float seconds) { return time.GetSeconds() <=> seconds; }
+	  private:
+		constexpr explicit Time(int32_t ticks) : m_ticks {ticks} {}
+		int32_t m_ticks = 0;
+	};
+	static_assert(sizeof(Time) == sizeof(int32_t) && std::is_trivially_copyable_v<Time>);
+	using ObjectId = std::array<uint8_t, 16>;
 	using Color = std::array<uint8_t, 4>;
 	using Vector2 = ::Vector2;
 	using Vector3 = ::Vector3;
@@ -37,7 +80,7 @@ namespace source_engine::dmx {
 	using StringArray = std::vector<String>;
 	using BinaryArray = std::vector<Binary>;
 	using TimeArray = std::vector<Time>;
-	// using ObjectIdArray = ;
+	using ObjectIdArray = std::vector<ObjectId>;
 	using ColorArray = std::vector<Color>;
 	using Vector2Array = std::vector<Vector2>;
 	using Vector3Array = std::vector<Vector3>;
@@ -0,0 +1,501 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "dmx_types.hpp"
+#include <sharedutils/util.h>
+#include <sharedutils/util_ifile.hpp>
+#include <array>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <string_view>
+#include <unordered_map>
+
+module source_engine.dmx;
+
+namespace source_engine::dmx {
+	AttrType get_id_type(const std::string &encoding, uint32_t encodingVersion, uint32_t id);
+
+	static constexpr uint32_t BINARY_ENCODING_VERSION = 5;
+	static constexpr uint32_t KEYVALUES2_ENCODING_VERSION = 1;
+	static constexpr size_t WRITE_BUFFER_SIZE = 64 * 1'024;
+
+	// KeyValues2 type names, indexed by AttrType
+	static constexpr std::array<std::string_view, umath::to_integral(AttrType::ArrayLast) + 1> s_kv2TypeNames = {"", "element", "int", "float", "bool", "string", "binary", "time", "elementid", "color", "vector2", "vector3", "vector4", "qangle", "quaternion", "matrix", "uint64", "uint8",
+	  "element_array", "int_array", "float_array", "bool_array", "string_array", "binary_array", "time_array", "elementid_array", "color_array", "vector2_array", "vector3_array", "vector4_array", "qangle_array", "quaternion_array", "matrix_array"};
+
+	static const std::vector<std::shared_ptr<Attribute>> &get_array_items(const Attribute &attr)
+	{
+		static const std::vector<std::shared_ptr<Attribute>> emptyArray {};
+		return attr.data ? *static_cast<const std::vector<std::shared_ptr<Attribute>> *>(attr.data.get()) : emptyArray;
+	}
+
+	static std::string create_header(std::string_view encoding, uint32_t encodingVersion, const SaveOptions &options)
+	{
+		return "<!-- dmx encoding " + std::string {encoding} + ' ' + std::to_string(encodingVersion) + " format " + options.format + ' ' + std::to_string(options.formatVersion) + " -->\n";
+	}
+
+	// Collects the output in a buffer, so that the file is written in large blocks; Flush has to be called at the end.
+	// The destructor doesn't flush, since an exception from the file would terminate the program during unwinding.
+	class FileWriter {
+	  public:
+		FileWriter(ufile::IFile &f) : m_file {f} { m_buffer.reserve(WRITE_BUFFER_SIZE + 256); }
+		void Flush()
+		{
+			if(m_buffer.empty())
+				return;
+			m_file.Write(m_buffer.data(), m_buffer.size());
+			m_buffer.clear();
+		}
+		void Write(const void *data, size_t size)
+		{
+			if(size >= WRITE_BUFFER_SIZE) {
+				Flush();
+				m_file.Write(data, size);
+				return;
+			}
+			m_buffer.append(static_cast<const char *>(data), size);
+			if(m_buffer.size() >= WRITE_BUFFER_SIZE)
+				Flush();
+		}
+		void Write(std::string_view str) { Write(str.data(), str.size()); }
+		void Write(char c)
+		{
+			m_buffer += c;
+			if(m_buffer.size() >= WRITE_BUFFER_SIZE)
+				Flush();
+		}
+		template<typename T>
+		    requires(std::is_trivially_copyable_v<T>)
+		void WriteValue(const T &value)
+		{
+			Write(&value, sizeof(value));
+		}
+	  private:
+		ufile::IFile &m_file;
+		std::string m_buffer;
+	};
+
+	class BinaryWriter {
+	  public:
+		BinaryWriter(ufile::IFile &f, const std::vector<std::shared_ptr<Element>> &elements) : m_writer {f}, m_elements {elements}
+		{
+			for(uint32_t i = 0; i < m_elements.size(); ++i)
+				m_elementIndices[m_elements[i].get()] = static_cast<int32_t>(i);
+			m_typeIds.fill(std::numeric_limits<uint8_t>::max());
+			// Reverse lookup of the type id table of the loader
+			for(uint32_t id = 0; id < std::numeric_limits<uint8_t>::max(); ++id) {
+				AttrType type;
+				try {
+					type = get_id_type("binary", BINARY_ENCODING_VERSION, id);
+				}
+				catch(const std::out_of_range &) {
+					break;
+				}
+				if(umath::to_integral(type) < m_typeIds.size())
+					m_typeIds[umath::to_integral(type)] = static_cast<uint8_t>(id);
+			}
+		}
+		void Write(const SaveOptions &options)
+		{
+			// Element types, element names, attribute names and string values that aren't part of an array go into the dictionary
+			for(auto &el : m_elements) {
+				AddString(el->type);
+				AddString(el->name);
+				for(auto &[name, attr] : el->attributes) {
+					AddString(name);
+					if(attr->type == AttrType::String)
+						AddString(attr->data ? std::string_view {*static_cast<const String *>(attr->data.get())} : std::string_view {});
+				}
+			}
+
+			m_writer.Write(create_header("binary", BINARY_ENCODING_VERSION, options));
+			m_writer.Write('\0');
+			m_writer.WriteValue(static_cast<int32_t>(m_strings.size()));
+			for(auto str : m_strings) {
+				m_writer.Write(str);
+				m_writer.Write('\0');
+			}
+
+			m_writer.WriteValue(static_cast<int32_t>(m_elements.size()));
+			for(auto &el : m_elements) {
+				m_writer.WriteValue(GetStringIndex(el->type));
+				m_writer.WriteValue(GetStringIndex(el->name));
+				m_writer.WriteValue(el->GUID);
+			}
+			for(auto &el : m_elements) {
+				m_writer.WriteValue(static_cast<int32_t>(el->attributes.size()));
+				for(auto &[name, attr] : el->attributes)
+					WriteAttribute(name, *attr);
+			}
+			m_writer.Flush();
+		}
+	  private:
+		void AddString(std::string_view str)
+		{
+			if(m_stringIndices.try_emplace(str, static_cast<int32_t>(m_strings.size())).second)
+				m_strings.push_back(str);
+		}
+		int32_t GetStringIndex(std::string_view str) const { return m_stringIndices.find(str)->second; }
+		void WriteAttribute(const std::string &name, const Attribute &attr)
+		{
+			auto typeIdx = umath::to_integral(attr.type);
+			if(typeIdx >= m_typeIds.size() || m_typeIds[typeIdx] == std::numeric_limits<uint8_t>::max())
+				throw std::runtime_error {"Attribute '" + name + "' of type '" + type_to_string(attr.type) + "' can't be stored in binary dmx version " + std::to_string(BINARY_ENCODING_VERSION) + "!"};
+			m_writer.WriteValue(GetStringIndex(name));
+			m_writer.WriteValue(m_typeIds[typeIdx]);
+			if(is_single_type(attr.type)) {
+				WriteValue(attr.type, attr.data.get());
+				return;
+			}
+			auto singleType = get_single_type(attr.type);
+			auto &items = get_array_items(attr);
+			m_writer.WriteValue(static_cast<int32_t>(items.size()));
+			for(auto &item : items)
+				WriteValue(singleType, (item && item->type == singleType) ? item->data.get() : nullptr, true);
+		}
+		void WriteValue(AttrType type, const void *data, bool bFromArray = false)
+		{
+			if(data == nullptr) {
+				// Missing values are written as the default value of the type
+				visit_value_type(type, [this, type, bFromArray]<typename T>(std::type_identity<T>) {
+					T value {};
+					WriteValue(type, &value, bFromArray);
+				});
+				return;
+			}
+			switch(type) {
+			case AttrType::Element:
+				{
+					auto el = static_cast<const ElementRef *>(data)->lock();
+					auto it = el ? m_elementIndices.find(el.get()) : m_elementIndices.end();
+					m_writer.WriteValue((it != m_elementIndices.end()) ? it->second : int32_t {-1});
+					break;
+				}
+			case AttrType::String:
+				{
+					auto &str = *static_cast<const String *>(data);
+					if(bFromArray) {
+						m_writer.Write(str);
+						m_writer.Write('\0');
+					}
+					else
+						m_writer.WriteValue(GetStringIndex(str));
+					break;
+				}
+			case AttrType::Binary:
+				{
+					auto &bin = *static_cast<const Binary *>(data);
+					m_writer.WriteValue(static_cast<int32_t>(bin.size()));
+					m_writer.Write(bin.data(), bin.size());
+					break;
+				}
+			case AttrType::Time:
+				m_writer.WriteValue(static_cast<const Time *>(data)->GetTicks());
+				break;
+			case AttrType::Angle:
+				{
+					auto &ang = *static_cast<const Angle *>(data);
+					m_writer.WriteValue(std::array<float, 3> {ang.p, ang.y, ang.r});
+					break;
+				}
+			case AttrType::Quaternion:
+				{
+					std::array<float, 4> xyzw;
+					encode_quaternions(static_cast<const Quaternion *>(data), xyzw.data(), 1);
+					m_writer.WriteValue(xyzw);
+					break;
+				}
+			case AttrType::Int:
+				m_writer.WriteValue(*static_cast<const Int *>(data));
+				break;
+			case AttrType::Float:
+				m_writer.WriteValue(*static_cast<const Float *>(data));
+				break;
+			case AttrType::Bool:
+				m_writer.WriteValue(static_cast<uint8_t>(*static_cast<const Bool *>(data) ? 1 : 0));
+				break;
+			case AttrType::Color:
+				m_writer.WriteValue(*static_cast<const Color *>(data));
+				break;
+			case AttrType::Vector2:
+				m_writer.WriteValue(*static_cast<const Vector2 *>(data));
+				break;
+			case AttrType::Vector3:
+				m_writer.WriteValue(*static_cast<const Vector3 *>(data));
+				break;
+			case AttrType::Vector4:
+				m_writer.WriteValue(*static_cast<const Vector4 *>(data));
+				break;
+			case AttrType::Matrix:
+				m_writer.WriteValue(*static_cast<const Matrix *>(data));
+				break;
+			default:
+				throw std::logic_error {"Unsupported DMX data type '" + std::to_string(umath::to_integral(type)) + "'"};
+			}
+		}
+
+		FileWriter m_writer;
+		const std::vector<std::shared_ptr<Element>> &m_elements;
+		std::unordered_map<const Element *, int32_t> m_elementIndices;
+		// String views point into the elements, which outlive the writer
+		std::vector<std::string_view> m_strings;
+		std::unordered_map<std::string_view, int32_t> m_stringIndices;
+		std::array<uint8_t, umath::to_integral(AttrType::ArrayLast) + 1> m_typeIds;
+	};
+
+	class KeyValues2Writer {
+	  public:
+		KeyValues2Writer(ufile::IFile &f, const std::vector<std::shared_ptr<Element>> &elements) : m_writer {f}, m_elements {elements}
+		{
+			// Element references are written as ids, so every element needs a unique one. Elements without a GUID or with the
+			// GUID of a previous element get a new one.
+			std::set<util::GUID> usedGUIDs {};
+			for(auto &el : m_elements)
+				usedGUIDs.insert(el->GUID);
+			util::GUID nextGUID {};
+			auto generateGUID = [&usedGUIDs, &nextGUID]() {
+				do {
+					for(auto i = nextGUID.size(); i-- > 0;) {
+						if(++nextGUID[i] != 0)
+							break;
+					}
+				} while(usedGUIDs.contains(nextGUID));
+				usedGUIDs.insert(nextGUID);
+				return nextGUID;
+			};
+			std::set<util::GUID> assignedGUIDs {};
+			m_ids.reserve(m_elements.size());
+			for(auto &el : m_elements) {
+				auto guid = el->GUID;
+				if(guid == util::GUID {} || assignedGUIDs.insert(guid).second == false)
+					guid = generateGUID();
+				m_ids[el.get()] = util::guid_to_string(guid);
+			}
+		}
+		void Write(const SaveOptions &options)
+		{
+			m_writer.Write(create_header("keyvalues2", KEYVALUES2_ENCODING_VERSION, options));
+			for(auto &el : m_elements) {
+				WriteString(el->type);
+				m_writer.Write("\n{");
+				WriteItem("id", AttrType::ObjectId);
+				m_writer.Write(' ');
+				WriteString(m_ids[el.get()]);
+				WriteItem("name", AttrType::String);
+				m_writer.Write(' ');
+				WriteString(el->name);
+				for(auto &[name, attr] : el->attributes) {
+					if(name == "id" || name == "name")
+						continue; // Reserved for the element's own id and name
+					WriteItem(name, attr->type);
+					if(is_single_type(attr->type)) {
+						m_writer.Write(' ');
+						WriteValue(attr->type, attr->data.get());
+						continue;
+					}
+					auto singleType = get_single_type(attr->type);
+					auto &items = get_array_items(*attr);
+					m_writer.Write("\n\t[\n");
+					for(size_t i = 0; i < items.size(); ++i) {
+						m_writer.Write("\t\t");
+						if(singleType == AttrType::Element)
+							m_writer.Write("\"element\" ");
+						auto &item = items[i];
+						WriteValue(singleType, (item && item->type == singleType) ? item->data.get() : nullptr);
+						m_writer.Write((i + 1 < items.size()) ? ",\n" : "\n");
+					}
+					m_writer.Write("\t]");
+				}
+				m_writer.Write("\n}\n\n");
+			}
+			m_writer.Flush();
+		}
+	  private:
+		void WriteItem(std::string_view name, AttrType type)
+		{
+			auto typeIdx = umath::to_integral(type);
+			if(typeIdx >= s_kv2TypeNames.size() || s_kv2TypeNames[typeIdx].empty())
+				throw std::runtime_error {"Attribute '" + std::string {name} + "' of type '" + type_to_string(type) + "' can't be stored in KeyValues2 dmx!"};
+			m_writer.Write("\n\t");
+			WriteString(name);
+			m_writer.Write(' ');
+			WriteString(s_kv2TypeNames[typeIdx]);
+		}
+		void WriteString(std::string_view str)
+		{
+			// Quotes and backslashes are escaped with a backslash, everything else is written verbatim
+			m_writer.Write('"');
+			for(auto pos = str.find_first_of("\"\\"); pos != std::string_view::npos; pos = str.find_first_of("\"\\")) {
+				m_writer.Write(str.substr(0, pos));
+				m_writer.Write('\\');
+				m_writer.Write(str[pos]);
+				str.remove_prefix(pos + 1);
+			}
+			m_writer.Write(str);
+			m_writer.Write('"');
+		}
+		template<typename T>
+		void WriteNumbers(const T *values, size_t count)
+		{
+			// Shortest representation that round-trips
+			std::array<char, 32> buf;
+			m_writer.Write('"');
+			for(size_t i = 0; i < count; ++i) {
+				if(i > 0)
+					m_writer.Write(' ');
+				auto res = std::to_chars(buf.data(), buf.data() + buf.size(), values[i]);
+				m_writer.Write(buf.data(), res.ptr - buf.data());
+			}
+			m_writer.Write('"');
+		}
+		void WriteValue(AttrType type, const void *data)
+		{
+			if(data == nullptr) {
+				visit_value_type(type, [this, type]<typename T>(std::type_identity<T>) {
+					T value {};
+					WriteValue(type, &value);
+				});
+				return;
+			}
+			switch(type) {
+			case AttrType::Element:
+				{
+					auto el = static_cast<const ElementRef *>(data)->lock();
+					auto it = el ? m_ids.find(el.get()) : m_ids.end();
+					WriteString((it != m_ids.end()) ? std::string_view {it->second} : std::string_view {});
+					break;
+				}
+			case AttrType::Int:
+				WriteNumbers(static_cast<const Int *>(data), 1);
+				break;
+			case AttrType::Float:
+				WriteNumbers(static_cast<const Float *>(data), 1);
+				break;
+			case AttrType::Bool:
+				m_writer.Write(*static_cast<const Bool *>(data) ? "\"1\"" : "\"0\"");
+				break;
+			case AttrType::String:
+				WriteString(*static_cast<const String *>(data));
+				break;
+			case AttrType::Binary:
+				{
+					static constexpr char hexDigits[] = "0123456789ABCDEF";
+					auto &bin = *static_cast<const Binary *>(data);
+					m_writer.Write('"');
+					for(auto b : bin) {
+						m_writer.Write(hexDigits[b >> 4]);
+						m_writer.Write(hexDigits[b & 0xF]);
+					}
+					m_writer.Write('"');
+					break;
+				}
+			case AttrType::Time:
+				{
+					// Seconds with up to four decimal places, which represents the ticks exactly
+					auto ticks = static_cast<int64_t>(static_cast<const Time *>(data)->GetTicks());
+					auto str = std::string {(ticks < 0) ? "-" : ""} + std::to_string(std::abs(ticks) / Time::TICKS_PER_SECOND);
+					if(auto fraction = std::abs(ticks) % Time::TICKS_PER_SECOND; fraction != 0) {
+						auto digits = std::to_string(fraction + Time::TICKS_PER_SECOND).substr(1);
+						str += '.' + digits.substr(0, digits.find_last_not_of('0') + 1);
+					}
+					WriteString(str);
+					break;
+				}
+			case AttrType::ObjectId:
+				WriteString(util::guid_to_string(*static_cast<const ObjectId *>(data)));
+				break;
+			case AttrType::Color:
+				{
+					auto &col = *static_cast<const Color *>(data);
+					std::array<uint32_t, 4> values {col[0], col[1], col[2], col[3]};
+					WriteNumbers(values.data(), values.size());
+					break;
+				}
+			case AttrType::Vector2:
+				{
+					auto &v = *static_cast<const Vector2 *>(data);
+					float values[] = {v.x, v.y};
+					WriteNumbers(values, 2);
+					break;
+				}
+			case AttrType::Vector3:
+				{
+					auto &v = *static_cast<const Vector3 *>(data);
+					float values[] = {v.x, v.y, v.z};
+					WriteNumbers(values, 3);
+					break;
+				}
+			case AttrType::Vector4:
+				{
+					auto &v = *static_cast<const Vector4 *>(data);
+					float values[] = {v.x, v.y, v.z, v.w};
+					WriteNumbers(values, 4);
+					break;
+				}
+			case AttrType::Angle:
+				{
+					auto &v = *static_cast<const Angle *>(data);
+					float values[] = {v.p, v.y, v.r};
+					WriteNumbers(values, 3);
+					break;
+				}
+			case AttrType::Quaternion:
+				{
+					std::array<float, 4> xyzw;
+					encode_quaternions(static_cast<const Quaternion *>(data), xyzw.data(), 1);
+					WriteNumbers(xyzw.data(), xyzw.size());
+					break;
+				}
+			case AttrType::Matrix:
+				{
+					auto &m = *static_cast<const Matrix *>(data);
+					std::array<float, 16> values;
+					for(auto i = 0u; i < 4u; ++i) {
+						for(auto j = 0u; j < 4u; ++j)
+							values[i * 4 + j] = m[i][j];
+					}
+					WriteNumbers(values.data(), values.size());
+					break;
+				}
+			case AttrType::UInt64:
+				WriteNumbers(static_cast<const UInt64 *>(data), 1);
+				break;
+			case AttrType::UInt8:
+				{
+					uint32_t value = *static_cast<const UInt8 *>(data);
+					WriteNumbers(&value, 1);
+					break;
+				}
+			default:
+				throw std::logic_error {"Unsupported DMX data type '" + std::to_string(umath::to_integral(type)) + "'"};
+			}
+		}
+
+		FileWriter m_writer;
+		const std::vector<std::shared_ptr<Element>> &m_elements;
+		std::unordered_map<const Element *, std::string> m_ids;
+	};
+};
+
+void source_engine::dmx::FileData::Save(ufile::IFile &f, const SaveOptions &options) const
+{
+	if(options.format.empty() || options.format.find_first_of(" \t\r\n") != std::string::npos || options.format.size() > HeaderInfo::MAX_NAME_LENGTH)
+		throw std::invalid_argument {"Invalid dmx format name '" + options.format + "'!"};
+	// Includes referenced elements that aren't part of the element list
+	ElementTraversal traversal {*this};
+	auto &elements = traversal.GetElements();
+	switch(options.encoding) {
+	case Encoding::Binary:
+		BinaryWriter {f, elements}.Write(options);
+		break;
+	case Encoding::KeyValues2:
+		KeyValues2Writer {f, elements}.Write(options);
+		break;
+	default:
+		throw std::invalid_argument {"Unsupported dmx encoding!"};
+	}
+}
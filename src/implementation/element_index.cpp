@@ -0,0 +1,208 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "dmx_types.hpp"
+#include "temp_path.hpp"
+#include <sharedutils/util_ifile.hpp>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+module source_engine.dmx;
+
+namespace source_engine::dmx {
+	static constexpr std::array<char, 4> ELEMENT_INDEX_MAGIC = {'D', 'M', 'X', 'I'};
+	static constexpr uint32_t ELEMENT_INDEX_VERSION = 1;
+
+	struct ElementIndexHeader {
+		std::array<char, 4> magic;
+		uint32_t version;
+		uint64_t sourceSize;
+		uint64_t sourceFileSize;
+		int64_t sourceModificationTime;
+		uint32_t encodingVersion;
+		uint32_t encoding; // String index
+		uint32_t numStrings;
+		uint32_t numEntries;
+		uint32_t numDictionaryStrings;
+		uint32_t reserved;
+		uint64_t entriesOffset;
+		uint64_t sortedEntriesOffset;
+		uint64_t dictionaryStringOffsetsOffset;
+		uint64_t stringOffsetsOffset; // numStrings +1 offsets into the string data
+		uint64_t stringDataOffset;
+	};
+	static_assert(sizeof(ElementIndexHeader) == 96 && sizeof(ElementIndex::Entry) == 40);
+
+	static int64_t get_modification_time(const std::filesystem::path &path, std::error_code &ec)
+	{
+		auto t = std::filesystem::last_write_time(path, ec);
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+	}
+};
+
+std::vector<uint8_t> source_engine::dmx::ElementIndex::Serialize() const
+{
+	auto strings = m_strings;
+	auto encodingIdx = static_cast<uint32_t>(strings.size());
+	strings.push_back(m_encoding);
+
+	ElementIndexHeader header {};
+	header.magic = ELEMENT_INDEX_MAGIC;
+	header.version = ELEMENT_INDEX_VERSION;
+	header.sourceSize = m_sourceSize;
+	header.sourceFileSize = m_sourceFileSize;
+	header.sourceModificationTime = m_sourceModificationTime;
+	header.encodingVersion = m_encodingVersion;
+	header.encoding = encodingIdx;
+	header.numStrings = static_cast<uint32_t>(strings.size());
+	header.numEntries = static_cast<uint32_t>(m_entries.size());
+	header.numDictionaryStrings = static_cast<uint32_t>(m_dictionaryStringOffsets.size());
+
+	size_t stringDataSize = 0;
+	for(auto &str : strings)
+		stringDataSize += str.size();
+	auto align = [](uint64_t offset) { return (offset + 7) & ~static_cast<uint64_t>(7); };
+	header.entriesOffset = sizeof(ElementIndexHeader);
+	header.sortedEntriesOffset = header.entriesOffset + m_entries.size() * sizeof(Entry);
+	header.dictionaryStringOffsetsOffset = align(header.sortedEntriesOffset + m_sortedEntries.size() * sizeof(uint32_t));
+	header.stringOffsetsOffset = header.dictionaryStringOffsetsOffset + m_dictionaryStringOffsets.size() * sizeof(uint64_t);
+	header.stringDataOffset = header.stringOffsetsOffset + (strings.size() + 1) * sizeof(uint64_t);
+
+	std::vector<uint8_t> data {};
+	data.resize(header.stringDataOffset + stringDataSize);
+	memcpy(data.data(), &header, sizeof(header));
+	if(m_entries.empty() == false) {
+		memcpy(data.data() + header.entriesOffset, m_entries.data(), m_entries.size() * sizeof(Entry));
+		memcpy(data.data() + header.sortedEntriesOffset, m_sortedEntries.data(), m_sortedEntries.size() * sizeof(uint32_t));
+	}
+	if(m_dictionaryStringOffsets.empty() == false)
+		memcpy(data.data() + header.dictionaryStringOffsetsOffset, m_dictionaryStringOffsets.data(), m_dictionaryStringOffsets.size() * sizeof(uint64_t));
+	uint64_t offset = 0;
+	auto *offsets = data.data() + header.stringOffsetsOffset;
+	for(size_t i = 0; i < strings.size(); ++i) {
+		memcpy(offsets + i * sizeof(uint64_t), &offset, sizeof(offset));
+		memcpy(data.data() + header.stringDataOffset + offset, strings[i].data(), strings[i].size());
+		offset += strings[i].size();
+	}
+	memcpy(offsets + strings.size() * sizeof(uint64_t), &offset, sizeof(offset));
+	return data;
+}
+
+std::optional<source_engine::dmx::ElementIndex> source_engine::dmx::ElementIndex::Deserialize(const void *data, size_t size)
+{
+	auto *bytes = static_cast<const uint8_t *>(data);
+	ElementIndexHeader header;
+	if(size < sizeof(header))
+		return {};
+	memcpy(&header, bytes, sizeof(header));
+	if(header.magic != ELEMENT_INDEX_MAGIC || header.version != ELEMENT_INDEX_VERSION)
+		return {};
+	auto isInRange = [size](uint64_t offset, uint64_t count, uint64_t itemSize) { return count <= size / itemSize && offset <= size - count * itemSize; };
+	if(!isInRange(header.entriesOffset, header.numEntries, sizeof(Entry)) || !isInRange(header.sortedEntriesOffset, header.numEntries, sizeof(uint32_t))
+	  || !isInRange(header.dictionaryStringOffsetsOffset, header.numDictionaryStrings, sizeof(uint64_t)) || !isInRange(header.stringOffsetsOffset, static_cast<uint64_t>(header.numStrings) + 1, sizeof(uint64_t)) || header.stringDataOffset > size || header.numStrings == 0 || header.encoding != header.numStrings - 1)
+		return {};
+
+	ElementIndex index {};
+	index.m_sourceSize = header.sourceSize;
+	index.m_sourceFileSize = header.sourceFileSize;
+	index.m_sourceModificationTime = header.sourceModificationTime;
+	index.m_encodingVersion = header.encodingVersion;
+
+	auto stringDataSize = size - header.stringDataOffset;
+	index.m_strings.reserve(header.numStrings);
+	for(uint32_t i = 0; i < header.numStrings; ++i) {
+		uint64_t offsets[2];
+		memcpy(offsets, bytes + header.stringOffsetsOffset + i * sizeof(uint64_t), sizeof(offsets));
+		if(offsets[0] > offsets[1] || offsets[1] > stringDataSize)
+			return {};
+		index.m_strings.emplace_back(reinterpret_cast<const char *>(bytes + header.stringDataOffset + offsets[0]), offsets[1] - offsets[0]);
+	}
+	index.m_encoding = std::move(index.m_strings[header.encoding]);
+	index.m_strings.pop_back();
+
+	index.m_entries.resize(header.numEntries);
+	index.m_sortedEntries.resize(header.numEntries);
+	if(header.numEntries > 0) {
+		memcpy(index.m_entries.data(), bytes + header.entriesOffset, header.numEntries * sizeof(Entry));
+		memcpy(index.m_sortedEntries.data(), bytes + header.sortedEntriesOffset, header.numEntries * sizeof(uint32_t));
+	}
+	index.m_dictionaryStringOffsets.resize(header.numDictionaryStrings);
+	if(header.numDictionaryStrings > 0)
+		memcpy(index.m_dictionaryStringOffsets.data(), bytes + header.dictionaryStringOffsetsOffset, header.numDictionaryStrings * sizeof(uint64_t));
+	for(auto offset : index.m_dictionaryStringOffsets) {
+		if(offset >= index.m_sourceSize)
+			return {};
+	}
+	auto numStrings = static_cast<uint32_t>(index.m_strings.size());
+	for(auto &entry : index.m_entries) {
+		if(entry.type >= numStrings || entry.name >= numStrings || entry.headerOffset >= index.m_sourceSize || entry.bodyOffset >= index.m_sourceSize)
+			return {};
+	}
+	for(auto idx : index.m_sortedEntries) {
+		if(idx >= header.numEntries)
+			return {};
+	}
+	return index;
+}
+
+std::string source_engine::dmx::ElementIndex::GetSidecarPath(const std::string &dmxPath) { return dmxPath + ".dmxi"; }
+
+source_engine::dmx::ElementIndex source_engine::dmx::ElementIndex::LoadOrBuild(const std::string &dmxPath, const std::shared_ptr<ufile::IFile> &f)
+{
+	std::error_code ec;
+	auto fileSize = std::filesystem::file_size(dmxPath, ec);
+	int64_t modificationTime = 0;
+	if(!ec)
+		modificationTime = get_modification_time(dmxPath, ec);
+	if(ec)
+		return Build(f); // Not a file on disk, so there's nothing to compare the sidecar against
+
+	std::filesystem::path sidecarPath {GetSidecarPath(dmxPath)};
+	{
+		std::ifstream in {sidecarPath, std::ios::binary};
+		if(in) {
+			std::vector<uint8_t> data {std::istreambuf_iterator<char> {in}, std::istreambuf_iterator<char> {}};
+			auto index = Deserialize(data.data(), data.size());
+			if(index && index->m_sourceFileSize == fileSize && index->m_sourceModificationTime == modificationTime)
+				return std::move(*index);
+		}
+	}
+
+	auto index = Build(f);
+	index.m_sourceFileSize = fileSize;
+	index.m_sourceModificationTime = modificationTime;
+	auto data = index.Serialize();
+	write_file_atomically(sidecarPath, data.data(), data.size()); // The index is still valid if the sidecar can't be written
+	return index;
+}
+
+void source_engine::dmx::ElementIndex::UpdateLookupTable()
+{
+	m_sortedEntries.resize(m_entries.size());
+	for(uint32_t i = 0; i < m_entries.size(); ++i)
+		m_sortedEntries[i] = i;
+	// Stable, so that the first of multiple elements with the same GUID is found
+	std::stable_sort(m_sortedEntries.begin(), m_sortedEntries.end(), [this](uint32_t a, uint32_t b) { return m_entries[a].GUID < m_entries[b].GUID; });
+}
+
+std::optional<uint32_t> source_engine::dmx::ElementIndex::FindEntry(const util::GUID &guid) const
+{
+	auto it = std::lower_bound(m_sortedEntries.begin(), m_sortedEntries.end(), guid, [this](uint32_t idx, const util::GUID &guid) { return m_entries[idx].GUID < guid; });
+	if(it == m_sortedEntries.end() || m_entries[*it].GUID != guid)
+		return {};
+	return *it;
+}
+
+const std::vector<source_engine::dmx::ElementIndex::Entry> &source_engine::dmx::ElementIndex::GetEntries() const { return m_entries; }
+const std::string &source_engine::dmx::ElementIndex::GetString(uint32_t idx) const { return m_strings.at(idx); }
+const std::string &source_engine::dmx::ElementIndex::GetEncoding() const { return m_encoding; }
+uint32_t source_engine::dmx::ElementIndex::GetEncodingVersion() const { return m_encodingVersion; }
+const std::vector<uint64_t> &source_engine::dmx::ElementIndex::GetDictionaryStringOffsets() const { return m_dictionaryStringOffsets; }
+uint64_t source_engine::dmx::ElementIndex::GetSourceSize() const { return m_sourceSize; }
+int64_t source_engine::dmx::ElementIndex::GetSourceModificationTime() const { return m_sourceModificationTime; }
@@ -0,0 +1,206 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "dmx_types.hpp"
+#include "thread_pool.hpp"
+#include <atomic>
+#include <span>
+#include <stdexcept>
+
+module source_engine.dmx;
+
+namespace source_engine::dmx {
+	// Levels smaller than this are not worth distributing across threads
+	constexpr size_t MIN_ELEMENTS_PER_TASK = 64;
+
+	static Element *get_referenced_element(const Attribute &attr)
+	{
+		if(attr.data == nullptr)
+			return nullptr;
+		auto &elRef = *static_cast<const ElementRef *>(attr.data.get());
+		return elRef.lock().get();
+	}
+	template<typename TFunc>
+	static void iterate_child_elements(const Element &el, const TFunc &func)
+	{
+		for(auto &pair : el.attributes) {
+			auto &attr = *pair.second;
+			if(attr.data == nullptr)
+				continue;
+			switch(attr.type) {
+			case AttrType::Element:
+				if(auto *child = get_referenced_element(attr))
+					func(child);
+				break;
+			case AttrType::ElementArray:
+				{
+					auto &children = *static_cast<const std::vector<std::shared_ptr<Attribute>> *>(attr.data.get());
+					for(auto &childAttr : children) {
+						if(childAttr->data == nullptr)
+							continue; // Child points to non-existing element? This shouldn't happen!
+						if(childAttr->type != AttrType::Element)
+							throw std::logic_error {"Object of non-Element type is member of Element array!"};
+						if(auto *child = get_referenced_element(*childAttr))
+							func(child);
+					}
+					break;
+				}
+			}
+		}
+	}
+};
+
+source_engine::dmx::ElementTraversal::ElementTraversal(const FileData &fileData) : ElementTraversal {fileData.GetElements()} {}
+
+source_engine::dmx::ElementTraversal::ElementTraversal(const std::vector<std::shared_ptr<Element>> &elements) : m_elements {elements}
+{
+	m_indices.reserve(m_elements.size());
+	for(uint32_t i = 0; i < m_elements.size(); ++i)
+		m_indices.insert({m_elements[i].get(), i});
+	// Elements discovered along the way are appended to m_elements and processed by the same loop
+	m_childOffsets.reserve(m_elements.size() + 1);
+	m_childOffsets.push_back(0);
+	for(size_t i = 0; i < m_elements.size(); ++i) {
+		iterate_child_elements(*m_elements[i], [this](Element *child) {
+			auto it = m_indices.find(child);
+			if(it == m_indices.end()) {
+				it = m_indices.insert({child, static_cast<uint32_t>(m_elements.size())}).first;
+				m_elements.push_back(child->shared_from_this());
+			}
+			m_children.push_back(it->second);
+		});
+		m_childOffsets.push_back(static_cast<uint32_t>(m_children.size()));
+	}
+}
+
+const std::vector<std::shared_ptr<source_engine::dmx::Element>> &source_engine::dmx::ElementTraversal::GetElements() const { return m_elements; }
+
+std::optional<uint32_t> source_engine::dmx::ElementTraversal::FindIndex(const Element &el) const
+{
+	auto it = m_indices.find(&el);
+	if(it == m_indices.end())
+		return {};
+	return it->second;
+}
+
+std::span<const uint32_t> source_engine::dmx::ElementTraversal::GetChildren(uint32_t index) const
+{
+	if(index >= m_elements.size())
+		return {};
+	return std::span<const uint32_t> {m_children.data() + m_childOffsets[index], m_childOffsets[index + 1] - m_childOffsets[index]};
+}
+
+bool source_engine::dmx::ElementTraversal::Traverse(uint32_t start, const Visitor &visitor, Order order, std::vector<uint64_t> &visited) const
+{
+	auto tryMarkVisited = [&visited](uint32_t idx) {
+		auto &word = visited[idx / 64];
+		auto bit = uint64_t {1} << (idx % 64);
+		if(word & bit)
+			return false;
+		word |= bit;
+		return true;
+	};
+	if(!tryMarkVisited(start))
+		return true;
+	if(order == Order::PreOrder) {
+		auto result = visitor(*m_elements[start], 0);
+		if(result == Result::Stop)
+			return false;
+		if(result == Result::SkipChildren)
+			return true;
+	}
+	struct Frame {
+		uint32_t index;
+		uint32_t depth;
+		uint32_t nextChild;
+	};
+	std::vector<Frame> stack {};
+	stack.push_back({start, 0, m_childOffsets[start]});
+	while(!stack.empty()) {
+		auto &frame = stack.back();
+		if(frame.nextChild < m_childOffsets[frame.index + 1]) {
+			auto child = m_children[frame.nextChild++];
+			if(!tryMarkVisited(child))
+				continue;
+			auto depth = frame.depth + 1;
+			if(order == Order::PreOrder) {
+				auto result = visitor(*m_elements[child], depth);
+				if(result == Result::Stop)
+					return false;
+				if(result == Result::SkipChildren)
+					continue;
+			}
+			stack.push_back({child, depth, m_childOffsets[child]}); // Invalidates frame
+			continue;
+		}
+		auto index = frame.index;
+		auto depth = frame.depth;
+		stack.pop_back();
+		if(order == Order::PostOrder && visitor(*m_elements[index], depth) == Result::Stop)
+			return false;
+	}
+	return true;
+}
+
+bool source_engine::dmx::ElementTraversal::Traverse(const Element &start, const Visitor &visitor, Order order) const
+{
+	auto index = FindIndex(start);
+	if(!index)
+		return true;
+	std::vector<uint64_t> visited((m_elements.size() + 63) / 64, 0);
+	return Traverse(*index, visitor, order, visited);
+}
+
+bool source_engine::dmx::ElementTraversal::TraverseAll(const Visitor &visitor, Order order) const
+{
+	std::vector<uint64_t> visited((m_elements.size() + 63) / 64, 0);
+	for(uint32_t i = 0; i < m_elements.size(); ++i) {
+		if(!Traverse(i, visitor, order, visited))
+			return false;
+	}
+	return true;
+}
+
+void source_engine::dmx::ElementTraversal::TraverseParallel(const Element &start, const ParallelVisitor &visitor, const Executor &executor) const
+{
+	auto startIndex = FindIndex(start);
+	if(!startIndex)
+		return;
+	auto visited = std::make_unique<std::atomic<uint64_t>[]>((m_elements.size() + 63) / 64);
+	auto tryMarkVisited = [&visited](uint32_t idx) {
+		auto bit = uint64_t {1} << (idx % 64);
+		return (visited[idx / 64].fetch_or(bit, std::memory_order_relaxed) & bit) == 0;
+	};
+	tryMarkVisited(*startIndex);
+
+	auto numThreads = get_thread_count(executor);
+	std::vector<uint32_t> frontier {*startIndex};
+	std::vector<std::vector<uint32_t>> nextFrontiers {};
+	for(uint32_t depth = 0; !frontier.empty(); ++depth) {
+		auto numTasks = std::clamp<size_t>(frontier.size() / MIN_ELEMENTS_PER_TASK, 1, numThreads);
+		nextFrontiers.resize(numTasks);
+		auto processRange = [this, &frontier, &nextFrontiers, &visitor, &tryMarkVisited, numTasks, depth](size_t taskIdx) {
+			auto &next = nextFrontiers[taskIdx];
+			next.clear();
+			auto begin = frontier.size() * taskIdx / numTasks;
+			auto end = frontier.size() * (taskIdx + 1) / numTasks;
+			for(auto i = begin; i < end; ++i) {
+				auto index = frontier[i];
+				visitor(*m_elements[index], depth);
+				for(auto child : GetChildren(index)) {
+					if(tryMarkVisited(child))
+						next.push_back(child);
+				}
+			}
+		};
+		if(numTasks > 1)
+			run_parallel(numTasks, numTasks - 1, processRange, executor);
+		else
+			processRange(0);
+		frontier.clear();
+		for(size_t i = 0; i < numTasks; ++i)
+			frontier.insert(frontier.end(), nextFrontiers[i].begin(), nextFrontiers[i].end());
+	}
+}
@@ -0,0 +1,336 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "dmx_types.hpp"
+#include <sharedutils/util.h>
+#include <charconv>
+#include <cmath>
+#include <string_view>
+
+module source_engine.dmx;
+
+namespace source_engine::dmx {
+	// Length of the well-formed UTF-8 sequence starting at a lead byte >= 0x80, or 0 if it's malformed. Overlong encodings,
+	// surrogates and code points above U+10FFFF are malformed.
+	static size_t get_utf8_sequence_length(std::string_view str, size_t i)
+	{
+		auto at = [&str](size_t idx) -> unsigned char { return (idx < str.size()) ? static_cast<unsigned char>(str[idx]) : 0; };
+		auto isContinuation = [](unsigned char b) { return (b & 0xC0) == 0x80; };
+		auto c = at(i);
+		auto c1 = at(i + 1);
+		if(c >= 0xC2 && c <= 0xDF)
+			return isContinuation(c1) ? 2 : 0;
+		if(c >= 0xE0 && c <= 0xEF) {
+			auto minC1 = (c == 0xE0) ? 0xA0 : 0x80;
+			auto maxC1 = (c == 0xED) ? 0x9F : 0xBF;
+			return (c1 >= minC1 && c1 <= maxC1 && isContinuation(at(i + 2))) ? 3 : 0;
+		}
+		if(c >= 0xF0 && c <= 0xF4) {
+			auto minC1 = (c == 0xF0) ? 0x90 : 0x80;
+			auto maxC1 = (c == 0xF4) ? 0x8F : 0xBF;
+			return (c1 >= minC1 && c1 <= maxC1 && isContinuation(at(i + 2)) && isContinuation(at(i + 3))) ? 4 : 0;
+		}
+		return 0;
+	}
+
+	// Flush has to be called at the end; The destructor doesn't flush, so that an exception from the sink isn't thrown during unwinding
+	class JsonWriter {
+	  public:
+		JsonWriter(const JsonSink &sink, size_t bufferSize) : m_sink {sink}, m_bufferSize {std::max<size_t>(bufferSize, 256)} { m_buffer.reserve(m_bufferSize + 256); }
+		void Flush()
+		{
+			if(m_buffer.empty())
+				return;
+			m_sink(m_buffer);
+			m_buffer.clear();
+		}
+		void Raw(std::string_view str)
+		{
+			m_buffer += str;
+			FlushIfFull();
+		}
+		void Raw(char c)
+		{
+			m_buffer += c;
+			FlushIfFull();
+		}
+		void String(std::string_view str)
+		{
+			static constexpr char hexDigits[] = "0123456789abcdef";
+			m_buffer += '"';
+			// Runs of characters that don't need escaping are appended at once
+			size_t start = 0;
+			for(size_t i = 0; i < str.size(); ++i) {
+				auto c = static_cast<unsigned char>(str[i]);
+				if(c >= 0x80) {
+					// Valid UTF-8 sequences are kept, any other byte is escaped as the code point of the same value (Latin-1)
+					auto len = get_utf8_sequence_length(str, i);
+					if(len > 0) {
+						i += len - 1;
+						continue;
+					}
+				}
+				else if(c >= 0x20 && c != '"' && c != '\\')
+					continue;
+				m_buffer.append(str.data() + start, i - start);
+				start = i + 1;
+				switch(c) {
+				case '"':
+					m_buffer += "\\\"";
+					break;
+				case '\\':
+					m_buffer += "\\\\";
+					break;
+				case '\n':
+					m_buffer += "\\n";
+					break;
+				case '\r':
+					m_buffer += "\\r";
+					break;
+				case '\t':
+					m_buffer += "\\t";
+					break;
+				default:
+					m_buffer += "\\u00";
+					m_buffer += hexDigits[c >> 4];
+					m_buffer += hexDigits[c & 0xF];
+					break;
+				}
+			}
+			m_buffer.append(str.data() + start, str.size() - start);
+			m_buffer += '"';
+			FlushIfFull();
+		}
+		template<typename T>
+		void Number(T value)
+		{
+			if constexpr(std::is_floating_point_v<T>) {
+				if(!std::isfinite(value)) {
+					Raw("null"); // Not representable in JSON
+					return;
+				}
+			}
+			// Shortest representation that round-trips
+			std::array<char, 32> buf;
+			auto res = std::to_chars(buf.data(), buf.data() + buf.size(), value);
+			m_buffer.append(buf.data(), res.ptr);
+			FlushIfFull();
+		}
+		template<typename T>
+		void Numbers(const T *values, size_t count)
+		{
+			Raw('[');
+			for(size_t i = 0; i < count; ++i) {
+				if(i > 0)
+					m_buffer += ',';
+				Number(values[i]);
+			}
+			Raw(']');
+		}
+	  private:
+		void FlushIfFull()
+		{
+			if(m_buffer.size() >= m_bufferSize)
+				Flush();
+		}
+		const JsonSink &m_sink;
+		size_t m_bufferSize;
+		std::string m_buffer;
+	};
+
+	class JsonExporter {
+	  public:
+		JsonExporter(const JsonSink &sink, const JsonExportOptions &options) : m_writer {sink, options.bufferSize}, m_options {options}
+		{
+			for(auto i = umath::to_integral(AttrType::None); i <= umath::to_integral(AttrType::ArrayLast); ++i)
+				m_typeNames[i] = type_to_string(static_cast<AttrType>(i));
+		}
+		void Export(const FileData &fileData)
+		{
+			auto ndJson = (m_options.format == JsonExportOptions::Format::NdJson);
+			if(!ndJson)
+				m_writer.Raw("{\"elements\":[");
+			auto first = true;
+			for(auto &el : fileData.GetElements()) {
+				if(!ndJson && !first)
+					m_writer.Raw(',');
+				first = false;
+				WriteElement(*el);
+				if(ndJson)
+					m_writer.Raw('\n');
+			}
+			if(!ndJson)
+				m_writer.Raw("]}");
+			m_writer.Flush();
+		}
+	  private:
+		void WriteGUID(const util::GUID &guid) { m_writer.String(util::guid_to_string(guid)); }
+		void WriteElement(const Element &el)
+		{
+			m_writer.Raw("{\"id\":");
+			WriteGUID(el.GUID);
+			m_writer.Raw(",\"type\":");
+			m_writer.String(el.type);
+			m_writer.Raw(",\"name\":");
+			m_writer.String(el.name);
+			m_writer.Raw(",\"attributes\":{");
+			auto first = true;
+			for(auto &pair : el.attributes) {
+				if(!first)
+					m_writer.Raw(',');
+				first = false;
+				m_writer.String(pair.first);
+				m_writer.Raw(':');
+				WriteAttribute(*pair.second);
+			}
+			m_writer.Raw("}}");
+		}
+		void WriteAttribute(const Attribute &attr)
+		{
+			m_writer.Raw("{\"type\":");
+			auto typeIdx = umath::to_integral(attr.type);
+			m_writer.String((typeIdx < m_typeNames.size()) ? std::string_view {m_typeNames[typeIdx]} : std::string_view {"Invalid"});
+			m_writer.Raw(",\"value\":");
+			if(attr.data == nullptr)
+				m_writer.Raw("null");
+			else if(is_array_type(attr.type)) {
+				auto &items = *static_cast<const std::vector<std::shared_ptr<Attribute>> *>(attr.data.get());
+				auto count = m_options.maxArrayItems ? std::min(items.size(), *m_options.maxArrayItems) : items.size();
+				m_writer.Raw('[');
+				for(size_t i = 0; i < count; ++i) {
+					if(i > 0)
+						m_writer.Raw(',');
+					auto &item = *items[i];
+					if(item.data == nullptr)
+						m_writer.Raw("null");
+					else
+						WriteValue(item.type, item.data.get());
+				}
+				m_writer.Raw(']');
+				if(count < items.size()) {
+					m_writer.Raw(",\"size\":");
+					m_writer.Number(items.size());
+				}
+			}
+			else if(is_single_type(attr.type))
+				WriteValue(attr.type, attr.data.get());
+			else
+				m_writer.Raw("null");
+			m_writer.Raw('}');
+		}
+		void WriteValue(AttrType type, const void *data)
+		{
+			switch(type) {
+			case AttrType::Element:
+				{
+					auto el = static_cast<const ElementRef *>(data)->lock();
+					if(el)
+						WriteGUID(el->GUID);
+					else
+						m_writer.Raw("null");
+					break;
+				}
+			case AttrType::Int:
+				m_writer.Number(*static_cast<const Int *>(data));
+				break;
+			case AttrType::Float:
+				m_writer.Number(*static_cast<const Float *>(data));
+				break;
+			case AttrType::Bool:
+				m_writer.Raw(*static_cast<const Bool *>(data) ? "true" : "false");
+				break;
+			case AttrType::String:
+				m_writer.String(*static_cast<const String *>(data));
+				break;
+			case AttrType::Binary:
+				{
+					static constexpr char hexDigits[] = "0123456789abcdef";
+					auto &bin = *static_cast<const Binary *>(data);
+					m_writer.Raw('"');
+					for(auto b : bin) {
+						m_writer.Raw(hexDigits[b >> 4]);
+						m_writer.Raw(hexDigits[b & 0xF]);
+					}
+					m_writer.Raw('"');
+					break;
+				}
+			case AttrType::Time:
+				m_writer.Number(static_cast<const Time *>(data)->GetSecondsDouble());
+				break;
+			case AttrType::ObjectId:
+				WriteGUID(*static_cast<const ObjectId *>(data));
+				break;
+			case AttrType::Color:
+				m_writer.Numbers(static_cast<const Color *>(data)->data(), 4);
+				break;
+			case AttrType::Vector2:
+				{
+					auto &v = *static_cast<const Vector2 *>(data);
+					float values[] = {v.x, v.y};
+					m_writer.Numbers(values, 2);
+					break;
+				}
+			case AttrType::Vector3:
+				{
+					auto &v = *static_cast<const Vector3 *>(data);
+					float values[] = {v.x, v.y, v.z};
+					m_writer.Numbers(values, 3);
+					break;
+				}
+			case AttrType::Vector4:
+				{
+					auto &v = *static_cast<const Vector4 *>(data);
+					float values[] = {v.x, v.y, v.z, v.w};
+					m_writer.Numbers(values, 4);
+					break;
+				}
+			case AttrType::Angle:
+				{
+					auto &v = *static_cast<const Angle *>(data);
+					float values[] = {v.p, v.y, v.r};
+					m_writer.Numbers(values, 3);
+					break;
+				}
+			case AttrType::Quaternion:
+				{
+					// Same component order as in dmx files
+					std::array<float, 4> values;
+					encode_quaternions(static_cast<const Quaternion *>(data), values.data(), 1);
+					m_writer.Numbers(values.data(), values.size());
+					break;
+				}
+			case AttrType::Matrix:
+				{
+					auto &m = *static_cast<const Matrix *>(data);
+					float values[16];
+					for(auto i = 0; i < 4; ++i) {
+						for(auto j = 0; j < 4; ++j)
+							values[i * 4 + j] = m[i][j];
+					}
+					m_writer.Numbers(values, 16);
+					break;
+				}
+			case AttrType::UInt64:
+				m_writer.Number(*static_cast<const UInt64 *>(data));
+				break;
+			case AttrType::UInt8:
+				m_writer.Number(*static_cast<const UInt8 *>(data));
+				break;
+			default:
+				m_writer.Raw("null");
+				break;
+			}
+		}
+		JsonWriter m_writer;
+		const JsonExportOptions &m_options;
+		std::array<std::string, umath::to_integral(AttrType::ArrayLast) + 1> m_typeNames;
+	};
+};
+
+void source_engine::dmx::export_json(const FileData &fileData, const JsonSink &sink, const JsonExportOptions &options)
+{
+	JsonExporter exporter {sink, options};
+	exporter.Export(fileData);
+}
@@ -16,6 +16,7 @@ void KeyValues2::BaseElement::ToString(std::stringstream &outStream) { ToString(
 KeyValues2::BaseElement::Type KeyValues2::BaseElement::GetType() const { return Type::Invalid; }
 
 KeyValues2::StringValue::StringValue(const std::string &value) : value {value} {}
+KeyValues2::StringValue::StringValue(std::string &&value) : value {std::move(value)} {}
 void KeyValues2::StringValue::ToString(std::stringstream &outStream, const std::string &t) { outStream << t << value << "\n"; }
 KeyValues2::BaseElement::Type KeyValues2::StringValue::GetType() const { return Type::String; }
 
@@ -50,12 +51,16 @@ void KeyValues2::Array::ToString(std::stringstream &outStream, const std::string
 }
 KeyValues2::BaseElement::Type KeyValues2::Array::GetType() const { return Type::Array; }
 
-KeyValues2::Result KeyValues2::Load(const std::shared_ptr<ufile::IFile> &f, std::shared_ptr<Array> &outArray)
+KeyValues2::Result KeyValues2::Load(const std::shared_ptr<ufile::IFile> &f, std::shared_ptr<Array> &outArray, const std::function<bool()> &topLevelItemCallback, std::string *stringBuffer, const Filter *filter)
 {
-	KeyValues2 dmxKv2 {f};
+	std::string localStringBuffer {};
+	KeyValues2 dmxKv2 {f, topLevelItemCallback, stringBuffer ? *stringBuffer : localStringBuffer, filter};
 	return dmxKv2.Read(outArray);
 }
-KeyValues2::KeyValues2(const std::shared_ptr<ufile::IFile> &f) : m_file {f} {}
+KeyValues2::KeyValues2(const std::shared_ptr<ufile::IFile> &f, const std::function<bool()> &topLevelItemCallback, std::string &stringBuffer, const Filter *filter)
+    : m_file {f}, m_topLevelItemCallback {topLevelItemCallback}, m_stringBuffer {stringBuffer}, m_filter {filter}
+{
+}
 KeyValues2::Result KeyValues2::Read(std::shared_ptr<Array> &outArray)
 {
 	/*constexpr auto *identifier = "<!-- dmx encoding keyvalues2 1 format tex 1 -->";
@@ -90,25 +95,43 @@ std::optional<char> KeyValues2::ReadToken(bool includeWhitespace)
 	}
 	return c;
 }
-std::optional<std::string> KeyValues2::ReadString()
+bool KeyValues2::ReadStringToBuffer()
 {
-	std::string str = "";
+	auto &str = m_stringBuffer;
+	str.clear();
 	auto token = ReadToken();
 	if(token.has_value() == false)
-		return {};
+		return false;
 	auto inQuotes = token == '\"';
 	if(inQuotes)
 		token = ReadToken(true);
 	for(;;) {
 		if(token.has_value() == false)
-			return {};
+			return false;
 		if(inQuotes == false && IsWhitespace(*token))
-			return str; // Reached end of string
+			return true; // Reached end of string
 		switch(*token) {
 		case '"':
 			{
 				if(inQuotes)
-					return str;
+					return true;
+				str += *token;
+				break;
+			}
+		case '\\':
+			{
+				// Escaped quotes and backslashes; Any other backslash is kept as-is, e.g. in unescaped Windows paths
+				if(inQuotes) {
+					auto next = ReadToken(true);
+					if(next.has_value() == false)
+						return false;
+					if(*next != '"' && *next != '\\')
+						str += *token;
+					str += *next;
+					break;
+				}
+				str += *token;
+				break;
 			}
 		default:
 			str += *token;
@@ -117,7 +140,7 @@ std::optional<std::string> KeyValues2::ReadString()
 		token = ReadToken(true);
 	}
 	// unreachable
-	return {};
+	return false;
 }
 bool KeyValues2::ReadUntil(char c)
 {
@@ -137,22 +160,26 @@ bool KeyValues2::ReadUntilAfter(char c)
 	return m_file->Eof() == false;
 }
 
-KeyValues2::Result KeyValues2::ReadArrayItem(Array &a)
+KeyValues2::Result KeyValues2::ReadArrayItem(Array &a, bool skipStrings)
 {
-	auto type = ReadString();
+	if(ReadStringToBuffer() == false)
+		return Result::SyntaxError;
 	auto token = ReadToken();
-	if(type.has_value() == false || token.has_value() == false)
+	if(token.has_value() == false)
 		return Result::SyntaxError;
-	auto item = std::make_shared<ArrayItem>();
 	if(token == ',' || token == ']') {
 		// Item has no type
-		item->value = std::make_shared<StringValue>(*type);
-		a.items.push_back(item);
+		if(skipStrings == false) {
+			auto item = std::make_shared<ArrayItem>();
+			item->value = std::make_shared<StringValue>(m_stringBuffer);
+			a.items.push_back(item);
+		}
 		if(token == ']')
 			m_file->Seek(m_file->Tell() - 1);
 		return Result::Success;
 	}
-	item->type = *type;
+	auto item = std::make_shared<ArrayItem>();
+	item->type = m_stringBuffer;
 	if(IsControlCharacter(*token)) {
 		// Value is either an element or an array
 		switch(*token) {
@@ -160,7 +187,7 @@ KeyValues2::Result KeyValues2::ReadArrayItem(Array &a)
 			{
 				auto eChild = std::make_shared<Element>();
 				item->value = eChild;
-				auto result = ReadElementBody(*eChild);
+				auto result = ReadElementBody(*eChild, IsElementTypeIncluded(*item->type));
 				if(result != Result::Success)
 					return result;
 				a.items.push_back(item);
@@ -170,7 +197,7 @@ KeyValues2::Result KeyValues2::ReadArrayItem(Array &a)
 			{
 				auto aChild = std::make_shared<Array>();
 				item->value = aChild;
-				auto result = ReadArrayBody(*aChild);
+				auto result = ReadArrayBody(*aChild, false, skipStrings);
 				if(result != Result::Success)
 					return result;
 				a.items.push_back(item);
@@ -181,15 +208,16 @@ KeyValues2::Result KeyValues2::ReadArrayItem(Array &a)
 	}
 	// Value is a string
 	m_file->Seek(m_file->Tell() - 1);
-	auto value = ReadString();
-	if(value.has_value() == false)
+	if(ReadStringToBuffer() == false)
 		return Result::SyntaxError;
-	item->value = std::make_shared<StringValue>(*value);
-	a.items.push_back(item);
+	if(skipStrings == false) {
+		item->value = std::make_shared<StringValue>(m_stringBuffer);
+		a.items.push_back(item);
+	}
 	return Result::Success;
 }
 
-KeyValues2::Result KeyValues2::ReadArrayBody(Array &a, bool root)
+KeyValues2::Result KeyValues2::ReadArrayBody(Array &a, bool root, bool skipStrings)
 {
 	// Each item in the array has the following structure:
 	// [type] <value>
@@ -198,9 +226,11 @@ KeyValues2::Result KeyValues2::ReadArrayBody(Array &a, bool root)
 	auto token = ReadToken();
 	while(token.has_value() && *token != ']') {
 		m_file->Seek(m_file->Tell() - 1);
-		auto result = ReadArrayItem(a);
+		auto result = ReadArrayItem(a, skipStrings);
 		if(result != Result::Success)
 			return result;
+		if(root && m_topLevelItemCallback && m_topLevelItemCallback() == false)
+			return Result::Cancelled;
 		token = ReadToken();
 		while(token.has_value() && *token == ',')
 			token = ReadToken();
@@ -210,36 +240,44 @@ KeyValues2::Result KeyValues2::ReadArrayBody(Array &a, bool root)
 	return Result::Success;
 }
 
-KeyValues2::Result KeyValues2::ReadElementItem(Element &e)
+KeyValues2::Result KeyValues2::ReadElementItem(Element &e, bool included)
 {
-	auto name = ReadString();
-	auto type = ReadString();
+	// The name and type are read into the scratch buffers and only copied once it's known that the item is kept
+	if(ReadStringToBuffer() == false)
+		return Result::SyntaxError;
+	std::swap(m_nameBuffer, m_stringBuffer);
+	if(ReadStringToBuffer() == false) // Type
+		return Result::SyntaxError;
 	auto token = ReadToken();
-	if(name.has_value() == false || type.has_value() == false || token.has_value() == false)
+	if(token.has_value() == false)
 		return Result::SyntaxError;
-	auto item = std::make_shared<ElementItem>();
-	item->type = *type;
+	// The id and name of an element are always kept, so that references to filtered elements can be resolved
+	auto keepValue = (included && IsAttributeIncluded(m_nameBuffer)) || m_nameBuffer == "id" || m_nameBuffer == "name";
 	if(IsControlCharacter(*token)) {
-		// Value is either an element or an array
+		// Value is either an element or an array; Nested items reuse the scratch buffers
+		auto name = m_nameBuffer;
+		auto item = std::make_shared<ElementItem>();
+		item->type = m_stringBuffer;
 		switch(*token) {
 		case '{':
 			{
 				auto eChild = std::make_shared<Element>();
 				item->value = eChild;
-				auto result = ReadElementBody(*eChild);
+				auto result = ReadElementBody(*eChild, IsElementTypeIncluded(item->type));
 				if(result != Result::Success)
 					return result;
-				e.children[*name] = item;
+				e.children[std::move(name)] = item;
 				return result;
 			}
 		case '[':
 			{
 				auto aChild = std::make_shared<Array>();
 				item->value = aChild;
-				auto result = ReadArrayBody(*aChild);
+				auto result = ReadArrayBody(*aChild, false, !keepValue);
 				if(result != Result::Success)
 					return result;
-				e.children[*name] = item;
+				if(keepValue || aChild->items.empty() == false)
+					e.children[std::move(name)] = item;
 				return result;
 			}
 		}
@@ -247,15 +285,21 @@ KeyValues2::Result KeyValues2::ReadElementItem(Element &e)
 	}
 	// Value is a string
 	m_file->Seek(m_file->Tell() - 1);
-	auto value = ReadString();
-	if(value.has_value() == false)
+	std::shared_ptr<ElementItem> item = nullptr;
+	if(keepValue) {
+		item = std::make_shared<ElementItem>();
+		item->type = m_stringBuffer;
+	}
+	if(ReadStringToBuffer() == false)
 		return Result::SyntaxError;
-	item->value = std::make_shared<StringValue>(*value);
-	e.children[*name] = item;
+	if(item) {
+		item->value = std::make_shared<StringValue>(m_stringBuffer);
+		e.children[m_nameBuffer] = item;
+	}
 	return Result::Success;
 }
 
-KeyValues2::Result KeyValues2::ReadElementBody(Element &e)
+KeyValues2::Result KeyValues2::ReadElementBody(Element &e, bool included)
 {
 	// Each item in the element has the following structure:
 	// <name> <type> <value>
@@ -263,7 +307,7 @@ KeyValues2::Result KeyValues2::ReadElementBody(Element &e)
 	auto token = ReadToken();
 	while(token.has_value() && *token != '}') {
 		m_file->Seek(m_file->Tell() - 1);
-		auto result = ReadElementItem(e);
+		auto result = ReadElementItem(e, included);
 		if(result != Result::Success)
 			return result;
 		token = ReadToken();
@@ -272,3 +316,6 @@ KeyValues2::Result KeyValues2::ReadElementBody(Element &e)
 		return Result::SyntaxError;
 	return Result::Success;
 }
+
+bool KeyValues2::IsElementTypeIncluded(const std::string &type) const { return !m_filter || !m_filter->isElementTypeIncluded || m_filter->isElementTypeIncluded(type); }
+bool KeyValues2::IsAttributeIncluded(const std::string &name) const { return !m_filter || !m_filter->isAttributeIncluded || m_filter->isAttributeIncluded(name); }
@@ -8,43 +8,241 @@ module;
 #include <sharedutils/util.h>
 #include <sharedutils/util_string.h>
 #include <cstring>
+#include <charconv>
+#include <limits>
+#include <string_view>
+#include <utility>
 
 module source_engine.dmx;
 
 import :keyvalues2;
 
+namespace source_engine::dmx {
+	struct Kv2TypeInfo {
+		std::string_view name;
+		AttrType type;
+	};
+	static constexpr std::array<Kv2TypeInfo, 32> s_kv2Types = {{{"element", AttrType::Element}, {"int", AttrType::Int}, {"float", AttrType::Float}, {"bool", AttrType::Bool}, {"string", AttrType::String}, {"binary", AttrType::Binary}, {"time", AttrType::Time},
+	  {"elementid", AttrType::ObjectId}, {"color", AttrType::Color}, {"vector2", AttrType::Vector2}, {"vector3", AttrType::Vector3}, {"vector4", AttrType::Vector4}, {"qangle", AttrType::Angle}, {"quaternion", AttrType::Quaternion}, {"matrix", AttrType::Matrix},
+	  {"uint64", AttrType::UInt64}, {"uint8", AttrType::UInt8}, {"element_array", AttrType::ElementArray}, {"int_array", AttrType::IntArray}, {"float_array", AttrType::FloatArray}, {"bool_array", AttrType::BoolArray}, {"string_array", AttrType::StringArray},
+	  {"binary_array", AttrType::BinaryArray}, {"time_array", AttrType::TimeArray}, {"elementid_array", AttrType::ObjectIdArray}, {"color_array", AttrType::ColorArray}, {"vector2_array", AttrType::Vector2Array}, {"vector3_array", AttrType::Vector3Array},
+	  {"vector4_array", AttrType::Vector4Array}, {"qangle_array", AttrType::AngleArray}, {"quaternion_array", AttrType::QuaternionArray}, {"matrix_array", AttrType::MatrixArray}}};
+
+	// FNV-1a; The table size has been chosen so that all type names above map to unique slots
+	static constexpr uint32_t kv2_type_hash(std::string_view name)
+	{
+		uint32_t hash = 2'166'136'261u;
+		for(auto c : name) {
+			hash ^= static_cast<uint8_t>(c);
+			hash *= 16'777'619u;
+		}
+		return hash;
+	}
+	static constexpr uint32_t KV2_TYPE_SLOT_COUNT = 128;
+	static constexpr uint8_t KV2_TYPE_SLOT_EMPTY = std::numeric_limits<uint8_t>::max();
+	static constexpr auto s_kv2TypeSlots = []() {
+		std::array<uint8_t, KV2_TYPE_SLOT_COUNT> slots {};
+		for(auto &slot : slots)
+			slot = KV2_TYPE_SLOT_EMPTY;
+		for(size_t i = 0; i < s_kv2Types.size(); ++i)
+			slots[kv2_type_hash(s_kv2Types[i].name) % KV2_TYPE_SLOT_COUNT] = static_cast<uint8_t>(i);
+		return slots;
+	}();
+	static constexpr bool is_kv2_type_hash_perfect()
+	{
+		for(size_t i = 0; i < s_kv2Types.size(); ++i) {
+			if(s_kv2TypeSlots[kv2_type_hash(s_kv2Types[i].name) % KV2_TYPE_SLOT_COUNT] != i)
+				return false;
+		}
+		return true;
+	}
+	static constexpr bool is_kv2_type_covered(AttrType type)
+	{
+		for(auto &info : s_kv2Types) {
+			if(info.type == type)
+				return true;
+		}
+		return false;
+	}
+	static constexpr bool are_all_kv2_types_covered()
+	{
+		for(auto i = static_cast<uint32_t>(AttrType::SingleFirst); i <= static_cast<uint32_t>(AttrType::ArrayLast); ++i) {
+			if(is_kv2_type_covered(static_cast<AttrType>(i)) == false)
+				return false;
+		}
+		return true;
+	}
+	static_assert(is_kv2_type_hash_perfect(), "KeyValues2 type names collide, KV2_TYPE_SLOT_COUNT has to be adjusted!");
+	static_assert(are_all_kv2_types_covered(), "Not all DMX types have a KeyValues2 type name!");
+
+	static AttrType kv2_type_to_attr_type(std::string_view name)
+	{
+		auto idx = s_kv2TypeSlots[kv2_type_hash(name) % KV2_TYPE_SLOT_COUNT];
+		if(idx == KV2_TYPE_SLOT_EMPTY || s_kv2Types[idx].name != name)
+			return AttrType::Invalid;
+		return s_kv2Types[idx].type;
+	}
+
+	template<typename T, size_t N>
+	static std::array<T, N> kv2_parse_values(std::string_view str)
+	{
+		std::array<T, N> values {};
+		auto *p = str.data();
+		auto *end = p + str.size();
+		for(auto &v : values) {
+			while(p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+				++p;
+			if(p < end && *p == '+')
+				++p;
+			auto res = std::from_chars(p, end, v);
+			p = res.ptr;
+			while(p < end && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r')
+				++p;
+		}
+		return values;
+	}
+
+	// Components of the whole array are collected first so that they can be reordered in bulk by decode_quaternions
+	static void kv2_parse_quaternion_components(const KeyValues2::Array &kvArray, std::vector<float> &outComponents)
+	{
+		outComponents.clear();
+		outComponents.reserve(kvArray.items.size() * 4);
+		for(auto &arrayItem : kvArray.items) {
+			if(arrayItem->value->GetType() != KeyValues2::BaseElement::Type::String)
+				throw std::invalid_argument {"Unexpected array item type " + std::to_string(umath::to_integral(arrayItem->GetType()))};
+			auto xyzw = kv2_parse_values<float, 4>(static_cast<const KeyValues2::StringValue &>(*arrayItem->value).value);
+			outComponents.insert(outComponents.end(), xyzw.begin(), xyzw.end());
+		}
+	}
+
+	// Decodes a value of any type except for element references
+	template<typename T>
+	static void kv2_decode_value(const std::string &value, T &out)
+	{
+		if constexpr(std::is_same_v<T, Int> || std::is_same_v<T, Float> || std::is_same_v<T, UInt64>)
+			out = kv2_parse_values<T, 1>(value)[0];
+		else if constexpr(std::is_same_v<T, Bool>)
+			out = util::to_boolean(value);
+		else if constexpr(std::is_same_v<T, String>)
+			out = value;
+		else if constexpr(std::is_same_v<T, Binary>) {
+			if(decode_hex(value, out) == false)
+				throw std::invalid_argument {"Invalid hex data for DMX binary value!"};
+		}
+		else if constexpr(std::is_same_v<T, Time>)
+			out = get_time(value);
+		else if constexpr(std::is_same_v<T, ObjectId>)
+			out = parse_object_id(value);
+		else if constexpr(std::is_same_v<T, Color>) {
+			auto values = kv2_parse_values<int32_t, 4>(value);
+			out = Color {static_cast<uint8_t>(values[0]), static_cast<uint8_t>(values[1]), static_cast<uint8_t>(values[2]), static_cast<uint8_t>(values[3])};
+		}
+		else if constexpr(std::is_same_v<T, Vector2>) {
+			auto values = kv2_parse_values<float, 2>(value);
+			out = Vector2 {values[0], values[1]};
+		}
+		else if constexpr(std::is_same_v<T, Vector3>) {
+			auto values = kv2_parse_values<float, 3>(value);
+			out = Vector3 {values[0], values[1], values[2]};
+		}
+		else if constexpr(std::is_same_v<T, Vector4>) {
+			auto values = kv2_parse_values<float, 4>(value);
+			out = Vector4 {values[0], values[1], values[2], values[3]};
+		}
+		else if constexpr(std::is_same_v<T, Angle>) {
+			auto values = kv2_parse_values<float, 3>(value);
+			out = Angle {values[0], values[1], values[2]};
+		}
+		else if constexpr(std::is_same_v<T, Quaternion>) {
+			// KeyValues2 stores quaternions as 'x y z w'
+			auto values = kv2_parse_values<float, 4>(value);
+			decode_quaternions(values.data(), &out, 1);
+		}
+		else if constexpr(std::is_same_v<T, Matrix>) {
+			auto values = kv2_parse_values<float, 16>(value);
+			for(auto i = 0u; i < 4u; ++i) {
+				for(auto j = 0u; j < 4u; ++j)
+					out[i][j] = values[i * 4 + j];
+			}
+		}
+		else if constexpr(std::is_same_v<T, UInt8>)
+			out = static_cast<UInt8>(kv2_parse_values<uint32_t, 1>(value)[0]);
+	}
+
+};
+
 class KV2ToDMXConverter {
   public:
-	static KV2ToDMXConverter Convert(const source_engine::dmx::KeyValues2::Array &kv2Data);
+	using IdToElementMap = std::unordered_map<std::string, source_engine::dmx::ElementRef>;
+	using RefList = std::vector<std::pair<std::shared_ptr<source_engine::dmx::ElementRef>, std::string>>;
+	// idToElement and refsToUpdate are scratch containers, they are cleared before the conversion returns
+	static KV2ToDMXConverter Convert(const source_engine::dmx::KeyValues2::Array &kv2Data, const source_engine::dmx::LoadOptions &options, IdToElementMap &idToElement, RefList &refsToUpdate);
 
 	const std::vector<std::shared_ptr<source_engine::dmx::Element>> &GetElements() const;
+	bool IsCancelled() const;
   private:
-	bool KV2StringToDMXAttribute(const source_engine::dmx::KeyValues2::StringValue &kvStrValue, const std::string &type, source_engine::dmx::Attribute &outAttribute, const std::string &elementName = "", const std::shared_ptr<source_engine::dmx::Element> &parentElement = nullptr);
+	using ValueDecoder = void (KV2ToDMXConverter::*)(const std::string &, source_engine::dmx::Attribute &);
+	template<source_engine::dmx::AttrType TType>
+	void DecodeValue(const std::string &value, source_engine::dmx::Attribute &outAttribute);
+	template<size_t... TIndices>
+	static constexpr std::array<ValueDecoder, sizeof...(TIndices)> MakeValueDecoders(std::index_sequence<TIndices...>);
+	static ValueDecoder GetValueDecoder(source_engine::dmx::AttrType type);
+
+	bool KV2StringToDMXAttribute(const source_engine::dmx::KeyValues2::StringValue &kvStrValue, source_engine::dmx::AttrType type, source_engine::dmx::Attribute &outAttribute, const std::string &elementName = "", const std::shared_ptr<source_engine::dmx::Element> &parentElement = nullptr);
 	void KV2ElementToDMXAttribute(const source_engine::dmx::KeyValues2::Element &kvEl, const std::string &type, source_engine::dmx::Attribute &outAttribute);
 	void KV2ArrayToDMXElement(const source_engine::dmx::KeyValues2::Array &kvEl, const source_engine::dmx::KeyValues2::ElementItem &kvChild, source_engine::dmx::Attribute &outAttribute);
 	void InitializeDMXElement(const source_engine::dmx::KeyValues2::Element &kv2El, std::shared_ptr<source_engine::dmx::Element> &inOutElement);
+	// Returns false if the value isn't decoded into the record, because it has no matching field
+	bool KV2ValueToField(const source_engine::dmx::KeyValues2::ElementItem &kvChild, const std::string &name, source_engine::dmx::ElementBinding &binding, size_t recordIdx);
+
+	KV2ToDMXConverter(IdToElementMap &idToElement, RefList &refsToUpdate);
 
 	// Contains all references to elements that need to be updated once all
 	// dmx elements and attributes have been created
-	std::vector<std::pair<std::shared_ptr<source_engine::dmx::ElementRef>, std::string>> m_refsToUpdate = {};
+	RefList &m_refsToUpdate;
 
-	std::unordered_map<std::string, source_engine::dmx::ElementRef> m_idToElement = {};
+	IdToElementMap &m_idToElement;
 	std::vector<std::shared_ptr<source_engine::dmx::Element>> m_elements = {};
+	source_engine::dmx::StringInterner *m_stringInterner = nullptr;
+	const source_engine::dmx::LoadFilter *m_filter = nullptr;
+	source_engine::dmx::Schema *m_schema = nullptr;
+	std::vector<float> m_quaternionComponents = {};
+	std::vector<source_engine::dmx::Quaternion> m_quaternions = {};
+	bool m_cancelled = false;
 };
 
 const std::vector<std::shared_ptr<source_engine::dmx::Element>> &KV2ToDMXConverter::GetElements() const { return m_elements; }
 
-KV2ToDMXConverter KV2ToDMXConverter::Convert(const source_engine::dmx::KeyValues2::Array &kv2Data)
+bool KV2ToDMXConverter::IsCancelled() const { return m_cancelled; }
+
+KV2ToDMXConverter::KV2ToDMXConverter(IdToElementMap &idToElement, RefList &refsToUpdate) : m_refsToUpdate {refsToUpdate}, m_idToElement {idToElement}
+{
+	m_refsToUpdate.clear();
+	m_idToElement.clear();
+}
+
+KV2ToDMXConverter KV2ToDMXConverter::Convert(const source_engine::dmx::KeyValues2::Array &kv2Data, const source_engine::dmx::LoadOptions &options, IdToElementMap &idToElement, RefList &refsToUpdate)
 {
-	KV2ToDMXConverter conversionData {};
+	KV2ToDMXConverter conversionData {idToElement, refsToUpdate};
+	conversionData.m_stringInterner = options.stringInterner.get();
+	if(!options.filter.IsEmpty())
+		conversionData.m_filter = &options.filter;
+	conversionData.m_schema = options.schema.get();
+	source_engine::dmx::Schema::LoadScope schemaScope {conversionData.m_schema};
 	for(auto &item : kv2Data.items) {
+		if(options.stopToken.stop_requested()) {
+			conversionData.m_cancelled = true;
+			refsToUpdate.clear();
+			idToElement.clear();
+			return conversionData;
+		}
 		auto el = std::make_shared<source_engine::dmx::Element>();
 		el->type = item->type.has_value() ? *item->type : "";
-		if(item->value->GetType() == source_engine::dmx::KeyValues2::BaseElement::Type::Element)
-			conversionData.InitializeDMXElement(static_cast<source_engine::dmx::KeyValues2::Element &>(*item->value), el);
-		else
+		if(item->value->GetType() != source_engine::dmx::KeyValues2::BaseElement::Type::Element)
 			throw std::invalid_argument {"Object of type 'Element' expected as value for array, got type '" + std::to_string(umath::to_integral(item->value->GetType())) + "'!"};
+		// Has to be added before its nested elements, otherwise the first top-level element wouldn't be the root
 		conversionData.m_elements.push_back(el);
+		conversionData.InitializeDMXElement(static_cast<source_engine::dmx::KeyValues2::Element &>(*item->value), el);
 	}
 
 	for(auto &pair : conversionData.m_refsToUpdate) {
@@ -56,118 +254,88 @@ KV2ToDMXConverter KV2ToDMXConverter::Convert(const source_engine::dmx::KeyValues
 		else
 			throw std::invalid_argument {"Element id '" + elementId + "' refers to unknown element!"};
 	}
+	refsToUpdate.clear();
+	idToElement.clear();
 	return conversionData;
 }
 
-bool KV2ToDMXConverter::KV2StringToDMXAttribute(const source_engine::dmx::KeyValues2::StringValue &kvStrValue, const std::string &type, source_engine::dmx::Attribute &outAttribute, const std::string &elementName, const std::shared_ptr<source_engine::dmx::Element> &parentElement)
+template<source_engine::dmx::AttrType TType>
+void KV2ToDMXConverter::DecodeValue(const std::string &value, source_engine::dmx::Attribute &outAttribute)
 {
-	auto &value = kvStrValue.value;
-	if(type == "string") {
-		if(parentElement) {
-			if(elementName == "name") {
-				parentElement->name = value;
-				return false;
-			}
-		}
-		outAttribute.type = source_engine::dmx::AttrType::String;
-		outAttribute.data = std::make_shared<source_engine::dmx::String>(value);
-	}
-	else if(type == "elementid") {
-		if(elementName == "id") {
-			if(parentElement)
-				m_idToElement.insert(std::make_pair(value, parentElement));
-			return false;
-		}
-		else
-			throw std::invalid_argument {"Found item of type 'elementid', but item name is not 'id'!"};
-	}
-	else if(type == "vector3") {
-		outAttribute.type = source_engine::dmx::AttrType::Vector3;
-		outAttribute.data = std::make_shared<source_engine::dmx::Vector3>(uvec::create(value));
-	}
-	else if(type == "quaternion") {
-		outAttribute.type = source_engine::dmx::AttrType::Quaternion;
-		outAttribute.data = std::make_shared<source_engine::dmx::Quaternion>(source_engine::dmx::get_quaternion(value));
-	}
-	else if(type == "element") {
+	outAttribute.type = TType;
+	if constexpr(TType == source_engine::dmx::AttrType::Element) {
 		auto ref = std::make_shared<source_engine::dmx::ElementRef>();
-		outAttribute.type = source_engine::dmx::AttrType::Element;
 		outAttribute.data = ref;
 		if(value.empty() == false)
 			m_refsToUpdate.push_back({ref, value});
 	}
-	else if(type == "int") {
-		outAttribute.type = source_engine::dmx::AttrType::Int;
-		outAttribute.data = std::make_shared<source_engine::dmx::Int>(util::to_int(value));
-	}
-	else if(type == "float") {
-		outAttribute.type = source_engine::dmx::AttrType::Float;
-		outAttribute.data = std::make_shared<source_engine::dmx::Float>(util::to_float(value));
-	}
-	else if(type == "bool") {
-		outAttribute.type = source_engine::dmx::AttrType::Bool;
-		outAttribute.data = std::make_shared<source_engine::dmx::Bool>(util::to_boolean(value));
-	}
-	else if(type == "time") {
-		outAttribute.type = source_engine::dmx::AttrType::Time;
-		outAttribute.data = std::make_shared<source_engine::dmx::Time>(source_engine::dmx::get_time(value));
-	}
-	else if(type == "color") {
-		outAttribute.type = source_engine::dmx::AttrType::Color;
-		source_engine::dmx::Color color {};
-		ustring::string_to_array<uint8_t, int32_t>(value, color.data(), atoi, color.size());
-		outAttribute.data = std::make_shared<source_engine::dmx::Color>(color);
-	}
-	else if(type == "binary") {
-		outAttribute.type = source_engine::dmx::AttrType::Binary;
-		auto binary = std::make_shared<source_engine::dmx::Binary>();
-		binary->resize(value.size());
-		memcpy(binary->data(), value.data(), value.size());
-		outAttribute.data = binary;
-	}
-	else
-		throw std::invalid_argument {"DMX type '" + type + "' is currently not supported for KeyValues2 format!"};
+	else if constexpr(TType == source_engine::dmx::AttrType::String)
+		outAttribute.data = m_stringInterner ? std::const_pointer_cast<source_engine::dmx::String>(m_stringInterner->Intern(value)) : std::make_shared<source_engine::dmx::String>(value); // Copied by Attribute::GetString before it is modified
+	else {
+		source_engine::dmx::visit_value_type(TType, [&value, &outAttribute](auto tag) {
+			using T = typename decltype(tag)::type;
+			auto data = std::make_shared<T>();
+			source_engine::dmx::kv2_decode_value(value, *data);
+			outAttribute.data = std::move(data);
+		});
+	}
+}
+
+template<size_t... TIndices>
+constexpr std::array<KV2ToDMXConverter::ValueDecoder, sizeof...(TIndices)> KV2ToDMXConverter::MakeValueDecoders(std::index_sequence<TIndices...>)
+{
+	return {&KV2ToDMXConverter::DecodeValue<static_cast<source_engine::dmx::AttrType>(static_cast<uint32_t>(source_engine::dmx::AttrType::SingleFirst) + TIndices)>...};
+}
+
+KV2ToDMXConverter::ValueDecoder KV2ToDMXConverter::GetValueDecoder(source_engine::dmx::AttrType type)
+{
+	constexpr auto numSingleTypes = static_cast<uint32_t>(source_engine::dmx::AttrType::SingleLast) - static_cast<uint32_t>(source_engine::dmx::AttrType::SingleFirst) + 1;
+	static constexpr auto decoders = MakeValueDecoders(std::make_index_sequence<numSingleTypes> {});
+	return decoders[static_cast<uint32_t>(type) - static_cast<uint32_t>(source_engine::dmx::AttrType::SingleFirst)];
+}
+
+bool KV2ToDMXConverter::KV2StringToDMXAttribute(const source_engine::dmx::KeyValues2::StringValue &kvStrValue, source_engine::dmx::AttrType type, source_engine::dmx::Attribute &outAttribute, const std::string &elementName, const std::shared_ptr<source_engine::dmx::Element> &parentElement)
+{
+	auto &value = kvStrValue.value;
+	if(parentElement) {
+		if(type == source_engine::dmx::AttrType::String && elementName == "name") {
+			parentElement->name = value;
+			return false;
+		}
+		if(type == source_engine::dmx::AttrType::ObjectId && elementName == "id") {
+			parentElement->GUID = source_engine::dmx::parse_object_id(value);
+			m_idToElement.insert(std::make_pair(value, parentElement));
+			return false;
+		}
+	}
+	if(source_engine::dmx::is_single_type(type) == false)
+		throw std::invalid_argument {"DMX type '" + source_engine::dmx::type_to_string(type) + "' is not a valid value type!"};
+	(this->*GetValueDecoder(type))(value, outAttribute);
 	return true;
 }
 
 void KV2ToDMXConverter::KV2ArrayToDMXElement(const source_engine::dmx::KeyValues2::Array &kvEl, const source_engine::dmx::KeyValues2::ElementItem &kvChild, source_engine::dmx::Attribute &outAttribute)
 {
-	auto arrayType = source_engine::dmx::AttrType::Invalid;
-	std::string singleType = "";
-	if(kvChild.type == "float_array") {
-		arrayType = source_engine::dmx::AttrType::FloatArray;
-		singleType = "float";
-	}
-	else if(kvChild.type == "int_array") {
-		arrayType = source_engine::dmx::AttrType::IntArray;
-		singleType = "int";
-	}
-	else if(kvChild.type == "string_array") {
-		arrayType = source_engine::dmx::AttrType::StringArray;
-		singleType = "string";
-	}
-	else if(kvChild.type == "time_array") {
-		arrayType = source_engine::dmx::AttrType::TimeArray;
-		singleType = "time";
-	}
-	else if(kvChild.type == "quaternion_array") {
-		arrayType = source_engine::dmx::AttrType::QuaternionArray;
-		singleType = "quaternion";
-	}
-	else if(kvChild.type == "vector3_array") {
-		arrayType = source_engine::dmx::AttrType::Vector3Array;
-		singleType = "vector3";
-	}
-	else if(kvChild.type == "element_array") {
-		arrayType = source_engine::dmx::AttrType::ElementArray;
-		singleType = "element";
-	}
-	else
+	auto arrayType = source_engine::dmx::kv2_type_to_attr_type(kvChild.type);
+	if(source_engine::dmx::is_array_type(arrayType) == false)
 		throw std::invalid_argument {"DMX array type '" + kvChild.type + "' is currently not supported for KeyValues2 format!"};
+	auto singleType = source_engine::dmx::get_single_type(arrayType);
 	auto values = std::make_shared<std::vector<std::shared_ptr<source_engine::dmx::Attribute>>>();
 	outAttribute.data = values;
 	outAttribute.type = arrayType;
 	values->reserve(kvEl.items.size());
+	if(singleType == source_engine::dmx::AttrType::Quaternion) {
+		source_engine::dmx::kv2_parse_quaternion_components(kvEl, m_quaternionComponents);
+		m_quaternions.resize(kvEl.items.size());
+		source_engine::dmx::decode_quaternions(m_quaternionComponents.data(), m_quaternions.data(), m_quaternions.size());
+		for(auto &rot : m_quaternions) {
+			auto attr = std::make_shared<source_engine::dmx::Attribute>();
+			attr->type = singleType;
+			attr->data = std::make_shared<source_engine::dmx::Quaternion>(rot);
+			values->push_back(attr);
+		}
+		return;
+	}
 	for(auto &arrayItem : kvEl.items) {
 		switch(arrayItem->value->GetType()) {
 		case source_engine::dmx::KeyValues2::BaseElement::Type::String:
@@ -182,7 +350,7 @@ void KV2ToDMXConverter::KV2ArrayToDMXElement(const source_engine::dmx::KeyValues
 			{
 				auto &kvEl = static_cast<source_engine::dmx::KeyValues2::Element &>(*arrayItem->value);
 				auto attr = std::make_shared<source_engine::dmx::Attribute>();
-				KV2ElementToDMXAttribute(kvEl, singleType, *attr);
+				KV2ElementToDMXAttribute(kvEl, arrayItem->type.has_value() ? *arrayItem->type : "", *attr);
 				values->push_back(attr);
 				break;
 			}
@@ -205,34 +373,90 @@ void KV2ToDMXConverter::KV2ElementToDMXAttribute(const source_engine::dmx::KeyVa
 
 void KV2ToDMXConverter::InitializeDMXElement(const source_engine::dmx::KeyValues2::Element &kv2El, std::shared_ptr<source_engine::dmx::Element> &inOutElement)
 {
+	// Nested elements of filtered attributes are still converted so that references to them resolve,
+	// but the attribute itself is not added
+	auto elementIncluded = !m_filter || m_filter->IsElementTypeIncluded(inOutElement->type);
+	auto isAttributeIncluded = [this, elementIncluded](const std::string &name) { return !m_filter || (elementIncluded && m_filter->IsAttributeIncluded(name)); };
+	auto *binding = (m_schema && elementIncluded) ? m_schema->FindBinding(inOutElement->type) : nullptr;
+	size_t recordIdx = 0;
+	if(binding)
+		recordIdx = binding->AddRecord(inOutElement);
 	for(auto &pair : kv2El.children) {
 		auto &kvChild = pair.second;
+		// The id and name are properties of the element itself
+		if(binding && pair.first != "id" && pair.first != "name" && isAttributeIncluded(pair.first) && KV2ValueToField(*kvChild, pair.first, *binding, recordIdx))
+			continue;
 		auto attr = std::make_shared<source_engine::dmx::Attribute>();
 		auto &kvValue = kvChild->value;
 		auto type = kvValue->GetType();
 		if(type == source_engine::dmx::KeyValues2::BaseElement::Type::String) {
 			auto &kvStrValue = static_cast<source_engine::dmx::KeyValues2::StringValue &>(*kvValue);
-			if(KV2StringToDMXAttribute(kvStrValue, kvChild->type, *attr, pair.first, inOutElement))
+			auto attrType = source_engine::dmx::kv2_type_to_attr_type(kvChild->type);
+			if(attrType == source_engine::dmx::AttrType::Invalid)
+				throw std::invalid_argument {"DMX type '" + kvChild->type + "' is currently not supported for KeyValues2 format!"};
+			if(KV2StringToDMXAttribute(kvStrValue, attrType, *attr, pair.first, inOutElement) && isAttributeIncluded(pair.first))
 				inOutElement->attributes.insert(std::make_pair(pair.first, attr));
 		}
 		else if(type == source_engine::dmx::KeyValues2::BaseElement::Type::Element) {
 			auto &kvEl = static_cast<source_engine::dmx::KeyValues2::Element &>(*kvValue);
 			KV2ElementToDMXAttribute(kvEl, kvChild->type, *attr);
-			inOutElement->attributes.insert(std::make_pair(pair.first, attr));
+			if(isAttributeIncluded(pair.first))
+				inOutElement->attributes.insert(std::make_pair(pair.first, attr));
 		}
 		else if(type == source_engine::dmx::KeyValues2::BaseElement::Type::Array) {
 			auto &kvEl = static_cast<source_engine::dmx::KeyValues2::Array &>(*kvValue);
 			KV2ArrayToDMXElement(kvEl, *kvChild, *attr);
-			inOutElement->attributes.insert(std::make_pair(pair.first, attr));
+			if(isAttributeIncluded(pair.first))
+				inOutElement->attributes.insert(std::make_pair(pair.first, attr));
 		}
 		else
 			throw std::invalid_argument {"DMX type '" + std::to_string(umath::to_integral(type)) + "' is currently not supported for KeyValues2 format!"};
 	}
 }
 
-std::shared_ptr<source_engine::dmx::FileData> source_engine::dmx::FileData::CreateFromKeyValues2Data(const void *pKv2Data)
+bool KV2ToDMXConverter::KV2ValueToField(const source_engine::dmx::KeyValues2::ElementItem &kvChild, const std::string &name, source_engine::dmx::ElementBinding &binding, size_t recordIdx)
+{
+	auto *field = binding.FindField(name);
+	if(!field || field->type != source_engine::dmx::kv2_type_to_attr_type(kvChild.type))
+		return false;
+	auto *member = field->getMember(binding.GetRecord(recordIdx));
+	auto &kvValue = *kvChild.value;
+	if(source_engine::dmx::is_single_type(field->type)) {
+		if(kvValue.GetType() != source_engine::dmx::KeyValues2::BaseElement::Type::String)
+			return false;
+		auto &value = static_cast<const source_engine::dmx::KeyValues2::StringValue &>(kvValue).value;
+		source_engine::dmx::visit_value_type(field->type, [&value, member](auto tag) { source_engine::dmx::kv2_decode_value(value, *static_cast<typename decltype(tag)::type *>(member)); });
+		return true;
+	}
+	if(kvValue.GetType() != source_engine::dmx::KeyValues2::BaseElement::Type::Array)
+		return false;
+	auto &kvArray = static_cast<const source_engine::dmx::KeyValues2::Array &>(kvValue);
+	source_engine::dmx::visit_value_type(source_engine::dmx::get_single_type(field->type), [this, &kvArray, member](auto tag) {
+		using T = typename decltype(tag)::type;
+		auto &values = *static_cast<std::vector<T> *>(member);
+		values.resize(kvArray.items.size());
+		if constexpr(std::is_same_v<T, source_engine::dmx::Quaternion>) {
+			source_engine::dmx::kv2_parse_quaternion_components(kvArray, m_quaternionComponents);
+			source_engine::dmx::decode_quaternions(m_quaternionComponents.data(), values.data(), values.size());
+			return;
+		}
+		for(size_t i = 0; i < kvArray.items.size(); ++i) {
+			auto &arrayItem = kvArray.items[i];
+			if(arrayItem->value->GetType() != source_engine::dmx::KeyValues2::BaseElement::Type::String)
+				throw std::invalid_argument {"Unexpected array item type " + std::to_string(umath::to_integral(arrayItem->GetType()))};
+			T v {};
+			source_engine::dmx::kv2_decode_value(static_cast<const source_engine::dmx::KeyValues2::StringValue &>(*arrayItem->value).value, v);
+			values[i] = std::move(v);
+		}
+	});
+	return true;
+}
+
+std::shared_ptr<source_engine::dmx::FileData> source_engine::dmx::FileData::CreateFromKeyValues2Data(const void *pKv2Data, const LoadOptions &options, LoaderContext &context)
 {
-	auto data = KV2ToDMXConverter::Convert(*static_cast<const KeyValues2::Array *>(pKv2Data));
+	auto data = KV2ToDMXConverter::Convert(*static_cast<const KeyValues2::Array *>(pKv2Data), options, context.m_kv2IdToElement, context.m_kv2RefsToUpdate);
+	if(data.IsCancelled())
+		return nullptr;
 	auto fd = std::shared_ptr<FileData>(new FileData());
 	fd->m_elements = data.GetElements();
 	return fd;
@@ -0,0 +1,30 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "dmx_types.hpp"
+#include "thread_pool.hpp"
+#include <sharedutils/util_ifile.hpp>
+#include <future>
+
+module source_engine.dmx;
+
+std::future<std::shared_ptr<source_engine::dmx::FileData>> source_engine::dmx::FileData::LoadAsync(const std::shared_ptr<ufile::IFile> &f, LoadOptions options, const Executor &executor)
+{
+	auto promise = std::make_shared<std::promise<std::shared_ptr<FileData>>>();
+	auto future = promise->get_future();
+	auto task = [f, options = std::move(options), promise]() {
+		try {
+			promise->set_value(Load(f, options));
+		}
+		catch(...) {
+			promise->set_exception(std::current_exception());
+		}
+	};
+	if(executor)
+		executor(std::move(task));
+	else
+		ThreadPool::GetDefault().Push(std::move(task));
+	return future;
+}
@@ -0,0 +1,113 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "dmx_types.hpp"
+#include "memory_usage.hpp"
+#include <unordered_set>
+
+module source_engine.dmx;
+
+namespace source_engine::dmx {
+	class MemoryUsageCounter {
+	  public:
+		MemoryUsageCounter(MemoryUsageReport &report) : m_report {report} {}
+		void CountElement(const Element &el, MemoryUsage &usage)
+		{
+			usage.overhead += SHARED_CONTROL_BLOCK_SIZE + sizeof(Element) - 2 * sizeof(std::string) - sizeof(util::GUID);
+			usage.payload += sizeof(util::GUID);
+			usage.strings += 2 * sizeof(std::string) + get_string_heap_size(el.type) + get_string_heap_size(el.name);
+
+			// The attribute names are part of the map nodes
+			usage.overhead += get_hash_table_size(el.attributes) - el.attributes.size() * sizeof(std::string);
+			usage.strings += el.attributes.size() * sizeof(std::string);
+			for(auto &[name, attr] : el.attributes) {
+				usage.strings += get_string_heap_size(name);
+				if(!attr)
+					continue;
+				auto attrUsage = CountAttribute(*attr, attr.use_count());
+				if(auto typeIdx = static_cast<size_t>(attr->type); typeIdx < m_report.attributeTypes.size())
+					m_report.attributeTypes[typeIdx] += attrUsage;
+				usage += attrUsage;
+			}
+
+			usage.lookupTables += get_hash_table_size(el.nameToChildElement);
+			for(auto &[name, child] : el.nameToChildElement)
+				usage.lookupTables += get_string_heap_size(name);
+		}
+		// Attribute object, value and array items
+		MemoryUsage CountAttribute(const Attribute &attr, long useCount)
+		{
+			MemoryUsage usage {};
+			if(!Visit(&attr, useCount))
+				return usage;
+			usage.overhead += SHARED_CONTROL_BLOCK_SIZE + sizeof(Attribute);
+			usage.lookupTables += attr.GetIndexMemoryUsage();
+			if(attr.data == nullptr || !Visit(attr.data.get(), attr.data.use_count()))
+				return usage;
+			if(is_single_type(attr.type))
+				CountValue(attr.type, attr.data.get(), usage);
+			else if(is_array_type(attr.type)) {
+				auto &items = *static_cast<const std::vector<std::shared_ptr<Attribute>> *>(attr.data.get());
+				usage.overhead += SHARED_CONTROL_BLOCK_SIZE + sizeof(items) + items.capacity() * sizeof(items.front());
+				for(auto &item : items) {
+					if(item)
+						usage += CountAttribute(*item, item.use_count());
+				}
+			}
+			return usage;
+		}
+	  private:
+		// Blocks that are referenced more than once are only counted the first time they're visited
+		bool Visit(const void *ptr, long useCount) { return useCount <= 1 || m_visited.insert(ptr).second; }
+		void CountValue(AttrType type, const void *data, MemoryUsage &usage)
+		{
+			usage.overhead += SHARED_CONTROL_BLOCK_SIZE;
+			visit_value_type(type, [data, &usage]<typename T>(std::type_identity<T>) {
+				if constexpr(std::is_same_v<T, ElementRef>)
+					usage.overhead += sizeof(T);
+				else if constexpr(std::is_same_v<T, String>)
+					usage.strings += sizeof(T) + get_string_heap_size(*static_cast<const T *>(data));
+				else if constexpr(std::is_same_v<T, Binary>) {
+					usage.overhead += sizeof(T);
+					usage.payload += static_cast<const T *>(data)->capacity();
+				}
+				else
+					usage.payload += sizeof(T);
+			});
+		}
+
+		MemoryUsageReport &m_report;
+		std::unordered_set<const void *> m_visited;
+	};
+};
+
+uint64_t source_engine::dmx::MemoryUsage::GetTotal() const { return payload + strings + overhead + lookupTables; }
+source_engine::dmx::MemoryUsage &source_engine::dmx::MemoryUsage::operator+=(const MemoryUsage &other)
+{
+	payload += other.payload;
+	strings += other.strings;
+	overhead += other.overhead;
+	lookupTables += other.lookupTables;
+	return *this;
+}
+
+source_engine::dmx::MemoryUsageReport source_engine::dmx::FileData::GetMemoryUsage() const
+{
+	MemoryUsageReport report {};
+	MemoryUsageCounter counter {report};
+	std::unordered_set<const Element *> countedElements {};
+	for(auto &el : m_elements) {
+		if(!el || (el.use_count() > 1 && countedElements.insert(el.get()).second == false))
+			continue;
+		counter.CountElement(*el, report.elementTypes[el->type]);
+	}
+	for(auto &[type, usage] : report.elementTypes)
+		report.total += usage;
+
+	report.total.overhead += m_elements.capacity() * sizeof(m_elements.front());
+	if(m_rootAttribute)
+		report.total += counter.CountAttribute(*m_rootAttribute, m_rootAttribute.use_count());
+	return report;
+}
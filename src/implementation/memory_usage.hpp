@@ -0,0 +1,35 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef __UTIL_DMX_MEMORY_USAGE_HPP__
+#define __UTIL_DMX_MEMORY_USAGE_HPP__
+
+#include <cstdint>
+#include <string>
+
+namespace source_engine::dmx {
+	// Approximations of the allocations made by the standard library. The actual sizes depend on the implementation
+	// and the allocator, but are close to these for the common 64-bit implementations.
+
+	// Reference counts and vtable pointer of a control block created by std::make_shared, which is allocated together with the object
+	constexpr uint64_t SHARED_CONTROL_BLOCK_SIZE = sizeof(void *) + 2 * sizeof(uint32_t);
+	// Link and cached hash of an unordered container node
+	constexpr uint64_t HASH_NODE_OVERHEAD = sizeof(void *) + sizeof(size_t);
+	// Links and color of a std::set/std::map node
+	constexpr uint64_t TREE_NODE_OVERHEAD = 4 * sizeof(void *);
+
+	// Heap storage of a string, 0 if the string is stored inline
+	inline uint64_t get_string_heap_size(const std::string &str)
+	{
+		static const auto inlineCapacity = std::string {}.capacity();
+		return (str.capacity() > inlineCapacity) ? str.capacity() + 1 : 0;
+	}
+	// Buckets and nodes of an unordered container, without any heap storage of the values
+	template<typename TContainer>
+	uint64_t get_hash_table_size(const TContainer &container)
+	{
+		return container.bucket_count() * sizeof(void *) + container.size() * (HASH_NODE_OVERHEAD + sizeof(typename TContainer::value_type));
+	}
+};
+
+#endif
@@ -0,0 +1,374 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "dmx_types.hpp"
+#include "simd.hpp"
+#include "thread_pool.hpp"
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+
+module source_engine.dmx;
+
+namespace source_engine::dmx {
+	using AttributeArray = std::vector<std::shared_ptr<Attribute>>;
+	// Vertices are written in blocks, so that the output of a block stays in the cache while the streams are interleaved into it
+	static constexpr size_t VERTEX_BLOCK_SIZE = 256;
+
+	static std::shared_ptr<Element> get_vertex_data(const Element &mesh)
+	{
+		for(auto *name : {"bindState", "currentState"}) {
+			auto attr = mesh.GetAttr(name);
+			if(!attr || attr->type != AttrType::Element || !attr->data)
+				continue;
+			auto vertexData = static_cast<ElementRef *>(attr->data.get())->lock();
+			if(vertexData && vertexData->type == "DmeVertexData")
+				return vertexData;
+		}
+		return nullptr;
+	}
+	static const AttributeArray *get_array_attribute(const Element &el, const std::string &name)
+	{
+		auto attr = el.GetAttr(name);
+		if(!attr || !is_array_type(attr->type) || !attr->data)
+			return nullptr;
+		return static_cast<const AttributeArray *>(attr->data.get());
+	}
+	static const AttributeArray *get_index_stream(const Element &vertexData, const std::string &stream)
+	{
+		auto attr = vertexData.GetAttr(stream + "Indices");
+		if(!attr || attr->type != AttrType::IntArray || !attr->data)
+			return nullptr;
+		return static_cast<const AttributeArray *>(attr->data.get());
+	}
+	static bool is_joint_stream(const std::string &stream) { return stream == "jointWeights" || stream == "jointIndices"; }
+	static uint32_t get_joint_count(const Element &vertexData)
+	{
+		auto attr = vertexData.GetAttr("jointCount");
+		if(!attr || attr->type != AttrType::Int || !attr->data)
+			return 0;
+		return static_cast<uint32_t>(std::max(*static_cast<const Int *>(attr->data.get()), 0));
+	}
+	// The vertex count is the length of the index stream of the first stream in the vertex format
+	static size_t get_vertex_count(const Element &vertexData)
+	{
+		if(auto *format = get_array_attribute(vertexData, "vertexFormat")) {
+			for(auto &item : *format) {
+				if(item->type != AttrType::String || !item->data)
+					continue;
+				if(auto *indices = get_index_stream(vertexData, *static_cast<const String *>(item->data.get())))
+					return indices->size();
+			}
+		}
+		if(auto *indices = get_index_stream(vertexData, "positions"))
+			return indices->size();
+		auto *positions = get_array_attribute(vertexData, "positions");
+		return positions ? positions->size() : 0;
+	}
+
+	static uint32_t get_value_component_count(AttrType type)
+	{
+		switch(type) {
+		case AttrType::Int:
+		case AttrType::Float:
+			return 1;
+		case AttrType::Vector2:
+			return 2;
+		case AttrType::Vector3:
+			return 3;
+		case AttrType::Vector4:
+		case AttrType::Quaternion:
+		case AttrType::Color:
+			return 4;
+		default:
+			return 0;
+		}
+	}
+	static void read_components(AttrType type, const void *data, float *out)
+	{
+		switch(type) {
+		case AttrType::Int:
+			out[0] = static_cast<float>(*static_cast<const Int *>(data));
+			break;
+		case AttrType::Float:
+			out[0] = *static_cast<const Float *>(data);
+			break;
+		case AttrType::Vector2:
+			{
+				auto &v = *static_cast<const Vector2 *>(data);
+				out[0] = v.x;
+				out[1] = v.y;
+				break;
+			}
+		case AttrType::Vector3:
+			{
+				auto &v = *static_cast<const Vector3 *>(data);
+				out[0] = v.x;
+				out[1] = v.y;
+				out[2] = v.z;
+				break;
+			}
+		case AttrType::Vector4:
+			{
+				auto &v = *static_cast<const Vector4 *>(data);
+				out[0] = v.x;
+				out[1] = v.y;
+				out[2] = v.z;
+				out[3] = v.w;
+				break;
+			}
+		case AttrType::Quaternion:
+			{
+				auto &q = *static_cast<const Quaternion *>(data);
+				out[0] = q.x;
+				out[1] = q.y;
+				out[2] = q.z;
+				out[3] = q.w;
+				break;
+			}
+		case AttrType::Color:
+			{
+				auto &c = *static_cast<const Color *>(data);
+				for(size_t i = 0; i < c.size(); ++i)
+					out[i] = c[i] / 255.f;
+				break;
+			}
+		default:
+			break;
+		}
+	}
+
+	// A stream whose values and indices have been copied out of the attributes into contiguous arrays
+	struct GatheredStream {
+		std::vector<float> values;
+		std::vector<int32_t> indices;
+		bool indexed = false;
+		uint32_t numComponents = 0; // Per index
+		size_t numValues = 0;
+	};
+	static bool gather_stream(const Element &vertexData, const std::string &name, uint32_t jointCount, GatheredStream &outStream)
+	{
+		outStream.values.clear();
+		outStream.indices.clear();
+		auto attr = vertexData.GetAttr(name);
+		if(!attr || !is_array_type(attr->type) || !attr->data)
+			return false;
+		auto valueType = get_single_type(attr->type);
+		auto valueComponents = get_value_component_count(valueType);
+		if(valueComponents == 0)
+			return false;
+		auto &values = *static_cast<const AttributeArray *>(attr->data.get());
+		auto *indices = get_index_stream(vertexData, name);
+		auto valuesPerIndex = 1u;
+		if(!indices && is_joint_stream(name)) {
+			if(jointCount == 0)
+				return false;
+			indices = get_index_stream(vertexData, "positions");
+			valuesPerIndex = jointCount;
+		}
+		outStream.indexed = (indices != nullptr);
+		outStream.numComponents = valueComponents * valuesPerIndex;
+		outStream.numValues = values.size() / valuesPerIndex;
+
+		outStream.values.resize(outStream.numValues * outStream.numComponents);
+		auto *out = outStream.values.data();
+		for(size_t i = 0; i < outStream.numValues * valuesPerIndex; ++i, out += valueComponents) {
+			auto &item = values[i];
+			if(item->type == valueType && item->data)
+				read_components(valueType, item->data.get(), out);
+			else
+				std::fill_n(out, valueComponents, 0.f);
+		}
+		if(indices) {
+			outStream.indices.resize(indices->size());
+			for(size_t i = 0; i < indices->size(); ++i) {
+				auto &item = (*indices)[i];
+				outStream.indices[i] = item->data ? *static_cast<const Int *>(item->data.get()) : -1;
+			}
+		}
+		return true;
+	}
+
+	template<typename T, bool NORMALIZED>
+	static T convert_component(float value)
+	{
+		constexpr auto maxValue = static_cast<float>(std::numeric_limits<T>::max());
+		// NaN becomes 0
+		if(!(value > 0.f))
+			return 0;
+		if constexpr(NORMALIZED) {
+			if(value >= 1.f)
+				return std::numeric_limits<T>::max();
+			return static_cast<T>(std::nearbyint(value * maxValue));
+		}
+		else {
+			if(value >= maxValue)
+				return std::numeric_limits<T>::max();
+			return static_cast<T>(value);
+		}
+	}
+	template<typename T, bool NORMALIZED>
+	static void write_vertices(const GatheredStream &stream, uint32_t numComponents, uint8_t *out, uint32_t stride, size_t first, size_t last)
+	{
+		auto numCopied = std::min(numComponents, stream.numComponents);
+		T components[MeshExtractor::MAX_COMPONENTS];
+		for(auto v = first; v < last; ++v, out += stride) {
+			auto idx = static_cast<int64_t>(v);
+			if(stream.indexed)
+				idx = (v < stream.indices.size()) ? stream.indices[v] : -1;
+			if(idx < 0 || static_cast<size_t>(idx) >= stream.numValues) {
+				std::memset(out, 0, numComponents * sizeof(T));
+				continue;
+			}
+			auto *src = stream.values.data() + idx * stream.numComponents;
+			if constexpr(std::is_same_v<T, float>) {
+				std::memcpy(out, src, numCopied * sizeof(T));
+				std::memset(out + numCopied * sizeof(T), 0, (numComponents - numCopied) * sizeof(T));
+				continue;
+			}
+			else {
+#ifdef UTIL_DMX_SIMD_SSE2
+				if constexpr(std::is_same_v<T, uint8_t> && NORMALIZED) {
+					// Typical for joint weights; Min/max return the second operand for NaN, which matches convert_component
+					if(numComponents == 4 && numCopied == 4) {
+						auto values = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src), _mm_setzero_ps()), _mm_set1_ps(1.f));
+						auto ints = _mm_cvtps_epi32(_mm_mul_ps(values, _mm_set1_ps(255.f)));
+						ints = _mm_packus_epi16(_mm_packs_epi32(ints, ints), ints);
+						auto packed = _mm_cvtsi128_si32(ints);
+						std::memcpy(out, &packed, sizeof(packed));
+						continue;
+					}
+				}
+#endif
+				for(uint32_t c = 0; c < numCopied; ++c)
+					components[c] = convert_component<T, NORMALIZED>(src[c]);
+				std::fill(components + numCopied, components + numComponents, T {0});
+				std::memcpy(out, components, numComponents * sizeof(T));
+			}
+		}
+	}
+	static void write_vertices(const GatheredStream &stream, const MeshExtractor::VertexAttribute &attr, uint8_t *out, uint32_t stride, size_t first, size_t last)
+	{
+		switch(attr.componentType) {
+		case MeshExtractor::ComponentType::Float:
+			write_vertices<float, false>(stream, attr.numComponents, out, stride, first, last);
+			break;
+		case MeshExtractor::ComponentType::UInt8:
+			write_vertices<uint8_t, false>(stream, attr.numComponents, out, stride, first, last);
+			break;
+		case MeshExtractor::ComponentType::UInt16:
+			write_vertices<uint16_t, false>(stream, attr.numComponents, out, stride, first, last);
+			break;
+		case MeshExtractor::ComponentType::UInt32:
+			write_vertices<uint32_t, false>(stream, attr.numComponents, out, stride, first, last);
+			break;
+		case MeshExtractor::ComponentType::UNorm8:
+			write_vertices<uint8_t, true>(stream, attr.numComponents, out, stride, first, last);
+			break;
+		case MeshExtractor::ComponentType::UNorm16:
+			write_vertices<uint16_t, true>(stream, attr.numComponents, out, stride, first, last);
+			break;
+		}
+	}
+
+	static void validate_layout(const MeshExtractor::VertexLayout &layout)
+	{
+		if(layout.stride == 0)
+			throw std::invalid_argument {"Vertex layout has a stride of 0!"};
+		for(auto &attr : layout.attributes) {
+			auto componentSize = MeshExtractor::GetComponentSize(attr.componentType);
+			if(componentSize == 0)
+				throw std::invalid_argument {"Vertex attribute '" + attr.stream + "' has an invalid component type!"};
+			if(attr.numComponents == 0 || attr.numComponents > MeshExtractor::MAX_COMPONENTS)
+				throw std::invalid_argument {"Vertex attribute '" + attr.stream + "' has " + std::to_string(attr.numComponents) + " components, expected 1 to " + std::to_string(MeshExtractor::MAX_COMPONENTS) + "!"};
+			if(static_cast<uint64_t>(attr.offset) + attr.numComponents * componentSize > layout.stride)
+				throw std::invalid_argument {"Vertex attribute '" + attr.stream + "' exceeds the vertex stride of " + std::to_string(layout.stride) + " bytes!"};
+		}
+	}
+};
+
+source_engine::dmx::LoadFilter source_engine::dmx::MeshExtractor::GetLoadFilter()
+{
+	LoadFilter filter {};
+	filter.includeElementTypes = {"DmeMesh", "DmeVertexData"};
+	return filter;
+}
+
+size_t source_engine::dmx::MeshExtractor::GetComponentSize(ComponentType type)
+{
+	switch(type) {
+	case ComponentType::Float:
+	case ComponentType::UInt32:
+		return 4;
+	case ComponentType::UInt16:
+	case ComponentType::UNorm16:
+		return 2;
+	case ComponentType::UInt8:
+	case ComponentType::UNorm8:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+source_engine::dmx::MeshExtractor::MeshExtractor(const FileData &fileData)
+{
+	for(auto &mesh : fileData.GetElements()) {
+		if(mesh->type != "DmeMesh")
+			continue;
+		auto vertexData = get_vertex_data(*mesh);
+		if(!vertexData)
+			continue;
+		MeshVertexData meshData {};
+		meshData.mesh = mesh;
+		meshData.numVertices = get_vertex_count(*vertexData);
+		meshData.jointCount = get_joint_count(*vertexData);
+		meshData.vertexData = std::move(vertexData);
+		m_meshes.push_back(std::move(meshData));
+	}
+}
+
+const std::vector<source_engine::dmx::MeshVertexData> &source_engine::dmx::MeshExtractor::GetMeshes() const { return m_meshes; }
+
+bool source_engine::dmx::MeshExtractor::ExtractVertices(const MeshVertexData &mesh, const VertexLayout &layout, uint8_t *outVertices) const
+{
+	if(get_vertex_count(*mesh.vertexData) != mesh.numVertices)
+		return false; // Vertex data has been modified since the extractor was created
+	thread_local std::vector<GatheredStream> streams;
+	if(streams.size() < layout.attributes.size())
+		streams.resize(layout.attributes.size());
+	auto jointCount = get_joint_count(*mesh.vertexData);
+	for(size_t i = 0; i < layout.attributes.size(); ++i) {
+		if(!gather_stream(*mesh.vertexData, layout.attributes[i].stream, jointCount, streams[i]))
+			streams[i].numValues = 0; // Missing streams are written as zeros
+	}
+
+	for(size_t first = 0; first < mesh.numVertices; first += VERTEX_BLOCK_SIZE) {
+		auto last = std::min(first + VERTEX_BLOCK_SIZE, mesh.numVertices);
+		for(size_t i = 0; i < layout.attributes.size(); ++i) {
+			auto &attr = layout.attributes[i];
+			write_vertices(streams[i], attr, outVertices + first * layout.stride + attr.offset, layout.stride, first, last);
+		}
+	}
+	return true;
+}
+
+bool source_engine::dmx::MeshExtractor::Extract(size_t meshIndex, const VertexLayout &layout, void *outVertices) const
+{
+	validate_layout(layout);
+	if(meshIndex >= m_meshes.size())
+		return false;
+	return ExtractVertices(m_meshes[meshIndex], layout, static_cast<uint8_t *>(outVertices));
+}
+
+size_t source_engine::dmx::MeshExtractor::ExtractAll(const VertexLayout &layout, const std::vector<void *> &outVertices, const Executor &executor) const
+{
+	validate_layout(layout);
+	auto numMeshes = std::min(outVertices.size(), m_meshes.size());
+	return run_parallel_count(
+	  numMeshes, [this, &layout, &outVertices](size_t i) { return outVertices[i] && ExtractVertices(m_meshes[i], layout, static_cast<uint8_t *>(outVertices[i])); }, executor);
+}
@@ -0,0 +1,86 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "dmx_types.hpp"
+#include <sharedutils/util_ifile.hpp>
+#include <charconv>
+#include <cstring>
+#include <string_view>
+
+module source_engine.dmx;
+
+namespace source_engine::dmx {
+	// DMX headers should never be longer than this; The whole header is read with a single block read
+	constexpr size_t MAX_HEADER_SIZE = 1'024;
+
+	static constexpr bool is_header_whitespace(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+
+	// Returns the next whitespace-separated token and advances the view past it
+	static std::string_view next_header_token(std::string_view &str)
+	{
+		size_t start = 0;
+		while(start < str.size() && is_header_whitespace(str[start]))
+			++start;
+		auto end = start;
+		while(end < str.size() && !is_header_whitespace(str[end]))
+			++end;
+		auto token = str.substr(start, end - start);
+		str.remove_prefix(end);
+		return token;
+	}
+
+	static bool read_header_field(std::string_view &str, std::array<char, HeaderInfo::MAX_NAME_LENGTH + 1> &outName, uint32_t &outVersion)
+	{
+		auto name = next_header_token(str);
+		auto version = next_header_token(str);
+		if(name.empty() || name.size() > HeaderInfo::MAX_NAME_LENGTH)
+			return false;
+		auto res = std::from_chars(version.data(), version.data() + version.size(), outVersion);
+		if(res.ec != std::errc {} || res.ptr != version.data() + version.size())
+			return false;
+		std::memcpy(outName.data(), name.data(), name.size());
+		outName[name.size()] = '\0';
+		return true;
+	}
+};
+
+std::optional<source_engine::dmx::HeaderInfo> source_engine::dmx::FileData::Probe(const void *data, size_t size)
+{
+	std::string_view block {static_cast<const char *>(data), std::min(size, MAX_HEADER_SIZE)};
+	auto end = block.find("-->");
+	if(end == std::string_view::npos)
+		return {};
+	HeaderInfo info {};
+	info.headerSize = static_cast<uint32_t>(end + 3);
+
+	// <!-- dmx encoding <encoding> <encodingVersion> format <format> <formatVersion> -->
+	auto header = block.substr(0, end);
+	if(next_header_token(header) != "<!--" || next_header_token(header) != "dmx")
+		return {};
+	auto hasEncoding = false;
+	for(auto token = next_header_token(header); !token.empty(); token = next_header_token(header)) {
+		if(token == "encoding") {
+			if(!read_header_field(header, info.encoding, info.encodingVersion))
+				return {};
+			hasEncoding = true;
+		}
+		else if(token == "format") {
+			if(!read_header_field(header, info.format, info.formatVersion))
+				return {};
+		}
+	}
+	if(!hasEncoding)
+		return {};
+	return info;
+}
+
+std::optional<source_engine::dmx::HeaderInfo> source_engine::dmx::FileData::Probe(const std::shared_ptr<ufile::IFile> &f)
+{
+	std::array<char, MAX_HEADER_SIZE> block;
+	auto startPos = f->Tell();
+	auto size = f->Read(block.data(), block.size());
+	f->Seek(startPos);
+	return Probe(block.data(), size);
+}
@@ -0,0 +1,69 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "dmx_types.hpp"
+#include <stdexcept>
+
+module source_engine.dmx;
+
+source_engine::dmx::ElementBinding::ElementBinding(std::string elementType, std::vector<Field> &&fields) : m_elementType {std::move(elementType)}, m_fields {std::move(fields)}
+{
+	for(size_t i = 0; i < m_fields.size(); ++i) {
+		for(size_t j = 0; j < i; ++j) {
+			if(m_fields[i].name == m_fields[j].name)
+				throw std::invalid_argument {"Attribute '" + m_fields[i].name + "' of element type '" + m_elementType + "' is bound more than once!"};
+		}
+	}
+}
+
+const std::string &source_engine::dmx::ElementBinding::GetElementType() const { return m_elementType; }
+const std::vector<source_engine::dmx::ElementBinding::Field> &source_engine::dmx::ElementBinding::GetFields() const { return m_fields; }
+const source_engine::dmx::ElementBinding::Field *source_engine::dmx::ElementBinding::FindField(const std::string &name) const
+{
+	// Bindings usually have few fields, so a linear search is faster than a hash lookup
+	for(auto &field : m_fields) {
+		if(field.name == name)
+			return &field;
+	}
+	return nullptr;
+}
+const std::vector<std::shared_ptr<source_engine::dmx::Element>> &source_engine::dmx::ElementBinding::GetElements() const { return m_elements; }
+size_t source_engine::dmx::ElementBinding::GetRecordCount() const { return m_elements.size(); }
+void source_engine::dmx::ElementBinding::Clear() { m_elements.clear(); }
+size_t source_engine::dmx::ElementBinding::AddRecord(const std::shared_ptr<Element> &el)
+{
+	EmplaceRecord();
+	m_elements.push_back(el);
+	return m_elements.size() - 1;
+}
+
+source_engine::dmx::Schema::LoadScope::LoadScope(Schema *schema) : m_schema {schema}
+{
+	if(m_schema && m_schema->m_inUse.exchange(true, std::memory_order_acquire))
+		throw std::logic_error {"Schema is already used by another load!"};
+}
+source_engine::dmx::Schema::LoadScope::~LoadScope()
+{
+	if(m_schema)
+		m_schema->m_inUse.store(false, std::memory_order_release);
+}
+
+void source_engine::dmx::Schema::AddBinding(std::unique_ptr<ElementBinding> &&binding)
+{
+	auto &elementType = binding->GetElementType();
+	if(m_bindings.find(elementType) != m_bindings.end())
+		throw std::invalid_argument {"Element type '" + elementType + "' is already bound!"};
+	m_bindings.insert(std::make_pair(elementType, std::move(binding)));
+}
+source_engine::dmx::ElementBinding *source_engine::dmx::Schema::FindBinding(const std::string &elementType) const
+{
+	auto it = m_bindings.find(elementType);
+	return (it != m_bindings.end()) ? it->second.get() : nullptr;
+}
+void source_engine::dmx::Schema::ClearRecords()
+{
+	for(auto &[type, binding] : m_bindings)
+		binding->Clear();
+}
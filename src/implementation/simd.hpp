@@ -0,0 +1,12 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef __UTIL_DMX_SIMD_HPP__
+#define __UTIL_DMX_SIMD_HPP__
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define UTIL_DMX_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
+#endif
@@ -0,0 +1,572 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "dmx_types.hpp"
+#include "temp_path.hpp"
+#include <sharedutils/util_ifile.hpp>
+#include <array>
+#include <cstring>
+#include <limits>
+#include <string_view>
+#include <unordered_map>
+#include <filesystem>
+#include <cstdio>
+#include "definitions.hpp"
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+module source_engine.dmx;
+
+namespace source_engine::dmx {
+	static constexpr std::array<char, 4> SNAPSHOT_MAGIC = {'D', 'M', 'X', 'C'};
+	static constexpr uint32_t SNAPSHOT_VERSION = 2;
+	static constexpr uint32_t SNAPSHOT_NULL_INDEX = std::numeric_limits<uint32_t>::max();
+	static constexpr uint32_t SNAPSHOT_EMPTY_REF_INDEX = SNAPSHOT_NULL_INDEX - 1;
+	static constexpr uint32_t SNAPSHOT_ATTRIBUTE_FLAG_NULL = 1u;
+
+	struct SnapshotHeader {
+		std::array<char, 4> magic;
+		uint32_t version;
+		uint64_t sourceHash;
+		uint32_t numStrings;
+		uint32_t numElements;
+		uint32_t numAttributes;
+		uint32_t reserved;
+		uint64_t stringOffsetsOffset; // numStrings +1 offsets into the string data
+		uint64_t stringDataOffset;
+		uint64_t elementsOffset;
+		uint64_t attributesOffset;
+		uint64_t payloadOffset;
+		uint64_t payloadSize;
+	};
+	struct SnapshotElement {
+		uint32_t type;
+		uint32_t name;
+		util::GUID GUID;
+		uint32_t firstAttribute;
+		uint32_t numAttributes;
+	};
+	struct SnapshotAttribute {
+		uint32_t name;
+		AttrType type;
+		uint32_t count; // Number of array items, or number of bytes for binary values
+		uint32_t flags;
+		uint64_t offset; // Offset into the payload
+	};
+	struct SnapshotBinary {
+		uint64_t offset;
+		uint64_t size;
+	};
+	static_assert(sizeof(SnapshotHeader) == 80 && sizeof(SnapshotElement) == 32 && sizeof(SnapshotAttribute) == 24);
+
+	class SnapshotWriter {
+	  public:
+		// The string has to stay valid until the snapshot has been finalized
+		uint32_t AddString(const std::string &str)
+		{
+			auto it = m_stringIndices.find(str);
+			if(it != m_stringIndices.end())
+				return it->second;
+			auto idx = static_cast<uint32_t>(m_strings.size());
+			m_strings.push_back(str);
+			m_stringIndices.insert(std::make_pair(std::string_view {str}, idx));
+			return idx;
+		}
+		uint64_t AllocatePayload(size_t size)
+		{
+			auto offset = (m_payload.size() + 7) & ~static_cast<size_t>(7);
+			m_payload.resize(offset + size);
+			return offset;
+		}
+		uint8_t *GetPayload(uint64_t offset) { return m_payload.data() + offset; }
+		void WriteAttribute(const Attribute &attr, SnapshotAttribute &outAttr, const std::unordered_map<const Element *, uint32_t> &elementIndices);
+		std::vector<uint8_t> Finalize(uint64_t sourceHash, const std::vector<SnapshotElement> &elements, const std::vector<SnapshotAttribute> &attributes);
+	  private:
+		template<typename T>
+		void WriteValue(const void *data, uint64_t outOffset, const std::unordered_map<const Element *, uint32_t> &elementIndices);
+
+		std::vector<std::string_view> m_strings;
+		std::unordered_map<std::string_view, uint32_t> m_stringIndices;
+		std::vector<uint8_t> m_payload;
+	};
+
+	template<typename T>
+	static constexpr size_t get_snapshot_value_size()
+	{
+		if constexpr(std::is_same_v<T, ElementRef> || std::is_same_v<T, String>)
+			return sizeof(uint32_t);
+		else if constexpr(std::is_same_v<T, Binary>)
+			return sizeof(SnapshotBinary);
+		else {
+			static_assert(std::is_trivially_copyable_v<T>);
+			return sizeof(T);
+		}
+	}
+
+	class SnapshotReader {
+	  public:
+		SnapshotReader(const uint8_t *data, size_t size) : m_data {data}, m_size {size} {}
+		bool Init(std::optional<uint64_t> sourceHash);
+		std::shared_ptr<FileData> Read();
+	  private:
+		template<typename T>
+		const T *GetArray(uint64_t offset, uint64_t count) const
+		{
+			if(count > m_size / sizeof(T) || offset > m_size - count * sizeof(T))
+				throw std::runtime_error {"Corrupt dmx snapshot!"};
+			return reinterpret_cast<const T *>(m_data + offset);
+		}
+		const uint8_t *GetPayload(uint64_t offset, uint64_t size) const
+		{
+			if(size > m_header.payloadSize || offset > m_header.payloadSize - size)
+				throw std::runtime_error {"Corrupt dmx snapshot!"};
+			return m_data + m_header.payloadOffset + offset;
+		}
+		std::string_view GetString(uint32_t idx) const
+		{
+			if(idx >= m_header.numStrings)
+				throw std::runtime_error {"Corrupt dmx snapshot!"};
+			return m_strings[idx];
+		}
+		template<typename T>
+		std::shared_ptr<void> ReadValue(const uint8_t *data, const std::vector<std::shared_ptr<Element>> &elements) const;
+		void ReadAttribute(const SnapshotAttribute &snapshotAttr, Attribute &outAttr, const std::vector<std::shared_ptr<Element>> &elements) const;
+
+		const uint8_t *m_data;
+		size_t m_size;
+		SnapshotHeader m_header {};
+		std::vector<std::string_view> m_strings;
+	};
+
+	class MappedFile {
+	  public:
+		MappedFile(const std::filesystem::path &path);
+		~MappedFile();
+		MappedFile(const MappedFile &) = delete;
+		MappedFile &operator=(const MappedFile &) = delete;
+		const uint8_t *GetData() const { return m_data; }
+		size_t GetSize() const { return m_size; }
+	  private:
+#ifdef _WIN32
+		HANDLE m_file = INVALID_HANDLE_VALUE;
+		HANDLE m_mapping = nullptr;
+#else
+		int m_fd = -1;
+#endif
+		const uint8_t *m_data = nullptr;
+		size_t m_size = 0;
+	};
+};
+
+template<typename T>
+void source_engine::dmx::SnapshotWriter::WriteValue(const void *data, uint64_t outOffset, const std::unordered_map<const Element *, uint32_t> &elementIndices)
+{
+	if constexpr(std::is_same_v<T, ElementRef>) {
+		auto idx = SNAPSHOT_NULL_INDEX;
+		if(data) {
+			idx = SNAPSHOT_EMPTY_REF_INDEX;
+			auto el = static_cast<const ElementRef *>(data)->lock();
+			if(el) {
+				auto it = elementIndices.find(el.get());
+				if(it != elementIndices.end())
+					idx = it->second;
+			}
+		}
+		memcpy(GetPayload(outOffset), &idx, sizeof(idx));
+	}
+	else if constexpr(std::is_same_v<T, String>) {
+		static const String emptyString {};
+		auto idx = AddString(data ? *static_cast<const String *>(data) : emptyString);
+		memcpy(GetPayload(outOffset), &idx, sizeof(idx));
+	}
+	else if constexpr(std::is_same_v<T, Binary>) {
+		SnapshotBinary bin {};
+		if(data) {
+			auto &v = *static_cast<const Binary *>(data);
+			bin.size = v.size();
+			bin.offset = AllocatePayload(v.size());
+			memcpy(GetPayload(bin.offset), v.data(), v.size());
+		}
+		memcpy(GetPayload(outOffset), &bin, sizeof(bin)); // Payload may have been reallocated, so the pointer has to be retrieved afterwards
+	}
+	else {
+		T v {};
+		if(data)
+			v = *static_cast<const T *>(data);
+		memcpy(GetPayload(outOffset), &v, sizeof(v));
+	}
+}
+
+void source_engine::dmx::SnapshotWriter::WriteAttribute(const Attribute &attr, SnapshotAttribute &outAttr, const std::unordered_map<const Element *, uint32_t> &elementIndices)
+{
+	outAttr.type = attr.type;
+	outAttr.count = 0;
+	outAttr.flags = 0;
+	outAttr.offset = 0;
+	if(is_array_type(attr.type)) {
+		if(attr.data == nullptr) {
+			outAttr.flags |= SNAPSHOT_ATTRIBUTE_FLAG_NULL;
+			return;
+		}
+		auto &values = *static_cast<const std::vector<std::shared_ptr<Attribute>> *>(attr.data.get());
+		outAttr.count = static_cast<uint32_t>(values.size());
+		visit_value_type(get_single_type(attr.type), [this, &values, &outAttr, &elementIndices](auto tag) {
+			using T = typename decltype(tag)::type;
+			constexpr auto valueSize = get_snapshot_value_size<T>();
+			outAttr.offset = AllocatePayload(values.size() * valueSize);
+			for(size_t i = 0; i < values.size(); ++i)
+				WriteValue<T>(values[i]->data.get(), outAttr.offset + i * valueSize, elementIndices);
+		});
+		return;
+	}
+	if(is_single_type(attr.type) == false)
+		return;
+	if(attr.data == nullptr)
+		outAttr.flags |= SNAPSHOT_ATTRIBUTE_FLAG_NULL;
+	visit_value_type(attr.type, [this, &attr, &outAttr, &elementIndices](auto tag) {
+		using T = typename decltype(tag)::type;
+		outAttr.count = 1;
+		outAttr.offset = AllocatePayload(get_snapshot_value_size<T>());
+		WriteValue<T>(attr.data.get(), outAttr.offset, elementIndices);
+	});
+}
+
+std::vector<uint8_t> source_engine::dmx::SnapshotWriter::Finalize(uint64_t sourceHash, const std::vector<SnapshotElement> &elements, const std::vector<SnapshotAttribute> &attributes)
+{
+	SnapshotHeader header {};
+	header.magic = SNAPSHOT_MAGIC;
+	header.version = SNAPSHOT_VERSION;
+	header.sourceHash = sourceHash;
+	header.numStrings = static_cast<uint32_t>(m_strings.size());
+	header.numElements = static_cast<uint32_t>(elements.size());
+	header.numAttributes = static_cast<uint32_t>(attributes.size());
+
+	size_t stringDataSize = 0;
+	for(auto &str : m_strings)
+		stringDataSize += str.size();
+	auto align = [](uint64_t offset) { return (offset + 7) & ~static_cast<uint64_t>(7); };
+	header.elementsOffset = sizeof(SnapshotHeader);
+	header.attributesOffset = align(header.elementsOffset + elements.size() * sizeof(SnapshotElement));
+	header.payloadOffset = align(header.attributesOffset + attributes.size() * sizeof(SnapshotAttribute));
+	header.payloadSize = m_payload.size();
+	header.stringOffsetsOffset = align(header.payloadOffset + header.payloadSize);
+	header.stringDataOffset = header.stringOffsetsOffset + (m_strings.size() + 1) * sizeof(uint64_t);
+
+	std::vector<uint8_t> data {};
+	data.resize(header.stringDataOffset + stringDataSize);
+	memcpy(data.data(), &header, sizeof(header));
+	if(elements.empty() == false)
+		memcpy(data.data() + header.elementsOffset, elements.data(), elements.size() * sizeof(SnapshotElement));
+	if(attributes.empty() == false)
+		memcpy(data.data() + header.attributesOffset, attributes.data(), attributes.size() * sizeof(SnapshotAttribute));
+	if(m_payload.empty() == false)
+		memcpy(data.data() + header.payloadOffset, m_payload.data(), m_payload.size());
+	uint64_t offset = 0;
+	auto *offsets = data.data() + header.stringOffsetsOffset;
+	for(size_t i = 0; i < m_strings.size(); ++i) {
+		memcpy(offsets + i * sizeof(uint64_t), &offset, sizeof(offset));
+		memcpy(data.data() + header.stringDataOffset + offset, m_strings[i].data(), m_strings[i].size());
+		offset += m_strings[i].size();
+	}
+	memcpy(offsets + m_strings.size() * sizeof(uint64_t), &offset, sizeof(offset));
+	return data;
+}
+
+bool source_engine::dmx::SnapshotReader::Init(std::optional<uint64_t> sourceHash)
+{
+	if(m_size < sizeof(SnapshotHeader))
+		return false;
+	memcpy(&m_header, m_data, sizeof(m_header));
+	if(m_header.magic != SNAPSHOT_MAGIC || m_header.version != SNAPSHOT_VERSION)
+		return false;
+	if(sourceHash.has_value() && *sourceHash != m_header.sourceHash)
+		return false;
+	GetArray<uint8_t>(m_header.payloadOffset, m_header.payloadSize);
+	auto *offsets = GetArray<uint64_t>(m_header.stringOffsetsOffset, static_cast<uint64_t>(m_header.numStrings) + 1);
+	auto stringDataSize = m_size - std::min<uint64_t>(m_size, m_header.stringDataOffset);
+	auto *stringData = GetArray<char>(m_header.stringDataOffset, stringDataSize);
+	m_strings.reserve(m_header.numStrings);
+	for(uint32_t i = 0; i < m_header.numStrings; ++i) {
+		if(offsets[i] > offsets[i + 1] || offsets[i + 1] > stringDataSize)
+			throw std::runtime_error {"Corrupt dmx snapshot!"};
+		m_strings.push_back(std::string_view {stringData + offsets[i], offsets[i + 1] - offsets[i]});
+	}
+	return true;
+}
+
+template<typename T>
+std::shared_ptr<void> source_engine::dmx::SnapshotReader::ReadValue(const uint8_t *data, const std::vector<std::shared_ptr<Element>> &elements) const
+{
+	if constexpr(std::is_same_v<T, ElementRef>) {
+		uint32_t idx;
+		memcpy(&idx, data, sizeof(idx));
+		if(idx == SNAPSHOT_NULL_INDEX)
+			return nullptr;
+		auto ref = std::make_shared<ElementRef>();
+		if(idx != SNAPSHOT_EMPTY_REF_INDEX) {
+			if(idx >= elements.size())
+				throw std::runtime_error {"Corrupt dmx snapshot!"};
+			*ref = elements[idx];
+		}
+		return ref;
+	}
+	else if constexpr(std::is_same_v<T, String>) {
+		uint32_t idx;
+		memcpy(&idx, data, sizeof(idx));
+		return std::make_shared<String>(GetString(idx));
+	}
+	else if constexpr(std::is_same_v<T, Binary>) {
+		SnapshotBinary bin;
+		memcpy(&bin, data, sizeof(bin));
+		auto *bytes = GetPayload(bin.offset, bin.size);
+		return std::make_shared<Binary>(bytes, bytes + bin.size);
+	}
+	else {
+		auto v = std::make_shared<T>();
+		memcpy(v.get(), data, sizeof(T));
+		return v;
+	}
+}
+
+void source_engine::dmx::SnapshotReader::ReadAttribute(const SnapshotAttribute &snapshotAttr, Attribute &outAttr, const std::vector<std::shared_ptr<Element>> &elements) const
+{
+	outAttr.type = snapshotAttr.type;
+	if((snapshotAttr.flags & SNAPSHOT_ATTRIBUTE_FLAG_NULL) != 0 && is_single_type(snapshotAttr.type) == false)
+		return;
+	if(is_array_type(snapshotAttr.type)) {
+		auto values = std::make_shared<std::vector<std::shared_ptr<Attribute>>>();
+		auto singleType = get_single_type(snapshotAttr.type);
+		visit_value_type(singleType, [this, &snapshotAttr, &values, singleType, &elements](auto tag) {
+			using T = typename decltype(tag)::type;
+			constexpr auto valueSize = get_snapshot_value_size<T>();
+			auto *data = GetPayload(snapshotAttr.offset, static_cast<uint64_t>(snapshotAttr.count) * valueSize);
+			values->reserve(snapshotAttr.count);
+			for(uint32_t i = 0; i < snapshotAttr.count; ++i) {
+				auto attr = std::make_shared<Attribute>();
+				attr->type = singleType;
+				attr->data = ReadValue<T>(data + i * valueSize, elements);
+				values->push_back(attr);
+			}
+		});
+		outAttr.data = values;
+		return;
+	}
+	if(is_single_type(snapshotAttr.type) == false)
+		return;
+	outAttr.data = visit_value_type(snapshotAttr.type, [this, &snapshotAttr, &elements](auto tag) -> std::shared_ptr<void> {
+		using T = typename decltype(tag)::type;
+		auto *data = GetPayload(snapshotAttr.offset, get_snapshot_value_size<T>());
+		if((snapshotAttr.flags & SNAPSHOT_ATTRIBUTE_FLAG_NULL) != 0)
+			return nullptr;
+		return ReadValue<T>(data, elements);
+	});
+}
+
+std::shared_ptr<source_engine::dmx::FileData> source_engine::dmx::SnapshotReader::Read()
+{
+	auto *snapshotElements = GetArray<SnapshotElement>(m_header.elementsOffset, m_header.numElements);
+	auto *snapshotAttributes = GetArray<SnapshotAttribute>(m_header.attributesOffset, m_header.numAttributes);
+
+	std::vector<std::shared_ptr<Element>> elements {};
+	elements.reserve(m_header.numElements);
+	for(uint32_t i = 0; i < m_header.numElements; ++i) {
+		auto &snapshotEl = snapshotElements[i];
+		auto el = std::make_shared<Element>();
+		el->type = GetString(snapshotEl.type);
+		el->name = GetString(snapshotEl.name);
+		el->GUID = snapshotEl.GUID;
+		elements.push_back(el);
+	}
+	for(uint32_t i = 0; i < m_header.numElements; ++i) {
+		auto &snapshotEl = snapshotElements[i];
+		if(snapshotEl.numAttributes > m_header.numAttributes || snapshotEl.firstAttribute > m_header.numAttributes - snapshotEl.numAttributes)
+			throw std::runtime_error {"Corrupt dmx snapshot!"};
+		auto &el = *elements[i];
+		el.attributes.reserve(snapshotEl.numAttributes);
+		for(uint32_t j = 0; j < snapshotEl.numAttributes; ++j) {
+			auto &snapshotAttr = snapshotAttributes[snapshotEl.firstAttribute + j];
+			auto attr = std::make_shared<Attribute>();
+			ReadAttribute(snapshotAttr, *attr, elements);
+			el.attributes[std::string {GetString(snapshotAttr.name)}] = attr;
+		}
+	}
+	return FileData::Create(std::move(elements));
+}
+
+#ifdef _WIN32
+source_engine::dmx::MappedFile::MappedFile(const std::filesystem::path &path)
+{
+	m_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if(m_file == INVALID_HANDLE_VALUE)
+		return;
+	LARGE_INTEGER size;
+	if(GetFileSizeEx(m_file, &size) == FALSE || size.QuadPart == 0)
+		return;
+	m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if(m_mapping == nullptr)
+		return;
+	m_data = static_cast<const uint8_t *>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+	if(m_data)
+		m_size = static_cast<size_t>(size.QuadPart);
+}
+source_engine::dmx::MappedFile::~MappedFile()
+{
+	if(m_data)
+		UnmapViewOfFile(m_data);
+	if(m_mapping)
+		CloseHandle(m_mapping);
+	if(m_file != INVALID_HANDLE_VALUE)
+		CloseHandle(m_file);
+}
+#else
+source_engine::dmx::MappedFile::MappedFile(const std::filesystem::path &path)
+{
+	m_fd = open(path.c_str(), O_RDONLY);
+	if(m_fd == -1)
+		return;
+	struct stat st;
+	if(fstat(m_fd, &st) != 0 || st.st_size == 0)
+		return;
+	auto *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+	if(data == MAP_FAILED)
+		return;
+	m_data = static_cast<const uint8_t *>(data);
+	m_size = st.st_size;
+}
+source_engine::dmx::MappedFile::~MappedFile()
+{
+	if(m_data)
+		munmap(const_cast<uint8_t *>(m_data), m_size);
+	if(m_fd != -1)
+		close(m_fd);
+}
+#endif
+
+std::vector<uint8_t> source_engine::dmx::FileData::CreateSnapshot(uint64_t sourceHash) const
+{
+	std::unordered_map<const Element *, uint32_t> elementIndices {};
+	elementIndices.reserve(m_elements.size());
+	for(size_t i = 0; i < m_elements.size(); ++i)
+		elementIndices.insert(std::make_pair(m_elements[i].get(), static_cast<uint32_t>(i)));
+
+	SnapshotWriter writer {};
+	std::vector<SnapshotElement> elements {};
+	std::vector<SnapshotAttribute> attributes {};
+	elements.reserve(m_elements.size());
+	for(auto &el : m_elements) {
+		SnapshotElement snapshotEl {};
+		snapshotEl.type = writer.AddString(el->type);
+		snapshotEl.name = writer.AddString(el->name);
+		snapshotEl.GUID = el->GUID;
+		snapshotEl.firstAttribute = static_cast<uint32_t>(attributes.size());
+		snapshotEl.numAttributes = static_cast<uint32_t>(el->attributes.size());
+		for(auto &pair : el->attributes) {
+			SnapshotAttribute snapshotAttr {};
+			snapshotAttr.name = writer.AddString(pair.first);
+			writer.WriteAttribute(*pair.second, snapshotAttr, elementIndices);
+			attributes.push_back(snapshotAttr);
+		}
+		elements.push_back(snapshotEl);
+	}
+	return writer.Finalize(sourceHash, elements, attributes);
+}
+
+std::shared_ptr<source_engine::dmx::FileData> source_engine::dmx::FileData::LoadSnapshot(const void *data, size_t size, std::optional<uint64_t> sourceHash)
+{
+	SnapshotReader reader {static_cast<const uint8_t *>(data), size};
+	if(reader.Init(sourceHash) == false)
+		return nullptr;
+	return reader.Read();
+}
+
+uint64_t source_engine::dmx::compute_content_hash(const void *data, size_t size)
+{
+	constexpr uint64_t prime0 = 0x9E3779B185EBCA87ull;
+	constexpr uint64_t prime1 = 0xC2B2AE3D27D4EB4Full;
+	auto rotl = [](uint64_t v, int r) { return (v << r) | (v >> (64 - r)); };
+	auto round = [&rotl](uint64_t acc, uint64_t v) { return rotl(acc + v * prime1, 31) * prime0; };
+	auto *p = static_cast<const uint8_t *>(data);
+	auto *end = p + size;
+	std::array<uint64_t, 4> lanes = {prime0 + prime1, prime1, 0, 0 - prime0};
+	while(end - p >= 32) {
+		for(auto &lane : lanes) {
+			uint64_t v;
+			memcpy(&v, p, sizeof(v));
+			lane = round(lane, v);
+			p += sizeof(v);
+		}
+	}
+	uint64_t h = size;
+	for(auto lane : lanes)
+		h = round(h, lane);
+	while(end - p >= 8) {
+		uint64_t v;
+		memcpy(&v, p, sizeof(v));
+		h = round(h, v);
+		p += sizeof(v);
+	}
+	while(p < end)
+		h = rotl(h ^ (*(p++) * prime0), 11) * prime1;
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDull;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+source_engine::dmx::LoadCache::LoadCache(const std::string &cacheDirectory) : m_cacheDirectory {cacheDirectory} {}
+const std::string &source_engine::dmx::LoadCache::GetCacheDirectory() const { return m_cacheDirectory; }
+std::shared_ptr<source_engine::dmx::FileData> source_engine::dmx::LoadCache::Load(const std::shared_ptr<ufile::IFile> &f)
+{
+	auto startPos = f->Tell();
+	std::vector<uint8_t> sourceData {};
+	constexpr size_t chunkSize = 256 * 1'024;
+	for(;;) {
+		auto offset = sourceData.size();
+		sourceData.resize(offset + chunkSize);
+		auto numRead = f->Read(sourceData.data() + offset, chunkSize);
+		sourceData.resize(offset + numRead);
+		if(numRead < chunkSize)
+			break;
+	}
+	auto hash = compute_content_hash(sourceData.data(), sourceData.size());
+	sourceData = {};
+
+	std::array<char, 17> hashStr {};
+	snprintf(hashStr.data(), hashStr.size(), "%016llx", static_cast<unsigned long long>(hash));
+	auto cachePath = std::filesystem::path {m_cacheDirectory} / (std::string {hashStr.data()} + ".dmxc");
+	{
+		MappedFile mappedFile {cachePath};
+		if(mappedFile.GetData()) {
+			try {
+				auto fd = FileData::LoadSnapshot(mappedFile.GetData(), mappedFile.GetSize(), hash);
+				if(fd)
+					return fd;
+			}
+			catch(const std::exception &) {
+				// Corrupt cache file, we'll just overwrite it
+			}
+		}
+	}
+
+	f->Seek(startPos);
+	auto fd = FileData::Load(f);
+	if(fd == nullptr)
+		return fd;
+	auto snapshot = fd->CreateSnapshot(hash);
+	std::error_code ec;
+	std::filesystem::create_directories(m_cacheDirectory, ec);
+	write_file_atomically(cachePath, snapshot.data(), snapshot.size()); // If the cache can't be written, the file is loaded again next time
+	return fd;
+}
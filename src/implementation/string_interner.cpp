@@ -0,0 +1,100 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "dmx_types.hpp"
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string_view>
+
+module source_engine.dmx;
+
+// Open-addressing hash table of entry pointers. Slots are only ever filled, never cleared, so readers
+// can probe a table without synchronization. Once a table gets too full it is replaced by a larger one,
+// the old table is kept alive until the interner is destroyed since readers may still be probing it.
+struct source_engine::dmx::StringInterner::Impl {
+	struct Entry {
+		size_t hash;
+		std::shared_ptr<const String> value;
+	};
+	struct Table {
+		Table(size_t capacity) : slots {std::make_unique<std::atomic<const Entry *>[]>(capacity)}, mask {capacity - 1} {}
+		std::unique_ptr<std::atomic<const Entry *>[]> slots;
+		size_t mask;
+	};
+	static size_t Hash(std::string_view str) { return std::hash<std::string_view> {}(str); }
+
+	const Entry *Find(const Table &table, std::string_view str, size_t hash) const
+	{
+		for(auto i = hash & table.mask;; i = (i + 1) & table.mask) {
+			auto *entry = table.slots[i].load(std::memory_order_acquire);
+			if(!entry)
+				return nullptr;
+			if(entry->hash == hash && *entry->value == str)
+				return entry;
+		}
+	}
+	static void Insert(Table &table, const Entry &entry)
+	{
+		auto i = entry.hash & table.mask;
+		while(table.slots[i].load(std::memory_order_relaxed))
+			i = (i + 1) & table.mask;
+		table.slots[i].store(&entry, std::memory_order_release);
+	}
+
+	std::atomic<Table *> table = nullptr;
+	std::atomic<size_t> size = 0;
+
+	// Only accessed while the mutex is locked
+	std::mutex mutex;
+	std::deque<Entry> entries;
+	std::vector<std::unique_ptr<Table>> tables;
+};
+
+source_engine::dmx::StringInterner::StringInterner(size_t initialCapacity) : m_impl {std::make_unique<Impl>()}
+{
+	size_t capacity = 16;
+	while(capacity < initialCapacity * 2)
+		capacity *= 2;
+	m_impl->tables.push_back(std::make_unique<Impl::Table>(capacity));
+	m_impl->table.store(m_impl->tables.back().get(), std::memory_order_release);
+}
+
+source_engine::dmx::StringInterner::~StringInterner() {}
+
+std::shared_ptr<const source_engine::dmx::String> source_engine::dmx::StringInterner::Find(std::string_view str) const
+{
+	auto *entry = m_impl->Find(*m_impl->table.load(std::memory_order_acquire), str, Impl::Hash(str));
+	return entry ? entry->value : nullptr;
+}
+
+std::shared_ptr<const source_engine::dmx::String> source_engine::dmx::StringInterner::Intern(std::string_view str)
+{
+	auto hash = Impl::Hash(str);
+	if(auto *entry = m_impl->Find(*m_impl->table.load(std::memory_order_acquire), str, hash))
+		return entry->value;
+
+	std::scoped_lock lock {m_impl->mutex};
+	auto *table = m_impl->table.load(std::memory_order_relaxed);
+	if(auto *entry = m_impl->Find(*table, str, hash)) // Another thread may have inserted the string in the meantime
+		return entry->value;
+	auto &entry = m_impl->entries.emplace_back(Impl::Entry {hash, std::make_shared<const String>(str)});
+	auto size = m_impl->size.load(std::memory_order_relaxed) + 1;
+	auto capacity = table->mask + 1;
+	if(size * 2 > capacity) {
+		// Keep the load factor below 50% so that probe sequences stay short
+		auto newTable = std::make_unique<Impl::Table>(capacity * 2);
+		for(auto &e : m_impl->entries)
+			Impl::Insert(*newTable, e);
+		m_impl->table.store(newTable.get(), std::memory_order_release);
+		m_impl->tables.push_back(std::move(newTable));
+	}
+	else
+		Impl::Insert(*table, entry);
+	m_impl->size.store(size, std::memory_order_release);
+	return entry.value;
+}
+
+size_t source_engine::dmx::StringInterner::GetSize() const { return m_impl->size.load(std::memory_order_acquire); }
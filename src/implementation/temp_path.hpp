@@ -0,0 +1,59 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef __UTIL_DMX_TEMP_PATH_HPP__
+#define __UTIL_DMX_TEMP_PATH_HPP__
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <system_error>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace source_engine::dmx {
+	// Path of a temporary file next to path, which is unique across threads and processes
+	inline std::filesystem::path get_temporary_path(const std::filesystem::path &path)
+	{
+#ifdef _WIN32
+		auto pid = static_cast<uint64_t>(_getpid());
+#else
+		auto pid = static_cast<uint64_t>(getpid());
+#endif
+		thread_local std::mt19937_64 rng {std::random_device {}()};
+		auto tmpPath = path;
+		tmpPath += "." + std::to_string(pid) + "." + std::to_string(rng()) + ".tmp";
+		return tmpPath;
+	}
+	// Writes to a temporary file first and then renames it, so that concurrent readers never see a partially written file.
+	// Returns false if the file couldn't be written, in which case the temporary file is removed again.
+	inline bool write_file_atomically(const std::filesystem::path &path, const void *data, size_t size)
+	{
+		std::error_code ec;
+		auto tmpPath = get_temporary_path(path);
+		{
+			std::ofstream out {tmpPath, std::ios::binary | std::ios::trunc};
+			if(!out)
+				return false;
+			out.write(static_cast<const char *>(data), size);
+			if(!out) {
+				out.close();
+				std::filesystem::remove(tmpPath, ec);
+				return false;
+			}
+		}
+		std::filesystem::rename(tmpPath, path, ec);
+		if(ec) {
+			std::filesystem::remove(tmpPath, ec);
+			return false;
+		}
+		return true;
+	}
+};
+
+#endif
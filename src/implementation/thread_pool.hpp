@@ -0,0 +1,205 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef __UTIL_DMX_THREAD_POOL_HPP__
+#define __UTIL_DMX_THREAD_POOL_HPP__
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace source_engine::dmx {
+	// Work-stealing thread pool. Every worker has its own task queue; tasks pushed from a worker thread
+	// go to that worker's queue, tasks pushed from other threads are distributed round-robin. Idle workers
+	// steal from the front of other workers' queues.
+	class ThreadPool {
+	  public:
+		static ThreadPool &GetDefault()
+		{
+			static ThreadPool pool {std::max(std::thread::hardware_concurrency(), 1u)};
+			return pool;
+		}
+		ThreadPool(uint32_t numThreads)
+		{
+			numThreads = std::max(numThreads, 1u);
+			m_queues.reserve(numThreads);
+			for(auto i = 0u; i < numThreads; ++i)
+				m_queues.push_back(std::make_unique<Queue>());
+			m_threads.reserve(numThreads);
+			for(auto i = 0u; i < numThreads; ++i)
+				m_threads.emplace_back([this, i]() { Run(i); });
+		}
+		~ThreadPool()
+		{
+			{
+				std::scoped_lock lock {m_mutex};
+				m_running = false;
+			}
+			m_condition.notify_all();
+			for(auto &t : m_threads)
+				t.join();
+		}
+		ThreadPool(const ThreadPool &) = delete;
+		ThreadPool &operator=(const ThreadPool &) = delete;
+		uint32_t GetThreadCount() const { return static_cast<uint32_t>(m_threads.size()); }
+		void Push(std::function<void()> task)
+		{
+			auto &worker = GetCurrentWorker();
+			auto queueIdx = (worker.pool == this) ? worker.index : (m_nextQueue.fetch_add(1, std::memory_order_relaxed) % m_queues.size());
+			m_pendingTasks.fetch_add(1, std::memory_order_release);
+			{
+				auto &queue = *m_queues[queueIdx];
+				std::scoped_lock lock {queue.mutex};
+				queue.tasks.push_back(std::move(task));
+			}
+			{
+				std::scoped_lock lock {m_mutex};
+			}
+			m_condition.notify_one();
+		}
+	  private:
+		struct Queue {
+			std::mutex mutex;
+			std::deque<std::function<void()>> tasks;
+		};
+		struct WorkerInfo {
+			ThreadPool *pool = nullptr;
+			size_t index = 0;
+		};
+		static WorkerInfo &GetCurrentWorker()
+		{
+			static thread_local WorkerInfo info {};
+			return info;
+		}
+		std::optional<std::function<void()>> Pop(size_t queueIdx)
+		{
+			// Own queue is processed LIFO, which keeps recently pushed (and likely still cached) work local
+			{
+				auto &queue = *m_queues[queueIdx];
+				std::scoped_lock lock {queue.mutex};
+				if(!queue.tasks.empty()) {
+					auto task = std::move(queue.tasks.back());
+					queue.tasks.pop_back();
+					return task;
+				}
+			}
+			for(size_t i = 1; i < m_queues.size(); ++i) {
+				auto &queue = *m_queues[(queueIdx + i) % m_queues.size()];
+				std::scoped_lock lock {queue.mutex};
+				if(!queue.tasks.empty()) {
+					auto task = std::move(queue.tasks.front());
+					queue.tasks.pop_front();
+					return task;
+				}
+			}
+			return {};
+		}
+		void Run(size_t queueIdx)
+		{
+			GetCurrentWorker() = {this, queueIdx};
+			for(;;) {
+				if(auto task = Pop(queueIdx)) {
+					m_pendingTasks.fetch_sub(1, std::memory_order_relaxed);
+					(*task)();
+					continue;
+				}
+				std::unique_lock lock {m_mutex};
+				m_condition.wait(lock, [this]() { return !m_running || m_pendingTasks.load(std::memory_order_acquire) > 0; });
+				if(!m_running && m_pendingTasks.load(std::memory_order_acquire) <= 0)
+					return;
+			}
+		}
+		std::vector<std::unique_ptr<Queue>> m_queues;
+		std::vector<std::thread> m_threads;
+		std::atomic<size_t> m_nextQueue = 0;
+		std::atomic<int64_t> m_pendingTasks = 0;
+		std::mutex m_mutex;
+		std::condition_variable m_condition;
+		bool m_running = true;
+	};
+
+	// Runs task(0) .. task(numTasks - 1) on the calling thread and on up to numHelpers tasks pushed to the executor, or the
+	// default pool if there is no executor, and returns once all of them have finished. Indices are claimed one at a time by
+	// whichever thread gets to them first, so the calling thread completes the work by itself if no helper ever runs, e.g. if
+	// it is a worker of a single-threaded pool. Helpers that run late find nothing left to claim. If tasks throw, the first
+	// exception is rethrown once all tasks have finished.
+	inline void run_parallel(size_t numTasks, size_t numHelpers, const std::function<void(size_t)> &task, const std::function<void(std::function<void()>)> &executor = nullptr)
+	{
+		if(numTasks == 0)
+			return;
+		struct State {
+			const std::function<void(size_t)> *task = nullptr;
+			size_t numTasks = 0;
+			std::atomic<size_t> next = 0;
+			std::atomic<size_t> finished = 0;
+			std::mutex errorMutex;
+			std::exception_ptr error = nullptr;
+		};
+		// Helpers may outlive this call, so everything they access before claiming an index is owned by them
+		auto state = std::make_shared<State>();
+		state->task = &task;
+		state->numTasks = numTasks;
+		auto work = [state]() {
+			for(auto i = state->next++; i < state->numTasks; i = state->next++) {
+				try {
+					(*state->task)(i);
+				}
+				catch(...) {
+					std::scoped_lock lock {state->errorMutex};
+					if(!state->error)
+						state->error = std::current_exception();
+				}
+				if(++state->finished == state->numTasks)
+					state->finished.notify_all();
+			}
+		};
+		numHelpers = std::min(numHelpers, numTasks - 1);
+		for(size_t i = 0; i < numHelpers; ++i) {
+			if(executor)
+				executor(work);
+			else
+				ThreadPool::GetDefault().Push(work);
+		}
+		work();
+		// All indices have been claimed at this point; The ones still running on other threads are being executed, not queued
+		for(auto n = state->finished.load(); n < numTasks; n = state->finished.load())
+			state->finished.wait(n);
+		if(state->error)
+			std::rethrow_exception(state->error);
+	}
+
+	// Number of threads available on the executor, or the default pool if there is no executor
+	inline size_t get_thread_count(const std::function<void(std::function<void()>)> &executor)
+	{
+		return executor ? std::max(std::thread::hardware_concurrency(), 1u) : ThreadPool::GetDefault().GetThreadCount();
+	}
+
+	// Runs task(0) .. task(numItems - 1) in parallel and returns the number of tasks that have returned true. Items are handed
+	// out one at a time, for work items whose sizes vary a lot.
+	inline size_t run_parallel_count(size_t numItems, const std::function<bool(size_t)> &task, const std::function<void(std::function<void()>)> &executor = nullptr)
+	{
+		if(numItems == 0)
+			return 0;
+		auto numTasks = std::min(numItems, get_thread_count(executor));
+		std::atomic<size_t> numSucceeded = 0;
+		run_parallel(
+		  numItems, numTasks - 1,
+		  [&task, &numSucceeded](size_t i) {
+			  if(task(i))
+				  ++numSucceeded;
+		  },
+		  executor);
+		return numSucceeded;
+	}
+};
+
+#endif
@@ -9,6 +9,8 @@ module;
 #include <vector>
 #include <optional>
 #include <sstream>
+#include <functional>
+#include <unordered_map>
 #include <fsys/filesystem.h>
 #include "definitions.hpp"
 
@@ -17,9 +19,17 @@ export module source_engine.dmx:keyvalues2;
 export namespace source_engine::dmx {
 	class KeyValues2 {
 	  public:
-		enum class Result { Success, SyntaxError, InvalidFormat };
+		enum class Result { Success, SyntaxError, InvalidFormat, Cancelled };
 		struct Array;
-		static Result Load(const std::shared_ptr<ufile::IFile> &f, std::shared_ptr<Array> &outArray);
+		// Values of attributes that are filtered out, and of elements whose type is filtered out, are skipped without
+		// allocating. Nested elements are always kept and filtered by their own type, as are element ids and names.
+		struct Filter {
+			std::function<bool(const std::string &)> isElementTypeIncluded = nullptr;
+			std::function<bool(const std::string &)> isAttributeIncluded = nullptr;
+		};
+		// topLevelItemCallback is called after each top-level item has been read; Returning false cancels the load.
+		// If specified, stringBuffer is used as scratch space for reading strings and keeps its capacity between loads.
+		static Result Load(const std::shared_ptr<ufile::IFile> &f, std::shared_ptr<Array> &outArray, const std::function<bool()> &topLevelItemCallback = nullptr, std::string *stringBuffer = nullptr, const Filter *filter = nullptr);
 		struct BaseElement {
 			enum class Type : uint32_t { Invalid = 0, String, ElementItem, Element, ArrayItem, Array };
 			void ToString(std::stringstream &outStream);
@@ -28,6 +38,7 @@ export namespace source_engine::dmx {
 		};
 		struct StringValue : public BaseElement {
 			StringValue(const std::string &value);
+			StringValue(std::string &&value);
 			virtual void ToString(std::stringstream &outStream, const std::string &t) override;
 			virtual Type GetType() const override;
 
@@ -62,21 +73,27 @@ export namespace source_engine::dmx {
 
 		uint32_t GetErrorLine() const;
 	  private:
-		KeyValues2(const std::shared_ptr<ufile::IFile> &f);
+		KeyValues2(const std::shared_ptr<ufile::IFile> &f, const std::function<bool()> &topLevelItemCallback, std::string &stringBuffer, const Filter *filter);
 		Result Read(std::shared_ptr<Array> &outArray);
 		constexpr bool IsWhitespace(char c) const;
 		constexpr bool IsControlCharacter(char c) const;
 		char ReadChar();
 		std::optional<char> ReadToken(bool includeWhitespace = false);
-		std::optional<std::string> ReadString();
+		bool ReadStringToBuffer();
 		bool ReadUntil(char c);
 		bool ReadUntilAfter(char c);
 
-		Result ReadArrayItem(Array &a);
-		Result ReadArrayBody(Array &a, bool root = false);
-		Result ReadElementItem(Element &e);
-		Result ReadElementBody(Element &e);
+		Result ReadArrayItem(Array &a, bool skipStrings);
+		Result ReadArrayBody(Array &a, bool root = false, bool skipStrings = false);
+		Result ReadElementItem(Element &e, bool included);
+		Result ReadElementBody(Element &e, bool included);
+		bool IsElementTypeIncluded(const std::string &type) const;
+		bool IsAttributeIncluded(const std::string &name) const;
 		std::shared_ptr<ufile::IFile> m_file;
+		std::function<bool()> m_topLevelItemCallback;
+		std::string &m_stringBuffer;
+		std::string m_nameBuffer; // Name of the element item that is being read
+		const Filter *m_filter = nullptr;
 		uint32_t m_curLine = 0;
 	};
 };
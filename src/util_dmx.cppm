@@ -4,12 +4,24 @@
 module;
 
 #include <memory>
+#include <atomic>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <array>
+#include <optional>
+#include <type_traits>
+#include <stdexcept>
+#include <functional>
+#include <future>
+#include <stop_token>
+#include <exception>
 #include <sstream>
+#include <span>
+#include <ranges>
 #include <unordered_map>
 #include <unordered_set>
+#include <set>
 #include "dmx_types.hpp"
 #include "definitions.hpp"
 
@@ -62,21 +74,54 @@ export namespace source_engine::dmx {
 	};
 
 	struct Element;
+	struct Attribute;
 	using ElementRef = std::weak_ptr<Element>;
 	using ElementRefArray = std::vector<ElementRef>;
+	struct ConstItem {
+		const Attribute *operator()(const std::shared_ptr<Attribute> &item) const { return item.get(); }
+	};
+	// Items of an array that can only be read
+	using ConstArrayView = std::ranges::transform_view<std::ranges::ref_view<const std::vector<std::shared_ptr<Attribute>>>, ConstItem>;
 	struct Attribute : public std::enable_shared_from_this<Attribute> {
 		AttrType type = AttrType::Invalid;
+	  private:
+		bool m_readOnly = false; // Set for the attributes of snapshots
+	  public:
 		std::shared_ptr<void> data = nullptr;
 
+		Attribute() = default;
+		// Copies the type, the value block and whether the array index is enabled; Indices aren't copied
+		Attribute(const Attribute &other);
+		Attribute &operator=(const Attribute &other);
+		~Attribute();
+
+		// Elements have to be renamed with Element::SetName, otherwise InvalidateNameIndex has to be called
 		std::shared_ptr<Element> Get(const std::string &name) const;
+		// All elements with the name, in array order
+		std::vector<std::shared_ptr<Element>> GetAll(const std::string &name) const;
+		// All elements whose name starts with the prefix, ordered by name
+		std::vector<std::shared_ptr<Element>> FindByPrefix(std::string_view prefix) const;
+		void InvalidateNameIndex();
 		std::string DataToString() const;
 		void DebugPrint(std::stringstream &ss);
 		void DebugPrint(std::stringstream &ss, std::unordered_set<void *> &iteratedObjects, const std::string &t0 = "", const std::string &t = "");
 
+		// Attributes of snapshots are read-only (see FileData::Snapshot)
+		bool IsReadOnly() const;
+
+		// The non-const getters copy the value block first if it is shared
 		template<typename T>
 		T *GetValue(AttrType type)
 		{
-			return (this->type == type) ? static_cast<T *>(data.get()) : nullptr;
+			if(this->type != type)
+				return nullptr;
+			MakeValueUnique();
+			return static_cast<T *>(data.get());
+		}
+		template<typename T>
+		const T *GetValue(AttrType type) const
+		{
+			return (this->type == type) ? static_cast<const T *>(data.get()) : nullptr;
 		}
 		ElementRef *GetElement();
 		Int *GetInt();
@@ -85,6 +130,7 @@ export namespace source_engine::dmx {
 		String *GetString();
 		Binary *GetBinary();
 		Time *GetTime();
+		ObjectId *GetObjectId();
 		Color *GetColor();
 		Vector2 *GetVector2();
 		Vector3 *GetVector3();
@@ -94,11 +140,100 @@ export namespace source_engine::dmx {
 		Matrix *GetMatrix();
 		UInt64 *GetUInt64();
 		UInt8 *GetUInt8();
+		const ElementRef *GetElement() const;
+		const Int *GetInt() const;
+		const Float *GetFloat() const;
+		const Bool *GetBoolean() const;
+		const String *GetString() const;
+		const Binary *GetBinary() const;
+		const Time *GetTime() const;
+		const ObjectId *GetObjectId() const;
+		const Color *GetColor() const;
+		const Vector2 *GetVector2() const;
+		const Vector3 *GetVector3() const;
+		const Vector4 *GetVector4() const;
+		const Angle *GetAngle() const;
+		const Quaternion *GetQuaternion() const;
+		const Matrix *GetMatrix() const;
+		const UInt64 *GetUInt64() const;
+		const UInt8 *GetUInt8() const;
+		// The non-const versions copy the array first if it is shared; The items are shared with the copy
 		std::vector<std::shared_ptr<dmx::Attribute>> *GetArray();
 		std::vector<std::shared_ptr<dmx::Attribute>> *GetArray(AttrType type);
+		std::optional<ConstArrayView> GetArray() const;
+		std::optional<ConstArrayView> GetArray(AttrType type) const;
+		// Same as the non-const GetArray
+		std::vector<std::shared_ptr<dmx::Attribute>> *GetMutableArray();
+
+		// Replaces the value block; Snapshots sharing the previous block are unaffected
+		template<typename T>
+		void SetValue(AttrType type, T &&value)
+		{
+			CheckWritable();
+			this->type = type;
+			data = std::make_shared<std::decay_t<T>>(std::forward<T>(value));
+			InvalidateIndices();
+		}
+		void SetArrayValue(uint32_t idx, dmx::Attribute &attr);
 		void RemoveArrayValue(uint32_t idx);
 		void RemoveArrayValue(dmx::Attribute &attr);
 		void AddArrayValue(dmx::Attribute &attr);
+		// Appends all values that aren't in the array yet, in a single pass
+		void AddArrayValues(const std::vector<std::shared_ptr<dmx::Attribute>> &values);
+		// Removes all given values in a single pass
+		void RemoveArrayValues(const std::vector<const dmx::Attribute *> &values);
+		// The array is only copied if at least one value matches
+		void RemoveArrayValuesIf(const std::function<bool(const dmx::Attribute &)> &predicate);
+		bool HasArrayValue(const dmx::Attribute &attr);
+
+		// Makes HasArrayValue, AddArrayValue and RemoveArrayValue constant-time
+		void SetArrayIndexEnabled(bool enabled);
+		bool IsArrayIndexEnabled() const;
+		// Approximate memory held by the indices
+		uint64_t GetIndexMemoryUsage() const;
+	  private:
+		struct NameHash {
+			using is_transparent = void;
+			size_t operator()(std::string_view str) const { return std::hash<std::string_view> {}(str); }
+		};
+		struct NameIndex {
+			const void *array = nullptr; // Array the index has been built for
+			// Rename counters of the array elements when the index was built
+			std::vector<std::pair<std::shared_ptr<const std::atomic<uint64_t>>, uint64_t>> renameCounts;
+			size_t numItems = 0;
+			std::atomic<bool> checkItems = false; // Set by MarkArrayChanged
+			std::unordered_map<std::string, std::vector<const Attribute *>, NameHash, std::equal_to<>> items; // Array items by element name, in array order
+			std::set<std::string_view> names; // Keys of items, sorted for prefix lookups
+		};
+		// Allocated on first use
+		struct Indices {
+			bool arrayIndexEnabled = false;
+			const void *positionsArray = nullptr; // nullptr if the membership index is out of date
+			std::unordered_map<const Attribute *, uint32_t> positions;
+			// Read without a lock
+			std::atomic<std::shared_ptr<NameIndex>> nameIndex;
+		};
+		friend class FileData;
+		friend class SnapshotBuilder;
+		void CheckWritable() const;
+		void MakeValueUnique();
+		Indices *GetIndices() const;
+		Indices &GetOrCreateIndices() const;
+		void InvalidateIndices();
+		// Keeps the name index, which is compared with the array on its next use
+		void MarkArrayChanged();
+		void ResetNameIndex(); // Only called from non-const functions
+		const std::vector<std::shared_ptr<dmx::Attribute>> *GetArrayData() const;
+		// Unlike GetArray, this keeps the indices up to date
+		std::vector<std::shared_ptr<dmx::Attribute>> *MakeArrayUnique();
+		std::unordered_map<const Attribute *, uint32_t> *GetArrayIndex();
+		bool IsNameIndexValid(const NameIndex &index) const;
+		bool NameIndexMatchesArray(const NameIndex &index) const;
+		// Returns nullptr if there is no index or it is out of date
+		NameIndex *GetValidNameIndex();
+		template<typename TFunc>
+		bool LookUpName(const TFunc &func) const;
+		mutable std::atomic<Indices *> m_indices = nullptr;
 	};
 	struct Element : public std::enable_shared_from_this<Element> {
 		std::string type;
@@ -108,27 +243,549 @@ export namespace source_engine::dmx {
 		std::unordered_map<std::string, std::weak_ptr<Element>> nameToChildElement;
 
 		std::string GetGUIDAsString() const;
-		std::shared_ptr<Element> Get(const std::string &name) const;
-		std::shared_ptr<Attribute> GetAttr(const std::string &name) const;
+		// Elements of snapshots are read-only
+		bool IsReadOnly() const;
+		void SetName(std::string name);
+		std::shared_ptr<Element> Get(const std::string &name);
+		std::shared_ptr<const Element> Get(const std::string &name) const;
+		std::shared_ptr<Attribute> GetAttr(const std::string &name);
+		std::shared_ptr<const Attribute> GetAttr(const std::string &name) const;
+		void UpdateChildElementLookupTable();
 		void DebugPrint(std::stringstream &ss);
 		void DebugPrint(std::stringstream &ss, std::unordered_set<void *> &iteratedObjects, const std::string &t = "");
+	  private:
+		friend class FileData;
+		friend class SnapshotBuilder;
+		friend struct Attribute;
+		// Incremented by SetName; Shared by the elements of a file data object
+		const std::shared_ptr<std::atomic<uint64_t>> &GetRenameCount() const;
+		std::shared_ptr<std::atomic<uint64_t>> m_renameCount = nullptr;
+		bool m_readOnly = false;
+	};
+	struct AttributeDiff {
+		enum class Change : uint8_t { Added = 0, Removed, Changed };
+		std::string name;
+		Change change = Change::Changed;
+		std::shared_ptr<Attribute> value = nullptr; // New value, nullptr if the attribute was removed
+	};
+	struct ElementDiff {
+		util::GUID GUID;
+		std::optional<std::string> type {};
+		std::optional<std::string> name {};
+		std::vector<AttributeDiff> attributes;
+	};
+	struct FileDataDiff {
+		std::vector<std::shared_ptr<Element>> addedElements; // Elements of the new file data
+		std::vector<util::GUID> removedElements;
+		std::vector<ElementDiff> changedElements;
+		bool IsEmpty() const;
+	};
+	struct HeaderInfo {
+		static constexpr size_t MAX_NAME_LENGTH = 31;
+		std::array<char, MAX_NAME_LENGTH + 1> encoding {};
+		uint32_t encodingVersion = 0;
+		std::array<char, MAX_NAME_LENGTH + 1> format {}; // Empty if the header has no format
+		uint32_t formatVersion = 0;
+		uint32_t headerSize = 0; // Number of bytes up to and including the closing '-->'
+
+		std::string_view GetEncoding() const { return encoding.data(); }
+		std::string_view GetFormat() const { return format.data(); }
+		bool IsBinary() const { return GetEncoding() == "binary"; }
+		bool IsKeyValues2() const { return GetEncoding() == "keyvalues2"; }
+	};
+	struct LoadProgress {
+		uint64_t bytesProcessed = 0;
+		uint64_t bytesTotal = 0;
+		uint32_t elementsProcessed = 0;
+		uint32_t elementsTotal = 0;
+	};
+	// Thread-safe string pool that can be shared between loads
+	class StringInterner {
+	  public:
+		StringInterner(size_t initialCapacity = 1'024);
+		~StringInterner();
+		StringInterner(const StringInterner &) = delete;
+		StringInterner &operator=(const StringInterner &) = delete;
+		// The returned string is shared with all other users of the interner
+		std::shared_ptr<const String> Intern(std::string_view str);
+		std::shared_ptr<const String> Find(std::string_view str) const;
+		size_t GetSize() const;
+	  private:
+		struct Impl;
+		std::unique_ptr<Impl> m_impl;
+	};
+	// Elements whose type is filtered out are loaded without their attributes
+	struct LoadFilter {
+		std::unordered_set<std::string> includeElementTypes; // If not empty, only elements of these types are loaded
+		std::unordered_set<std::string> excludeElementTypes;
+		std::unordered_set<std::string> includeAttributes; // If not empty, only these attributes are loaded
+		std::unordered_set<std::string> excludeAttributes;
+
+		bool IsEmpty() const;
+		bool IsElementTypeIncluded(const std::string &type) const;
+		bool IsAttributeIncluded(const std::string &name) const;
+	};
+	// Attribute type of a value type, or of a std::vector of a value type; AttrType::Invalid if there is none
+	template<typename T>
+	constexpr AttrType get_attr_type()
+	{
+		if constexpr(std::is_same_v<T, ElementRef>)
+			return AttrType::Element;
+		else if constexpr(std::is_same_v<T, Int>)
+			return AttrType::Int;
+		else if constexpr(std::is_same_v<T, Float>)
+			return AttrType::Float;
+		else if constexpr(std::is_same_v<T, Bool>)
+			return AttrType::Bool;
+		else if constexpr(std::is_same_v<T, String>)
+			return AttrType::String;
+		else if constexpr(std::is_same_v<T, Binary>)
+			return AttrType::Binary;
+		else if constexpr(std::is_same_v<T, Time>)
+			return AttrType::Time;
+		else if constexpr(std::is_same_v<T, ObjectId>)
+			return AttrType::ObjectId;
+		else if constexpr(std::is_same_v<T, Color>)
+			return AttrType::Color;
+		else if constexpr(std::is_same_v<T, Vector2>)
+			return AttrType::Vector2;
+		else if constexpr(std::is_same_v<T, Vector3>)
+			return AttrType::Vector3;
+		else if constexpr(std::is_same_v<T, Vector4>)
+			return AttrType::Vector4;
+		else if constexpr(std::is_same_v<T, Angle>)
+			return AttrType::Angle;
+		else if constexpr(std::is_same_v<T, Quaternion>)
+			return AttrType::Quaternion;
+		else if constexpr(std::is_same_v<T, Matrix>)
+			return AttrType::Matrix;
+		else if constexpr(std::is_same_v<T, UInt64>)
+			return AttrType::UInt64;
+		else if constexpr(std::is_same_v<T, UInt8>)
+			return AttrType::UInt8;
+		else if constexpr(requires {
+			                  typename T::value_type;
+			                  requires std::is_same_v<T, std::vector<typename T::value_type>>;
+		                  }) {
+			// Array types follow the same order as the single types; There are no UInt64 and UInt8 arrays
+			constexpr auto singleType = get_attr_type<typename T::value_type>();
+			if constexpr(singleType < AttrType::SingleFirst || singleType > AttrType::Matrix)
+				return AttrType::Invalid;
+			else
+				return static_cast<AttrType>(static_cast<uint32_t>(AttrType::ArrayFirst) + (static_cast<uint32_t>(singleType) - static_cast<uint32_t>(AttrType::SingleFirst)));
+		}
+		else
+			return AttrType::Invalid;
+	}
+	// A struct member that is decoded from the attribute with the specified name
+	template<typename TStruct, typename TValue>
+	struct FieldBinding {
+		static constexpr AttrType type = get_attr_type<TValue>();
+		static_assert(type != AttrType::Invalid, "Member type has no dmx attribute type!");
+		static_assert(type != AttrType::Element && type != AttrType::ElementArray, "Element references can't be bound, they remain attributes of the element!");
+		std::string_view name;
+		TValue TStruct::*member;
+	};
+	template<typename TStruct, typename TValue>
+	constexpr FieldBinding<TStruct, TValue> bind_field(std::string_view name, TValue TStruct::*member)
+	{
+		return {name, member};
+	}
+	// Same as above, but also checks the member type against the expected attribute type
+	template<AttrType TType, typename TStruct, typename TValue>
+	constexpr FieldBinding<TStruct, TValue> bind_field(std::string_view name, TValue TStruct::*member)
+	{
+		static_assert(get_attr_type<TValue>() == TType, "Member type doesn't match the attribute type!");
+		return {name, member};
+	}
+	// Decodes the attributes of all elements of a type into records
+	class ElementBinding {
+	  public:
+		struct Field {
+			std::string name;
+			AttrType type = AttrType::Invalid;
+			// Returns the member of a record
+			std::function<void *(void *)> getMember;
+		};
+		virtual ~ElementBinding() = default;
+		const std::string &GetElementType() const;
+		const std::vector<Field> &GetFields() const;
+		const Field *FindField(const std::string &name) const;
+		// Elements the records have been decoded from, in record order
+		const std::vector<std::shared_ptr<Element>> &GetElements() const;
+		size_t GetRecordCount() const;
+		virtual void Clear();
+
+		// Used by the loaders; Returns the index of the new default-constructed record
+		size_t AddRecord(const std::shared_ptr<Element> &el);
+		// Records may move when new ones are added
+		virtual void *GetRecord(size_t idx) = 0;
+	  protected:
+		ElementBinding(std::string elementType, std::vector<Field> &&fields);
+		virtual void EmplaceRecord() = 0;
+	  private:
+		std::string m_elementType;
+		std::vector<Field> m_fields;
+		std::vector<std::shared_ptr<Element>> m_elements;
+	};
+	template<typename TStruct>
+	class TypedElementBinding : public ElementBinding {
+	  public:
+		static_assert(std::is_default_constructible_v<TStruct>, "Records have to be default-constructible!");
+		template<typename... TValues>
+		TypedElementBinding(std::string elementType, const FieldBinding<TStruct, TValues> &...fields)
+		    : ElementBinding {std::move(elementType), {Field {std::string {fields.name}, fields.type, [member = fields.member](void *record) -> void * { return &(static_cast<TStruct *>(record)->*member); }}...}}
+		{
+		}
+		// Members of attributes an element doesn't have keep their default value
+		const std::vector<TStruct> &GetRecords() const { return m_records; }
+		std::vector<TStruct> &GetRecords() { return m_records; }
+		virtual void Clear() override
+		{
+			ElementBinding::Clear();
+			m_records.clear();
+		}
+		virtual void *GetRecord(size_t idx) override { return &m_records[idx]; }
+	  protected:
+		virtual void EmplaceRecord() override { m_records.emplace_back(); }
+	  private:
+		std::vector<TStruct> m_records;
+	};
+	// Bindings of element types to structs; The records of consecutive loads are appended
+	class Schema {
+	  public:
+		// Throws std::logic_error if another load is already using the schema
+		class LoadScope {
+		  public:
+			LoadScope(Schema *schema);
+			~LoadScope();
+			LoadScope(const LoadScope &) = delete;
+			LoadScope &operator=(const LoadScope &) = delete;
+		  private:
+			Schema *m_schema = nullptr;
+		};
+		// Throws std::invalid_argument if the element type is already bound or a field name is used twice
+		template<typename TStruct, typename... TValues>
+		TypedElementBinding<TStruct> &Bind(std::string elementType, const FieldBinding<TStruct, TValues> &...fields)
+		{
+			auto binding = std::make_unique<TypedElementBinding<TStruct>>(std::move(elementType), fields...);
+			auto &result = *binding;
+			AddBinding(std::move(binding));
+			return result;
+		}
+		ElementBinding *FindBinding(const std::string &elementType) const;
+		// Removes the records of all bindings
+		void ClearRecords();
+	  private:
+		void AddBinding(std::unique_ptr<ElementBinding> &&binding);
+		std::unordered_map<std::string, std::unique_ptr<ElementBinding>> m_bindings;
+		std::atomic<bool> m_inUse = false;
+	};
+	struct LoadOptions {
+		std::function<void(const LoadProgress &)> progressCallback = nullptr;
+		std::stop_token stopToken {};
+		std::shared_ptr<StringInterner> stringInterner = nullptr;
+		LoadFilter filter {};
+		// Validates all counts, lengths and indices of binary files in a separate pass before decoding
+		bool validateBinary = false;
+		std::shared_ptr<Schema> schema = nullptr;
 	};
+	// Approximate heap memory, not including the bookkeeping of the allocator
+	struct MemoryUsage {
+		uint64_t payload = 0; // Values other than strings
+		uint64_t strings = 0;
+		uint64_t overhead = 0; // Element and attribute objects, control blocks, maps and array storage
+		uint64_t lookupTables = 0; // nameToChildElement and the indices of arrays
+
+		uint64_t GetTotal() const;
+		MemoryUsage &operator+=(const MemoryUsage &other);
+	};
+	struct MemoryUsageReport {
+		MemoryUsage total {};
+		std::unordered_map<std::string, MemoryUsage> elementTypes;
+		std::array<MemoryUsage, static_cast<size_t>(AttrType::ArrayLast) + 1> attributeTypes {};
+	};
+	enum class Encoding : uint8_t { Binary = 0, KeyValues2 };
+	struct SaveOptions {
+		// Binary files are written as version 5, KeyValues2 files as version 1
+		Encoding encoding = Encoding::Binary;
+		std::string format = "dmx";
+		uint32_t formatVersion = 1;
+	};
+	using Executor = std::function<void(std::function<void()>)>;
+	class LoaderContext;
+	class ElementIndex;
 	class FileData {
 	  public:
 		static std::shared_ptr<FileData> Load(const std::shared_ptr<ufile::IFile> &f);
+		// Returns nullptr if the load was cancelled
+		static std::shared_ptr<FileData> Load(const std::shared_ptr<ufile::IFile> &f, const LoadOptions &options);
+		static std::shared_ptr<FileData> Load(const std::shared_ptr<ufile::IFile> &f, const LoadOptions &options, LoaderContext &context);
+		// Uses the internal thread pool if no executor was specified
+		static std::future<std::shared_ptr<FileData>> LoadAsync(const std::shared_ptr<ufile::IFile> &f, LoadOptions options = {}, const Executor &executor = nullptr);
+		// Parses the dmx header at the current file position; The file position is restored
+		static std::optional<HeaderInfo> Probe(const std::shared_ptr<ufile::IFile> &f);
+		static std::optional<HeaderInfo> Probe(const void *data, size_t size);
+		// The first element is the root element
+		static std::shared_ptr<FileData> Create(std::vector<std::shared_ptr<Element>> &&elements);
+		// Elements are matched by their GUID; Elements with an all-zero GUID are ignored
+		static FileDataDiff Diff(const FileData &oldData, const FileData &newData);
+		// Returns nullptr if the snapshot is incompatible or was created from a different source
+		static std::shared_ptr<FileData> LoadSnapshot(const void *data, size_t size, std::optional<uint64_t> sourceHash = {});
+		// Decodes only the elements with the specified GUIDs and the elements they reference
+		static std::shared_ptr<FileData> LoadElements(const std::shared_ptr<ufile::IFile> &f, const ElementIndex &index, const std::vector<util::GUID> &guids, const LoadOptions &options = {});
 
 		const std::vector<std::shared_ptr<Element>> &GetElements() const;
 		const std::shared_ptr<Attribute> &GetRootAttribute() const;
 		void DebugPrint(std::stringstream &ss);
+
+		// Includes referenced elements that aren't part of the element list
+		void Save(ufile::IFile &f, const SaveOptions &options = {}) const;
+		// Shared attributes and values are counted once
+		MemoryUsageReport GetMemoryUsage() const;
+
+		// Existing Element and Attribute objects are updated rather than replaced
+		void ApplyPatch(const FileDataDiff &diff);
+
+		// Position-independent snapshot that can be restored with LoadSnapshot
+		std::vector<uint8_t> CreateSnapshot(uint64_t sourceHash) const;
+
+		// Elements that can't be reached from the root element
+		std::vector<std::shared_ptr<Element>> FindUnreachableElements() const;
+		// Removes unreachable elements and stores the remaining ones in depth-first order; Returns the removed elements
+		std::vector<std::shared_ptr<Element>> Compact();
+
+		// Read-only copy that shares the value blocks until either side changes them
+		std::shared_ptr<const FileData> Snapshot() const;
 	  private:
 		FileData() = default;
-		static std::shared_ptr<FileData> CreateFromKeyValues2Data(const void *kv2Data);
+		static std::shared_ptr<FileData> CreateFromKeyValues2Data(const void *kv2Data, const LoadOptions &options, LoaderContext &context);
 		void UpdateRootElement();
 		void UpdateChildElementLookupTables();
+		void AdoptElement(Element &el) const;
 
 		std::shared_ptr<Attribute> m_rootAttribute = nullptr;
 		std::vector<std::shared_ptr<Element>> m_elements = {};
+		std::shared_ptr<std::atomic<uint64_t>> m_renameCount = std::make_shared<std::atomic<uint64_t>>(0);
+	};
+	// Scratch buffers that are reused by consecutive loads
+	class LoaderContext {
+	  public:
+		LoaderContext() = default;
+		LoaderContext(const LoaderContext &) = delete;
+		LoaderContext &operator=(const LoaderContext &) = delete;
+		// Releases all memory held by the context
+		void Clear();
+	  private:
+		friend FileData;
+		std::vector<std::string> m_dictionary;
+		std::vector<std::shared_ptr<const String>> m_internedDictionary;
+		std::vector<int32_t> m_timeTicks;
+		std::vector<float> m_quaternionComponents;
+		std::vector<Quaternion> m_quaternions;
+		std::vector<uint8_t> m_readBuffer;
+		std::string m_kv2StringBuffer;
+		std::unordered_map<std::string, ElementRef> m_kv2IdToElement;
+		std::vector<std::pair<std::shared_ptr<ElementRef>, std::string>> m_kv2RefsToUpdate;
+	};
+	// Offsets of the element headers and bodies of a binary dmx file (see FileData::LoadElements)
+	class ElementIndex {
+	  public:
+		struct Entry {
+			util::GUID GUID;
+			uint32_t type; // String index
+			uint32_t name; // String index
+			uint64_t headerOffset;
+			uint64_t bodyOffset;
+		};
+		// The file has to be positioned at the start of a binary dmx file
+		static ElementIndex Build(const std::shared_ptr<ufile::IFile> &f);
+		// Rebuilds the sidecar index if the size or modification time of the dmx file has changed
+		static ElementIndex LoadOrBuild(const std::string &dmxPath, const std::shared_ptr<ufile::IFile> &f);
+		static std::string GetSidecarPath(const std::string &dmxPath);
+		// Returns an empty optional if the data is not a compatible index
+		static std::optional<ElementIndex> Deserialize(const void *data, size_t size);
+
+		std::vector<uint8_t> Serialize() const;
+		const std::vector<Entry> &GetEntries() const;
+		const std::string &GetString(uint32_t idx) const;
+		std::optional<uint32_t> FindEntry(const util::GUID &guid) const;
+
+		const std::string &GetEncoding() const;
+		uint32_t GetEncodingVersion() const;
+		const std::vector<uint64_t> &GetDictionaryStringOffsets() const;
+		uint64_t GetSourceSize() const;
+		int64_t GetSourceModificationTime() const;
+	  private:
+		ElementIndex() = default;
+		void UpdateLookupTable();
+
+		std::string m_encoding;
+		uint32_t m_encodingVersion = 0;
+		uint64_t m_sourceSize = 0;
+		// Only set for sidecar indices
+		uint64_t m_sourceFileSize = 0;
+		int64_t m_sourceModificationTime = 0;
+		std::vector<std::string> m_strings;
+		std::vector<uint64_t> m_dictionaryStringOffsets;
+		std::vector<Entry> m_entries;
+		std::vector<uint32_t> m_sortedEntries; // Entry indices sorted by GUID
+	};
+	// Loads multiple files concurrently; All files loaded by the same batch loader share one string interner
+	class BatchLoader {
+	  public:
+		using FileOpener = std::function<std::shared_ptr<ufile::IFile>(size_t)>;
+		// Called from a worker thread; fileData is nullptr if the load has failed or was cancelled
+		using FileCallback = std::function<void(size_t fileIndex, const std::shared_ptr<FileData> &fileData, std::exception_ptr error)>;
+		BatchLoader(std::shared_ptr<StringInterner> stringInterner = nullptr);
+		// Files are opened lazily on the worker threads; Throws std::invalid_argument if a schema is set
+		std::vector<std::shared_ptr<FileData>> Load(size_t numFiles, const FileOpener &openFile, const FileCallback &onFileLoaded = nullptr, const LoadOptions &options = {});
+		std::vector<std::shared_ptr<FileData>> Load(const std::vector<std::shared_ptr<ufile::IFile>> &files, const FileCallback &onFileLoaded = nullptr, const LoadOptions &options = {});
+		const std::shared_ptr<StringInterner> &GetStringInterner() const;
+	  private:
+		std::shared_ptr<StringInterner> m_stringInterner;
+	};
+	// A log layer of a DmeChannel (DmeChannel -> log -> layers)
+	struct AnimationLayer {
+		std::shared_ptr<Element> channel;
+		std::shared_ptr<Element> log;
+		std::shared_ptr<Element> layer;
+		AttrType valueType = AttrType::Invalid; // Single type of the layer's values
+		size_t numSamples = 0;
+	};
+	// Extracts the times and values of animation log layers into caller-provided structure-of-arrays buffers
+	class AnimationExtractor {
+	  public:
+		struct Buffers {
+			Time *times = nullptr; // Room for numSamples times
+			float *seconds = nullptr; // Optional, room for numSamples times converted to seconds
+			void *values = nullptr; // Room for numSamples * GetValueSize(valueType) bytes
+		};
+		// Only keeps the elements and attributes needed for extraction
+		static LoadFilter GetLoadFilter();
+		// Size of a single value in the output buffer, or 0 if the type can't be extracted
+		static size_t GetValueSize(AttrType valueType);
+
+		AnimationExtractor(const FileData &fileData);
+		const std::vector<AnimationLayer> &GetLayers() const;
+		// Returns false if the layer's values can't be extracted
+		bool Extract(size_t layerIndex, const Buffers &buffers) const;
+		// buffers[i] belongs to GetLayers()[i]; Returns the number of layers that have been extracted
+		size_t ExtractAll(const std::vector<Buffers> &buffers, const Executor &executor = nullptr) const;
+	  private:
+		std::vector<AnimationLayer> m_layers;
+	};
+	// A DmeMesh and the DmeVertexData of its bind state
+	struct MeshVertexData {
+		std::shared_ptr<Element> mesh;
+		std::shared_ptr<Element> vertexData;
+		size_t numVertices = 0; // Length of the index streams
+		uint32_t jointCount = 0;
+	};
+	// Interleaves the vertex streams of DmeVertexData elements into caller-provided vertex buffers
+	class MeshExtractor {
+	  public:
+		static constexpr uint32_t MAX_COMPONENTS = 16;
+		// UNorm components are clamped to [0,1] and scaled to the full range of the integer type
+		enum class ComponentType : uint8_t { Float = 0, UInt8, UInt16, UInt32, UNorm8, UNorm16 };
+		struct VertexAttribute {
+			std::string stream; // e.g. "positions", "normals", "textureCoordinates", "jointWeights" or "jointIndices"
+			uint32_t offset = 0; // Byte offset within the vertex
+			ComponentType componentType = ComponentType::Float;
+			// Components the stream doesn't have are zero
+			uint32_t numComponents = 0;
+		};
+		struct VertexLayout {
+			std::vector<VertexAttribute> attributes;
+			uint32_t stride = 0;
+		};
+		// Only keeps the elements needed for extraction
+		static LoadFilter GetLoadFilter();
+		static size_t GetComponentSize(ComponentType type);
+
+		MeshExtractor(const FileData &fileData);
+		const std::vector<MeshVertexData> &GetMeshes() const;
+		// outVertices needs room for numVertices * layout.stride bytes; Throws std::invalid_argument if the layout is invalid
+		bool Extract(size_t meshIndex, const VertexLayout &layout, void *outVertices) const;
+		// outVertices[i] belongs to GetMeshes()[i]; Returns the number of meshes that have been extracted
+		size_t ExtractAll(const VertexLayout &layout, const std::vector<void *> &outVertices, const Executor &executor = nullptr) const;
+	  private:
+		bool ExtractVertices(const MeshVertexData &mesh, const VertexLayout &layout, uint8_t *outVertices) const;
+		std::vector<MeshVertexData> m_meshes;
+	};
+	// Every element is visited at most once
+	class ElementTraversal {
+	  public:
+		enum class Order : uint8_t { PreOrder = 0, PostOrder };
+		enum class Result : uint8_t {
+			Continue = 0,
+			SkipChildren, // Only has an effect for pre-order traversals
+			Stop
+		};
+		using Visitor = std::function<Result(Element &el, uint32_t depth)>;
+		using ParallelVisitor = std::function<void(Element &el, uint32_t depth)>;
+		ElementTraversal(const FileData &fileData);
+		ElementTraversal(const std::vector<std::shared_ptr<Element>> &elements);
+
+		const std::vector<std::shared_ptr<Element>> &GetElements() const;
+		std::optional<uint32_t> FindIndex(const Element &el) const;
+		// Indices of all elements directly referenced by the element
+		std::span<const uint32_t> GetChildren(uint32_t index) const;
+
+		// Returns false if the visitor has stopped the traversal
+		bool Traverse(const Element &start, const Visitor &visitor, Order order = Order::PreOrder) const;
+		// Traverses from every element that hasn't been reached yet, in element order
+		bool TraverseAll(const Visitor &visitor, Order order = Order::PreOrder) const;
+		// The elements of a level are visited concurrently, so the visitor must be thread-safe
+		void TraverseParallel(const Element &start, const ParallelVisitor &visitor, const Executor &executor = nullptr) const;
+	  private:
+		bool Traverse(uint32_t start, const Visitor &visitor, Order order, std::vector<uint64_t> &visited) const;
+
+		std::vector<std::shared_ptr<Element>> m_elements;
+		std::unordered_map<const Element *, uint32_t> m_indices;
+		std::vector<uint32_t> m_childOffsets; // Children of element i are m_children[m_childOffsets[i] .. m_childOffsets[i + 1])
+		std::vector<uint32_t> m_children;
+	};
+	struct JsonExportOptions {
+		enum class Format : uint8_t {
+			Json = 0, // {"elements": [...]}, the root element comes first
+			NdJson    // One element object per line
+		};
+		Format format = Format::Json;
+		// Unset to export full arrays
+		std::optional<size_t> maxArrayItems = 16;
+		// Size of the chunks passed to the sink
+		size_t bufferSize = 64 * 1'024;
+	};
+	// Called with consecutive chunks of the output
+	using JsonSink = std::function<void(std::string_view)>;
+	// Element references are written as GUID strings
+	void export_json(const FileData &fileData, const JsonSink &sink, const JsonExportOptions &options = {});
+
+	// Caches loaded file data as snapshots, keyed by the content hash of the source file
+	class LoadCache {
+	  public:
+		LoadCache(const std::string &cacheDirectory);
+		std::shared_ptr<FileData> Load(const std::shared_ptr<ufile::IFile> &f);
+		const std::string &GetCacheDirectory() const;
+	  private:
+		std::string m_cacheDirectory;
+	};
+
+	enum class Compression : uint8_t { None = 0, Zstd, Lz4 };
+	struct CompressionOptions {
+		Compression compression = Compression::Zstd;
+		std::optional<int> level {};
 	};
+	// Detects zstd and LZ4 frames; The file position is restored
+	Compression detect_compression(ufile::IFile &f);
+	// Whether the library has been built with support for the compression format
+	bool is_compression_supported(Compression compression);
+	// Decompressed on a background thread while it is being read; Returns f itself if it isn't compressed
+	std::shared_ptr<ufile::IFile> open_decompressed(const std::shared_ptr<ufile::IFile> &f, bool randomAccess = false);
+	// Compresses everything from the current position of in
+	void compress_dmx(ufile::IFile &in, ufile::IFile &out, const CompressionOptions &options = {});
+
 	std::string type_to_string(AttrType type);
 	bool is_single_type(AttrType type);
 	bool is_array_type(AttrType type);
@@ -137,5 +794,61 @@ export namespace source_engine::dmx {
 
 	Time get_time(const std::string &value);
 	Time get_time(int32_t value);
+	// Bulk conversion of times to seconds
+	void get_seconds(const Time *times, float *outSeconds, size_t count);
+	void get_seconds(const Time *times, double *outSeconds, size_t count);
 	Quat get_quaternion(const std::string &value);
+	// Converts between the component order of dmx files (x y z w) and the memory layout of Quaternion
+	void decode_quaternions(const float *xyzw, Quaternion *outQuats, size_t count);
+	void encode_quaternions(const Quaternion *quats, float *outXyzw, size_t count);
+	// Decodes hex text into bytes, whitespace between digits is ignored
+	bool decode_hex(std::string_view hex, Binary &outData);
+	// Characters that aren't hex digits are skipped
+	ObjectId parse_object_id(std::string_view str);
+	uint64_t compute_content_hash(const void *data, size_t size);
+
+	// Calls func with std::type_identity<T>, where T is the value type of the specified single type
+	template<typename TFunc>
+	decltype(auto) visit_value_type(AttrType type, TFunc &&func)
+	{
+		switch(type) {
+		case AttrType::Element:
+			return func(std::type_identity<ElementRef> {});
+		case AttrType::Int:
+			return func(std::type_identity<Int> {});
+		case AttrType::Float:
+			return func(std::type_identity<Float> {});
+		case AttrType::Bool:
+			return func(std::type_identity<Bool> {});
+		case AttrType::String:
+			return func(std::type_identity<String> {});
+		case AttrType::Binary:
+			return func(std::type_identity<Binary> {});
+		case AttrType::Time:
+			return func(std::type_identity<Time> {});
+		case AttrType::ObjectId:
+			return func(std::type_identity<ObjectId> {});
+		case AttrType::Color:
+			return func(std::type_identity<Color> {});
+		case AttrType::Vector2:
+			return func(std::type_identity<Vector2> {});
+		case AttrType::Vector3:
+			return func(std::type_identity<Vector3> {});
+		case AttrType::Vector4:
+			return func(std::type_identity<Vector4> {});
+		case AttrType::Angle:
+			return func(std::type_identity<Angle> {});
+		case AttrType::Quaternion:
+			return func(std::type_identity<Quaternion> {});
+		case AttrType::Matrix:
+			return func(std::type_identity<Matrix> {});
+		case AttrType::UInt64:
+			return func(std::type_identity<UInt64> {});
+		case AttrType::UInt8:
+			return func(std::type_identity<UInt8> {});
+		default:
+			break;
+		}
+		throw std::invalid_argument {"DMX type '" + type_to_string(type) + "' is not a value type!"};
+	}
 };
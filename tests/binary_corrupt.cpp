@@ -0,0 +1,120 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+// Loads truncated binary dmx files and files with corrupt counts, with and without the validation pass.
+// Corrupt counts have to be rejected instead of being allocated.
+
+#include <sharedutils/util_ifile.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <vector>
+
+import source_engine.dmx;
+
+namespace dmx = source_engine::dmx;
+
+static int g_numFailures = 0;
+static void check(bool condition, const char *description)
+{
+	if(condition)
+		return;
+	std::fprintf(stderr, "FAILED: %s\n", description);
+	++g_numFailures;
+}
+
+static constexpr int32_t INT_MARKER = 0x0BADF00D;
+static constexpr int32_t TIME_MARKER = 0x0C0FFEE0;
+
+static std::vector<uint8_t> create_file()
+{
+	auto root = std::make_shared<dmx::Element>();
+	root->type = "DmElement";
+	root->name = "root";
+	root->GUID = {1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+	auto ints = std::make_shared<dmx::Attribute>();
+	ints->type = dmx::AttrType::IntArray;
+	auto intItems = std::make_shared<std::vector<std::shared_ptr<dmx::Attribute>>>();
+	auto times = std::make_shared<dmx::Attribute>();
+	times->type = dmx::AttrType::TimeArray;
+	auto timeItems = std::make_shared<std::vector<std::shared_ptr<dmx::Attribute>>>();
+	for(int32_t i = 0; i < 4; ++i) {
+		auto item = std::make_shared<dmx::Attribute>();
+		item->SetValue(dmx::AttrType::Int, dmx::Int {INT_MARKER + i});
+		intItems->push_back(item);
+		auto timeItem = std::make_shared<dmx::Attribute>();
+		timeItem->SetValue(dmx::AttrType::Time, dmx::Time::FromTicks(TIME_MARKER + i));
+		timeItems->push_back(timeItem);
+	}
+	ints->data = intItems;
+	times->data = timeItems;
+	root->attributes["ints"] = ints;
+	root->attributes["times"] = times;
+	auto binary = std::make_shared<dmx::Attribute>();
+	binary->SetValue(dmx::AttrType::Binary, dmx::Binary {1, 2, 3, 4, 5, 6, 7, 8});
+	root->attributes["binary"] = binary;
+
+	auto f = std::make_shared<ufile::VectorFile>();
+	dmx::FileData::Create({root})->Save(*f);
+	return f->GetVector();
+}
+
+// Returns false if the load has thrown
+static bool try_load(std::vector<uint8_t> data, bool validate)
+{
+	dmx::LoadOptions options {};
+	options.validateBinary = validate;
+	try {
+		dmx::FileData::Load(std::make_shared<ufile::VectorFile>(std::move(data)), options);
+	}
+	catch(const std::exception &) {
+		return false;
+	}
+	return true;
+}
+
+// Replaces the count in front of the first occurrence of the marker
+static bool set_count_before(std::vector<uint8_t> &data, int32_t marker, int32_t count)
+{
+	auto *begin = reinterpret_cast<const uint8_t *>(&marker);
+	auto it = std::search(data.begin(), data.end(), begin, begin + sizeof(marker));
+	if(it == data.end() || it - data.begin() < static_cast<ptrdiff_t>(sizeof(count)))
+		return false;
+	std::memcpy(&*(it - sizeof(count)), &count, sizeof(count));
+	return true;
+}
+
+int main()
+{
+	auto data = create_file();
+	check(try_load(data, false), "intact file is loaded");
+	check(try_load(data, true), "intact file is loaded with validation");
+
+	// Truncated files may be rejected or loaded partially, but must not crash
+	for(size_t size = 0; size < data.size(); ++size) {
+		std::vector<uint8_t> truncated {data.begin(), data.begin() + size};
+		try_load(truncated, false);
+		try_load(truncated, true);
+	}
+
+	for(auto validate : {false, true}) {
+		for(auto count : {int32_t {0x7FFF'FFFF}, int32_t {-5}}) {
+			auto corrupt = data;
+			check(set_count_before(corrupt, INT_MARKER, count), "int array length is found");
+			check(!try_load(corrupt, validate), "int array with a corrupt length is rejected");
+
+			corrupt = data;
+			check(set_count_before(corrupt, TIME_MARKER, count), "time array length is found");
+			check(!try_load(corrupt, validate), "time array with a corrupt length is rejected");
+
+			corrupt = data;
+			int32_t binaryMarker = 0x04030201;
+			check(set_count_before(corrupt, binaryMarker, count), "binary length is found");
+			check(!try_load(corrupt, validate), "binary value with a corrupt length is rejected");
+		}
+	}
+	return (g_numFailures == 0) ? 0 : 1;
+}
@@ -0,0 +1,96 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+// Saves file data as binary dmx, converts it to KeyValues2 and back, and checks that nothing has changed on the way.
+// Strings contain quotes and backslashes, which KeyValues2 has to escape.
+
+#include <sharedutils/util_ifile.hpp>
+#include <array>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+import source_engine.dmx;
+
+namespace dmx = source_engine::dmx;
+
+static int g_numFailures = 0;
+static void check(bool condition, const char *description)
+{
+	if(condition)
+		return;
+	std::fprintf(stderr, "FAILED: %s\n", description);
+	++g_numFailures;
+}
+
+static std::shared_ptr<dmx::FileData> save_and_load(const dmx::FileData &fileData, dmx::Encoding encoding)
+{
+	auto f = std::make_shared<ufile::VectorFile>();
+	dmx::SaveOptions options {};
+	options.encoding = encoding;
+	fileData.Save(*f, options);
+	f->Seek(0);
+	return dmx::FileData::Load(f);
+}
+
+static std::shared_ptr<dmx::Attribute> make_string(std::string value)
+{
+	auto attr = std::make_shared<dmx::Attribute>();
+	attr->SetValue(dmx::AttrType::String, std::move(value));
+	return attr;
+}
+
+int main()
+{
+	const std::string path = R"(C:\models\"quoted"\file.mdl)";
+	const std::string name = R"(root "element" \ name\)";
+
+	auto child = std::make_shared<dmx::Element>();
+	child->type = "DmElement";
+	child->name = R"(child\)";
+	child->GUID = {2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+	child->attributes["text"] = make_string(R"(\"\\)");
+
+	auto root = std::make_shared<dmx::Element>();
+	root->type = "DmElement";
+	root->name = name;
+	root->GUID = {1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+	root->attributes["path"] = make_string(path);
+	root->attributes[R"(attribute "name")"] = make_string("\"");
+	auto count = std::make_shared<dmx::Attribute>();
+	count->SetValue(dmx::AttrType::Int, int32_t {42});
+	root->attributes["count"] = count;
+	auto ref = std::make_shared<dmx::Attribute>();
+	ref->SetValue(dmx::AttrType::Element, dmx::ElementRef {child});
+	root->attributes["child"] = ref;
+
+	auto original = dmx::FileData::Create({root, child});
+	auto binary = save_and_load(*original, dmx::Encoding::Binary);
+	check(binary != nullptr, "binary file data is loaded");
+	if(!binary)
+		return 1;
+	auto kv2 = save_and_load(*binary, dmx::Encoding::KeyValues2);
+	check(kv2 != nullptr, "KeyValues2 file data is loaded");
+	if(!kv2)
+		return 1;
+	auto binaryAgain = save_and_load(*kv2, dmx::Encoding::Binary);
+	check(binaryAgain != nullptr, "binary file data is loaded again");
+	if(!binaryAgain)
+		return 1;
+
+	check(dmx::FileData::Diff(*original, *binary).IsEmpty(), "binary round-trip preserves the file data");
+	check(dmx::FileData::Diff(*original, *kv2).IsEmpty(), "KeyValues2 round-trip preserves the file data");
+	check(dmx::FileData::Diff(*original, *binaryAgain).IsEmpty(), "KeyValues2 to binary round-trip preserves the file data");
+
+	auto &kv2Elements = kv2->GetElements();
+	check(kv2Elements.size() == 2, "KeyValues2 file data has both elements");
+	if(kv2Elements.empty() == false) {
+		const auto &kv2Root = *kv2Elements.front();
+		check(kv2Root.name == name, "element name with quotes and backslashes is preserved");
+		auto attr = kv2Root.GetAttr("path");
+		auto *str = attr ? attr->GetString() : nullptr;
+		check(str && *str == path, "string value with quotes and backslashes is preserved");
+	}
+	return (g_numFailures == 0) ? 0 : 1;
+}
@@ -0,0 +1,145 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+// Compares the bulk conversions, which have vectorized paths where SSE2 is available, with scalar reference implementations.
+// Sizes are chosen so that both the vectorized blocks and the scalar tails are covered.
+
+#include <mathutil/uquat.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <string>
+#include <vector>
+
+import source_engine.dmx;
+
+namespace dmx = source_engine::dmx;
+
+static int g_numFailures = 0;
+static void check(bool condition, const char *description)
+{
+	if(condition)
+		return;
+	std::fprintf(stderr, "FAILED: %s\n", description);
+	++g_numFailures;
+}
+
+static void test_seconds()
+{
+	std::vector<dmx::Time> times {};
+	for(int32_t ticks : {0, 1, -1, 3, 9'999, 10'000, -10'001, 123'456'789, std::numeric_limits<int32_t>::min(), std::numeric_limits<int32_t>::max()})
+		times.push_back(dmx::Time::FromTicks(ticks));
+	for(int32_t i = 0; i < 37; ++i)
+		times.push_back(dmx::Time::FromTicks(i * 7'919 - 100'000));
+	for(size_t count = 0; count <= times.size(); ++count) {
+		std::vector<float> seconds(count);
+		std::vector<double> secondsDouble(count);
+		dmx::get_seconds(times.data(), seconds.data(), count);
+		dmx::get_seconds(times.data(), secondsDouble.data(), count);
+		for(size_t i = 0; i < count; ++i) {
+			auto expected = times[i].GetSeconds();
+			auto expectedDouble = times[i].GetSecondsDouble();
+			check(std::memcmp(&seconds[i], &expected, sizeof(expected)) == 0, "float seconds match Time::GetSeconds");
+			check(std::memcmp(&secondsDouble[i], &expectedDouble, sizeof(expectedDouble)) == 0, "double seconds match Time::GetSecondsDouble");
+		}
+	}
+}
+
+// Byte by byte, whitespace between digits is skipped
+static std::optional<std::vector<uint8_t>> decode_hex_reference(const std::string &hex)
+{
+	auto getNibble = [](char c) -> int {
+		if(c >= '0' && c <= '9')
+			return c - '0';
+		if(c >= 'a' && c <= 'f')
+			return c - 'a' + 10;
+		if(c >= 'A' && c <= 'F')
+			return c - 'A' + 10;
+		return -1;
+	};
+	std::vector<uint8_t> data {};
+	int pending = -1;
+	for(auto c : hex) {
+		if(c == ' ' || c == '\t' || c == '\n' || c == '\r')
+			continue;
+		auto nibble = getNibble(c);
+		if(nibble < 0)
+			return {};
+		if(pending < 0)
+			pending = nibble;
+		else {
+			data.push_back(static_cast<uint8_t>((pending << 4) | nibble));
+			pending = -1;
+		}
+	}
+	if(pending >= 0)
+		return {};
+	return data;
+}
+
+static void check_hex(const std::string &hex)
+{
+	dmx::Binary data {};
+	auto expected = decode_hex_reference(hex);
+	auto result = dmx::decode_hex(hex, data);
+	check(result == expected.has_value(), "decode_hex accepts the same input as the reference");
+	if(result && expected)
+		check(data == *expected, "decode_hex output matches the reference");
+}
+
+static void test_hex()
+{
+	std::string digits {};
+	for(size_t i = 0; i < 200; ++i)
+		digits += "0123456789abcdefABCDEF"[(i * 7) % 22];
+	for(size_t len = 0; len <= 100; ++len) {
+		auto hex = digits.substr(0, len);
+		check_hex(hex);
+		// Line breaks and spaces at every position relative to the 32 character blocks
+		for(size_t pos = 0; pos <= len; pos += 5) {
+			check_hex(hex.substr(0, pos) + "\n\t" + hex.substr(pos));
+			check_hex(hex.substr(0, pos) + ' ' + hex.substr(pos));
+		}
+		// Invalid characters, including the ones just outside of the digit and letter ranges
+		for(auto c : {'g', 'G', '/', ':', '@', '`', '\0', '\x80', '\xff'}) {
+			for(size_t pos = 0; pos < len; pos += 11) {
+				auto invalid = hex;
+				invalid[pos] = c;
+				check_hex(invalid);
+			}
+		}
+	}
+}
+
+static void test_quaternions()
+{
+	std::vector<float> xyzw {};
+	for(size_t i = 0; i < 4 * 11; ++i)
+		xyzw.push_back(static_cast<float>(i) * 0.25f - 3.f);
+	for(size_t count = 0; count <= xyzw.size() / 4; ++count) {
+		std::vector<dmx::Quaternion> quats(count);
+		dmx::decode_quaternions(xyzw.data(), quats.data(), count);
+		auto matches = true;
+		for(size_t i = 0; i < count; ++i) {
+			auto *in = xyzw.data() + i * 4;
+			auto &q = quats[i];
+			matches = matches && q.x == in[0] && q.y == in[1] && q.z == in[2] && q.w == in[3];
+		}
+		check(matches, "decoded quaternions match the file components");
+
+		std::vector<float> encoded(count * 4);
+		dmx::encode_quaternions(quats.data(), encoded.data(), count);
+		check(std::equal(encoded.begin(), encoded.end(), xyzw.begin()), "encoded quaternions match the file components");
+	}
+}
+
+int main()
+{
+	test_seconds();
+	test_hex();
+	test_quaternions();
+	return (g_numFailures == 0) ? 0 : 1;
+}
@@ -0,0 +1,617 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+// Command-line tool for converting dmx files between the binary and KeyValues2 encodings and for printing statistics of
+// dmx files. Directories are searched recursively and files are processed in parallel.
+
+#include <sharedutils/util_ifile.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+import source_engine.dmx;
+
+namespace dmxtool {
+	namespace dmx = source_engine::dmx;
+	using Clock = std::chrono::steady_clock;
+
+	enum class Command : uint8_t { Convert = 0, Stat };
+
+	struct Options {
+		Command command = Command::Stat;
+		std::vector<std::filesystem::path> inputs;
+		std::optional<std::filesystem::path> outputDirectory {};
+		dmx::Encoding encoding = dmx::Encoding::Binary;
+		dmx::Compression compression = dmx::Compression::None;
+		uint32_t numJobs = 0;
+		bool csv = false;
+		bool verbose = false;
+	};
+
+	struct InputFile {
+		std::filesystem::path path;
+		std::filesystem::path relativePath; // Relative to the input directory, or the file name
+	};
+
+	// Array sizes are counted in power-of-two buckets: 0, 1, 2-3, 4-7, ...
+	static constexpr size_t NUM_ARRAY_SIZE_BUCKETS = 33;
+	static constexpr size_t NUM_ATTRIBUTE_TYPES = static_cast<size_t>(dmx::AttrType::ArrayLast) + 1;
+
+	struct Statistics {
+		size_t numElements = 0;
+		size_t numAttributes = 0;
+		size_t numArrayItems = 0;
+		size_t dictionarySize = 0;
+		size_t maxArraySize = 0;
+		uint64_t memoryUsage = 0;
+		dmx::MemoryUsage memory {};
+		std::map<std::string, size_t> elementTypes;
+		std::map<std::string, uint64_t> elementTypeMemory;
+		std::array<size_t, NUM_ATTRIBUTE_TYPES> attributeTypes {};
+		std::array<uint64_t, NUM_ATTRIBUTE_TYPES> attributeTypeMemory {};
+		std::array<size_t, NUM_ATTRIBUTE_TYPES> arrayItemTypes {};
+		std::array<size_t, NUM_ARRAY_SIZE_BUCKETS> arraySizes {};
+
+		void Merge(const Statistics &other)
+		{
+			numElements += other.numElements;
+			numAttributes += other.numAttributes;
+			numArrayItems += other.numArrayItems;
+			dictionarySize += other.dictionarySize;
+			maxArraySize = std::max(maxArraySize, other.maxArraySize);
+			memoryUsage += other.memoryUsage;
+			memory += other.memory;
+			for(auto &[type, count] : other.elementTypes)
+				elementTypes[type] += count;
+			for(auto &[type, size] : other.elementTypeMemory)
+				elementTypeMemory[type] += size;
+			for(size_t i = 0; i < NUM_ATTRIBUTE_TYPES; ++i) {
+				attributeTypes[i] += other.attributeTypes[i];
+				attributeTypeMemory[i] += other.attributeTypeMemory[i];
+				arrayItemTypes[i] += other.arrayItemTypes[i];
+			}
+			for(size_t i = 0; i < NUM_ARRAY_SIZE_BUCKETS; ++i)
+				arraySizes[i] += other.arraySizes[i];
+		}
+	};
+
+	// Durations in seconds
+	struct PhaseTimes {
+		double read = 0.0;
+		double load = 0.0;
+		double analyze = 0.0;
+		double save = 0.0;
+		double write = 0.0;
+
+		void Merge(const PhaseTimes &other)
+		{
+			read += other.read;
+			load += other.load;
+			analyze += other.analyze;
+			save += other.save;
+			write += other.write;
+		}
+	};
+
+	struct FileReport {
+		const InputFile *input = nullptr;
+		std::string error;
+		uint64_t fileSize = 0;
+		uint64_t outputSize = 0;
+		bool compressed = false;
+		std::string encoding;
+		uint32_t encodingVersion = 0;
+		std::string format;
+		uint32_t formatVersion = 0;
+		PhaseTimes times {};
+		Statistics statistics {};
+	};
+
+	static double get_seconds_since(Clock::time_point t) { return std::chrono::duration<double>(Clock::now() - t).count(); }
+
+	static size_t get_array_size_bucket(size_t size)
+	{
+		size_t bucket = 0;
+		while(size > 0 && bucket + 1 < NUM_ARRAY_SIZE_BUCKETS) {
+			size >>= 1;
+			++bucket;
+		}
+		return bucket;
+	}
+
+	static std::string get_array_size_bucket_name(size_t bucket)
+	{
+		if(bucket <= 1)
+			return std::to_string(bucket);
+		return std::to_string(size_t {1} << (bucket - 1)) + '-' + std::to_string((size_t {1} << bucket) - 1);
+	}
+
+	static std::string format_bytes(uint64_t bytes)
+	{
+		static constexpr std::array<const char *, 5> units = {"B", "KiB", "MiB", "GiB", "TiB"};
+		auto value = static_cast<double>(bytes);
+		size_t unit = 0;
+		while(value >= 1'024.0 && unit + 1 < units.size()) {
+			value /= 1'024.0;
+			++unit;
+		}
+		std::array<char, 32> buf;
+		std::snprintf(buf.data(), buf.size(), (unit == 0) ? "%.0f %s" : "%.2f %s", value, units[unit]);
+		return buf.data();
+	}
+
+	static std::string format_throughput(uint64_t bytes, double seconds)
+	{
+		if(seconds <= 0.0)
+			return "-";
+		return format_bytes(static_cast<uint64_t>(bytes / seconds)) + "/s";
+	}
+
+	static Statistics analyze(const dmx::FileData &fileData)
+	{
+		Statistics stats {};
+		dmx::ElementTraversal traversal {fileData};
+		auto &elements = traversal.GetElements();
+		stats.numElements = elements.size();
+		// Strings that a binary dictionary of the file data consists of
+		std::unordered_set<std::string_view> dictionary {};
+		for(auto &el : elements) {
+			++stats.elementTypes[el->type];
+			dictionary.insert(el->type);
+			dictionary.insert(el->name);
+			for(auto &[name, attr] : el->attributes) {
+				dictionary.insert(name);
+				++stats.numAttributes;
+				auto typeIdx = static_cast<size_t>(attr->type);
+				if(typeIdx >= NUM_ATTRIBUTE_TYPES)
+					continue;
+				++stats.attributeTypes[typeIdx];
+				auto &cattr = std::as_const(*attr); // The non-const getters would copy shared values
+				if(auto *str = cattr.GetString())
+					dictionary.insert(*str);
+				else if(auto items = cattr.GetArray()) {
+					stats.arrayItemTypes[typeIdx] += items->size();
+					stats.numArrayItems += items->size();
+					stats.maxArraySize = std::max(stats.maxArraySize, items->size());
+					++stats.arraySizes[get_array_size_bucket(items->size())];
+				}
+			}
+		}
+		stats.dictionarySize = dictionary.size();
+		auto memoryUsage = fileData.GetMemoryUsage();
+		stats.memory = memoryUsage.total;
+		stats.memoryUsage = memoryUsage.total.GetTotal();
+		for(auto &[type, usage] : memoryUsage.elementTypes)
+			stats.elementTypeMemory[type] = usage.GetTotal();
+		for(size_t i = 0; i < NUM_ATTRIBUTE_TYPES; ++i)
+			stats.attributeTypeMemory[i] = memoryUsage.attributeTypes[i].GetTotal();
+		return stats;
+	}
+
+	static std::vector<uint8_t> read_file(const std::filesystem::path &path)
+	{
+		std::ifstream in {path, std::ios::binary | std::ios::ate};
+		if(!in)
+			throw std::runtime_error {"Unable to open file!"};
+		std::vector<uint8_t> data {};
+		data.resize(static_cast<size_t>(in.tellg()));
+		in.seekg(0);
+		if(!in.read(reinterpret_cast<char *>(data.data()), data.size()))
+			throw std::runtime_error {"Unable to read file!"};
+		return data;
+	}
+
+	static uint64_t get_process_id()
+	{
+#ifdef _WIN32
+		return static_cast<uint64_t>(_getpid());
+#else
+		return static_cast<uint64_t>(getpid());
+#endif
+	}
+
+	static void write_file(const std::filesystem::path &path, const std::vector<uint8_t> &data)
+	{
+		std::error_code ec;
+		if(path.has_parent_path())
+			std::filesystem::create_directories(path.parent_path(), ec);
+		// Write to a temporary file first, so that the output is never left partially written. This also allows
+		// converting files in-place.
+		// The process id and a random number keep concurrent conversions, in this or other processes, from colliding
+		thread_local std::mt19937_64 rng {std::random_device {}()};
+		auto tmpPath = path;
+		tmpPath += "." + std::to_string(get_process_id()) + "." + std::to_string(rng()) + ".tmp";
+		{
+			std::ofstream out {tmpPath, std::ios::binary | std::ios::trunc};
+			if(out)
+				out.write(reinterpret_cast<const char *>(data.data()), data.size());
+			if(!out) {
+				out.close();
+				std::filesystem::remove(tmpPath, ec);
+				throw std::runtime_error {"Unable to write file '" + path.string() + "'!"};
+			}
+		}
+		std::filesystem::rename(tmpPath, path, ec);
+		if(ec) {
+			std::filesystem::remove(tmpPath, ec);
+			throw std::runtime_error {"Unable to write file '" + path.string() + "'!"};
+		}
+	}
+
+	static void process_file(const Options &options, const InputFile &input, dmx::LoaderContext &context, FileReport &report)
+	{
+		auto t = Clock::now();
+		auto data = read_file(input.path);
+		report.fileSize = data.size();
+		report.times.read = get_seconds_since(t);
+
+		t = Clock::now();
+		std::shared_ptr<ufile::IFile> f = std::make_shared<ufile::VectorFile>(std::move(data));
+		report.compressed = (dmx::detect_compression(*f) != dmx::Compression::None);
+		f = dmx::open_decompressed(f);
+		auto header = dmx::FileData::Probe(f);
+		if(!header)
+			throw std::runtime_error {"Not a valid dmx file!"};
+		report.encoding = header->GetEncoding();
+		report.encodingVersion = header->encodingVersion;
+		report.format = header->GetFormat();
+		report.formatVersion = header->formatVersion;
+		auto fileData = dmx::FileData::Load(f, {}, context);
+		f = nullptr;
+		report.times.load = get_seconds_since(t);
+
+		t = Clock::now();
+		report.statistics = analyze(*fileData);
+		report.times.analyze = get_seconds_since(t);
+
+		if(options.command != Command::Convert)
+			return;
+		t = Clock::now();
+		dmx::SaveOptions saveOptions {};
+		saveOptions.encoding = options.encoding;
+		if(report.format.empty() == false) {
+			saveOptions.format = report.format;
+			saveOptions.formatVersion = report.formatVersion;
+		}
+		auto out = std::make_shared<ufile::VectorFile>();
+		fileData->Save(*out, saveOptions);
+		if(options.compression != dmx::Compression::None) {
+			auto compressed = std::make_shared<ufile::VectorFile>();
+			out->Seek(0);
+			dmx::CompressionOptions compressionOptions {};
+			compressionOptions.compression = options.compression;
+			dmx::compress_dmx(*out, *compressed, compressionOptions);
+			out = compressed;
+		}
+		report.times.save = get_seconds_since(t);
+
+		t = Clock::now();
+		auto &outData = out->GetVector();
+		report.outputSize = outData.size();
+		write_file(*options.outputDirectory / input.relativePath, outData);
+		report.times.write = get_seconds_since(t);
+	}
+
+	static bool is_dmx_file(const std::filesystem::path &path)
+	{
+		auto ext = path.extension().string();
+		std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+		return ext == ".dmx" || ext == ".pcf";
+	}
+
+	static std::vector<InputFile> collect_input_files(const std::vector<std::filesystem::path> &inputs)
+	{
+		std::vector<InputFile> files {};
+		for(auto &input : inputs) {
+			std::error_code ec;
+			if(std::filesystem::is_directory(input, ec) == false) {
+				files.push_back({input, input.filename()});
+				continue;
+			}
+			auto firstFile = files.size();
+			for(auto it = std::filesystem::recursive_directory_iterator {input, ec}; !ec && it != std::filesystem::recursive_directory_iterator {}; it.increment(ec)) {
+				if(it->is_regular_file(ec) && is_dmx_file(it->path()))
+					files.push_back({it->path(), it->path().lexically_relative(input)});
+			}
+			if(ec)
+				std::fprintf(stderr, "Unable to read directory '%s': %s\n", input.string().c_str(), ec.message().c_str());
+			// Directory iteration order is unspecified
+			std::sort(files.begin() + firstFile, files.end(), [](const InputFile &a, const InputFile &b) { return a.path < b.path; });
+		}
+		return files;
+	}
+
+	static std::vector<FileReport> process_files(const Options &options, const std::vector<InputFile> &files)
+	{
+		std::vector<FileReport> reports {};
+		reports.resize(files.size());
+		std::atomic<size_t> nextFile = 0;
+		auto numJobs = std::min<size_t>(options.numJobs, files.size());
+		std::vector<std::jthread> workers {};
+		workers.reserve(numJobs);
+		for(size_t i = 0; i < numJobs; ++i) {
+			workers.emplace_back([&]() {
+				dmx::LoaderContext context {};
+				for(auto idx = nextFile++; idx < files.size(); idx = nextFile++) {
+					reports[idx].input = &files[idx];
+					try {
+						process_file(options, files[idx], context, reports[idx]);
+					}
+					catch(const std::exception &e) {
+						reports[idx].error = e.what();
+					}
+				}
+			});
+		}
+		workers.clear();
+		return reports;
+	}
+
+	static void print_csv(const Options &options, const std::vector<FileReport> &reports)
+	{
+		std::printf("path,error,file_size,output_size,compressed,encoding,encoding_version,format,format_version,elements,attributes,array_items,dictionary_size,max_array_size,memory_usage,read_ms,load_ms,analyze_ms,save_ms,write_ms\n");
+		for(auto &report : reports) {
+			auto &stats = report.statistics;
+			auto error = report.error;
+			std::replace(error.begin(), error.end(), '"', '\'');
+			std::printf("\"%s\",\"%s\",%llu,%llu,%d,%s,%u,%s,%u,%zu,%zu,%zu,%zu,%zu,%llu,%.3f,%.3f,%.3f,%.3f,%.3f\n", report.input->path.string().c_str(), error.c_str(), static_cast<unsigned long long>(report.fileSize), static_cast<unsigned long long>(report.outputSize), report.compressed ? 1 : 0,
+			  report.encoding.c_str(), report.encodingVersion, report.format.c_str(), report.formatVersion, stats.numElements, stats.numAttributes, stats.numArrayItems, stats.dictionarySize, stats.maxArraySize, static_cast<unsigned long long>(stats.memoryUsage), report.times.read * 1'000.0,
+			  report.times.load * 1'000.0, report.times.analyze * 1'000.0, report.times.save * 1'000.0, report.times.write * 1'000.0);
+		}
+	}
+
+	static void print_statistics(const Statistics &stats, const std::string &indent)
+	{
+		std::printf("%sElements: %zu, attributes: %zu, array items: %zu, dictionary strings: %zu\n", indent.c_str(), stats.numElements, stats.numAttributes, stats.numArrayItems, stats.dictionarySize);
+		std::printf("%sMemory after load: %s (payload %s, strings %s, overhead %s, lookup tables %s)\n", indent.c_str(), format_bytes(stats.memoryUsage).c_str(), format_bytes(stats.memory.payload).c_str(), format_bytes(stats.memory.strings).c_str(),
+		  format_bytes(stats.memory.overhead).c_str(), format_bytes(stats.memory.lookupTables).c_str());
+
+		std::vector<std::pair<std::string, size_t>> elementTypes {stats.elementTypes.begin(), stats.elementTypes.end()};
+		std::stable_sort(elementTypes.begin(), elementTypes.end(), [](auto &a, auto &b) { return a.second > b.second; });
+		std::printf("%s%-34s %10s %12s\n", indent.c_str(), "Element types:", "elements", "memory");
+		for(auto &[type, count] : elementTypes) {
+			auto it = stats.elementTypeMemory.find(type);
+			std::printf("%s  %-32s %10zu %12s\n", indent.c_str(), type.c_str(), count, format_bytes((it != stats.elementTypeMemory.end()) ? it->second : 0).c_str());
+		}
+
+		std::printf("%s%-34s %10s %12s %12s\n", indent.c_str(), "Attribute types:", "attributes", "memory", "array items");
+		for(size_t i = 0; i < NUM_ATTRIBUTE_TYPES; ++i) {
+			if(stats.attributeTypes[i] == 0)
+				continue;
+			auto type = static_cast<dmx::AttrType>(i);
+			std::printf("%s  %-32s %10zu %12s", indent.c_str(), dmx::type_to_string(type).c_str(), stats.attributeTypes[i], format_bytes(stats.attributeTypeMemory[i]).c_str());
+			if(dmx::is_array_type(type))
+				std::printf(" %12zu", stats.arrayItemTypes[i]);
+			std::printf("\n");
+		}
+
+		std::printf("%sArray sizes (max %zu):\n", indent.c_str(), stats.maxArraySize);
+		for(size_t i = 0; i < NUM_ARRAY_SIZE_BUCKETS; ++i) {
+			if(stats.arraySizes[i] > 0)
+				std::printf("%s  %-32s %10zu\n", indent.c_str(), get_array_size_bucket_name(i).c_str(), stats.arraySizes[i]);
+		}
+	}
+
+	static void print_report(const Options &options, const std::vector<FileReport> &reports, double wallTime)
+	{
+		auto convert = (options.command == Command::Convert);
+		std::printf("%-12s %-18s %10s %10s %10s %12s %10s %10s\n", "size", "encoding", "elements", "read ms", "load ms", "load rate", convert ? "save ms" : "memory", convert ? "output" : "mem/size");
+		Statistics totalStats {};
+		PhaseTimes totalTimes {};
+		uint64_t totalSize = 0;
+		uint64_t totalOutputSize = 0;
+		size_t numFailed = 0;
+		for(auto &report : reports) {
+			std::printf("%s\n", report.input->path.string().c_str());
+			if(report.error.empty() == false) {
+				std::printf("  error: %s\n", report.error.c_str());
+				++numFailed;
+				continue;
+			}
+			auto encoding = report.encoding + ' ' + std::to_string(report.encodingVersion) + (report.compressed ? "*" : "");
+			auto &stats = report.statistics;
+			std::array<char, 32> lastColumns[2];
+			if(convert) {
+				std::snprintf(lastColumns[0].data(), lastColumns[0].size(), "%.2f", (report.times.save + report.times.write) * 1'000.0);
+				std::snprintf(lastColumns[1].data(), lastColumns[1].size(), "%s", format_bytes(report.outputSize).c_str());
+			}
+			else {
+				std::snprintf(lastColumns[0].data(), lastColumns[0].size(), "%s", format_bytes(stats.memoryUsage).c_str());
+				std::snprintf(lastColumns[1].data(), lastColumns[1].size(), "%.1fx", (report.fileSize > 0) ? static_cast<double>(stats.memoryUsage) / report.fileSize : 0.0);
+			}
+			std::printf("  %-10s %-18s %10zu %10.2f %10.2f %12s %10s %10s\n", format_bytes(report.fileSize).c_str(), encoding.c_str(), stats.numElements, report.times.read * 1'000.0, report.times.load * 1'000.0, format_throughput(report.fileSize, report.times.load).c_str(), lastColumns[0].data(),
+			  lastColumns[1].data());
+			if(options.verbose)
+				print_statistics(stats, "  ");
+			totalStats.Merge(stats);
+			totalTimes.Merge(report.times);
+			totalSize += report.fileSize;
+			totalOutputSize += report.outputSize;
+		}
+
+		std::printf("\n%zu files, %zu failed (* = compressed)\n", reports.size(), numFailed);
+		std::printf("Input: %s, wall time: %.2f s, throughput: %s (%u jobs)\n", format_bytes(totalSize).c_str(), wallTime, format_throughput(totalSize, wallTime).c_str(), options.numJobs);
+		// Phase times are summed over all files, so with multiple jobs they exceed the wall time
+		std::printf("Phase times: read %.2f s (%s), load %.2f s (%s), analyze %.2f s", totalTimes.read, format_throughput(totalSize, totalTimes.read).c_str(), totalTimes.load, format_throughput(totalSize, totalTimes.load).c_str(), totalTimes.analyze);
+		if(convert)
+			std::printf(", save %.2f s, write %.2f s\nOutput: %s", totalTimes.save, totalTimes.write, format_bytes(totalOutputSize).c_str());
+		std::printf("\n");
+		print_statistics(totalStats, "");
+
+		// The files that are most likely responsible for load time and memory regressions
+		constexpr size_t numTopFiles = 10;
+		std::vector<const FileReport *> succeeded {};
+		for(auto &report : reports) {
+			if(report.error.empty())
+				succeeded.push_back(&report);
+		}
+		if(succeeded.size() < 2)
+			return;
+		auto printTop = [&](const char *title, auto &&getValue, auto &&formatValue) {
+			auto n = std::min(numTopFiles, succeeded.size());
+			std::partial_sort(succeeded.begin(), succeeded.begin() + n, succeeded.end(), [&](const FileReport *a, const FileReport *b) { return getValue(*a) > getValue(*b); });
+			std::printf("%s:\n", title);
+			for(size_t i = 0; i < n; ++i)
+				std::printf("  %12s  %s\n", formatValue(*succeeded[i]).c_str(), succeeded[i]->input->path.string().c_str());
+		};
+		printTop("Slowest loads", [](const FileReport &r) { return r.times.load; }, [](const FileReport &r) {
+			std::array<char, 32> buf;
+			std::snprintf(buf.data(), buf.size(), "%.2f ms", r.times.load * 1'000.0);
+			return std::string {buf.data()};
+		});
+		printTop("Largest memory footprints", [](const FileReport &r) { return r.statistics.memoryUsage; }, [](const FileReport &r) { return format_bytes(r.statistics.memoryUsage); });
+		printTop(
+		  "Largest memory footprints relative to file size", [](const FileReport &r) { return (r.fileSize > 0) ? static_cast<double>(r.statistics.memoryUsage) / r.fileSize : 0.0; },
+		  [](const FileReport &r) {
+			  std::array<char, 32> buf;
+			  std::snprintf(buf.data(), buf.size(), "%.1fx", (r.fileSize > 0) ? static_cast<double>(r.statistics.memoryUsage) / r.fileSize : 0.0);
+			  return std::string {buf.data()};
+		  });
+	}
+
+	static void print_usage()
+	{
+		std::printf("Usage: dmxtool <convert|stat> [options] <file|directory>...\n"
+		            "  convert                    Converts dmx files to another encoding\n"
+		            "  stat                       Prints statistics and load times of dmx files\n"
+		            "Directories are searched recursively for .dmx and .pcf files.\n"
+		            "Options:\n"
+		            "  -o, --output <directory>   Output directory of 'convert'. Files keep their path relative to the input directory,\n"
+		            "                             existing files are overwritten.\n"
+		            "  -e, --encoding <encoding>  Encoding of converted files, 'binary' (default) or 'keyvalues2'\n"
+		            "  -c, --compress <format>    Compresses converted files, 'zstd' or 'lz4'\n"
+		            "  -j, --jobs <count>         Number of files that are processed in parallel (default: number of hardware threads)\n"
+		            "  -v, --verbose              Prints the statistics of every file\n"
+		            "      --csv                  Prints one line of comma-separated values per file instead of the report\n");
+	}
+
+	static std::optional<Options> parse_arguments(int argc, char *argv[])
+	{
+		if(argc < 2)
+			return {};
+		Options options {};
+		std::string_view command {argv[1]};
+		if(command == "convert")
+			options.command = Command::Convert;
+		else if(command == "stat")
+			options.command = Command::Stat;
+		else {
+			std::fprintf(stderr, "Unknown command '%s'!\n", argv[1]);
+			return {};
+		}
+		for(int i = 2; i < argc; ++i) {
+			std::string_view arg {argv[i]};
+			auto getValue = [&]() -> std::optional<std::string_view> {
+				if(i + 1 >= argc) {
+					std::fprintf(stderr, "Missing value for option '%s'!\n", argv[i]);
+					return {};
+				}
+				return argv[++i];
+			};
+			if(arg == "-o" || arg == "--output") {
+				auto value = getValue();
+				if(!value)
+					return {};
+				options.outputDirectory = std::filesystem::path {*value};
+			}
+			else if(arg == "-e" || arg == "--encoding") {
+				auto value = getValue();
+				if(!value)
+					return {};
+				if(*value == "binary")
+					options.encoding = dmx::Encoding::Binary;
+				else if(*value == "keyvalues2" || *value == "kv2")
+					options.encoding = dmx::Encoding::KeyValues2;
+				else {
+					std::fprintf(stderr, "Unknown encoding '%s'!\n", std::string {*value}.c_str());
+					return {};
+				}
+			}
+			else if(arg == "-c" || arg == "--compress") {
+				auto value = getValue();
+				if(!value)
+					return {};
+				if(*value == "zstd")
+					options.compression = dmx::Compression::Zstd;
+				else if(*value == "lz4")
+					options.compression = dmx::Compression::Lz4;
+				else {
+					std::fprintf(stderr, "Unknown compression format '%s'!\n", std::string {*value}.c_str());
+					return {};
+				}
+				if(dmx::is_compression_supported(options.compression) == false) {
+					std::fprintf(stderr, "Compression format '%s' is not supported by this build!\n", std::string {*value}.c_str());
+					return {};
+				}
+			}
+			else if(arg == "-j" || arg == "--jobs") {
+				auto value = getValue();
+				if(!value)
+					return {};
+				options.numJobs = static_cast<uint32_t>(std::strtoul(std::string {*value}.c_str(), nullptr, 10));
+			}
+			else if(arg == "-v" || arg == "--verbose")
+				options.verbose = true;
+			else if(arg == "--csv")
+				options.csv = true;
+			else if(arg.starts_with('-')) {
+				std::fprintf(stderr, "Unknown option '%s'!\n", argv[i]);
+				return {};
+			}
+			else
+				options.inputs.push_back(std::filesystem::path {arg});
+		}
+		if(options.inputs.empty()) {
+			std::fprintf(stderr, "No input files specified!\n");
+			return {};
+		}
+		if(options.command == Command::Convert && !options.outputDirectory) {
+			std::fprintf(stderr, "The convert command requires an output directory!\n");
+			return {};
+		}
+		if(options.numJobs == 0)
+			options.numJobs = std::max(std::thread::hardware_concurrency(), 1u);
+		return options;
+	}
+};
+
+int main(int argc, char *argv[])
+{
+	auto options = dmxtool::parse_arguments(argc, argv);
+	if(!options) {
+		dmxtool::print_usage();
+		return 2;
+	}
+	auto files = dmxtool::collect_input_files(options->inputs);
+	auto t = dmxtool::Clock::now();
+	auto reports = dmxtool::process_files(*options, files);
+	auto wallTime = dmxtool::get_seconds_since(t);
+	if(options->csv)
+		dmxtool::print_csv(*options, reports);
+	else
+		dmxtool::print_report(*options, reports, wallTime);
+	auto failed = std::any_of(reports.begin(), reports.end(), [](const dmxtool::FileReport &report) { return report.error.empty() == false; });
+	return failed ? 1 : 0;
+}